@@ -4,6 +4,7 @@ pub fn build(b: *std.Build) void {
     const target = b.standardTargetOptions(.{});
     const optimize = b.standardOptimizeOption(.{ .preferred_optimize_mode = .ReleaseFast });
     const strip = b.option(bool, "strip", "Strip symbols from the binary. Default: false") orelse false;
+    const zstd = b.option(bool, "zstd", "Read .zst compressed inputs, links libzstd. Default: false") orelse false;
 
     // Create the executable
     const bin = b.addExecutable(.{
@@ -17,18 +18,42 @@ pub fn build(b: *std.Build) void {
     // Add C source files
     bin.addCSourceFiles(.{
         .files = &.{
+            "src/async.c",
+            "src/cache.c",
+            "src/job.c",
             "src/main.c",
+            "src/pmu.c",
+            "src/pool.c",
+            "src/scale.c",
+            "src/serve.c",
+            "src/tee.c",
+            "src/uring.c",
             "src/util.c",
+            "src/wmap.c",
             "src/xpsnr.c",
+            "src/zst.c",
         },
         .flags = &.{
             "-std=c99",
             "-lm",
+            "-fno-math-errno", // lets sqrt() vectorize, the results are the same
             "-Wall",
             "-Wextra",
             "-Wpedantic",
         },
     });
 
+    // Worker threads, shm_open() for -serve= frame handles
+    if (target.result.os.tag != .windows) {
+        bin.linkSystemLibrary("pthread");
+    }
+    if (target.result.os.tag == .linux) {
+        bin.linkSystemLibrary("rt");
+    }
+    if (zstd) {
+        bin.root_module.addCMacro("SXPSNR_ZSTD", "1");
+        bin.linkSystemLibrary("zstd");
+    }
+
     b.installArtifact(bin);
 }
@@ -0,0 +1,369 @@
+/*****************************************************************************/
+/*
+ * Python bindings for XPSNR.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "xpsnr.h"
+
+typedef struct {
+    PyObject_HEAD
+    XPSNRContext s;
+    XPSNR_META md;
+    int w[3], h[3]; /* geometry of the first frame, 0 before it */
+    int busy; /* a push() is running, possibly without the GIL */
+} CONTEXT;
+
+/* the buffers of one frame, held while it is scored so they stay put */
+typedef struct {
+    Py_buffer view[3];
+    int nview;
+} HELD;
+
+static void
+release_frame(HELD *held)
+{
+    int i;
+
+    for (i = 0; i < held->nview; i++) {
+        PyBuffer_Release(&held->view[i]);
+    }
+    held->nview = 0;
+}
+
+/* 1 if the struct format of a buffer is a single unsigned byte */
+static int
+is_u8(const char *fmt)
+{
+    if (fmt == NULL) { /* plain bytes */
+        return 1;
+    }
+    if (strchr("@=<>!", fmt[0]) != NULL) {
+        fmt++;
+    }
+    return strcmp(fmt, "B") == 0;
+}
+
+/* describe a 2-D buffer of 8 bit samples as a plane, in place with its
+ * strides. 0 with an exception set if it can't be one */
+static int
+get_plane(PyObject *o, Py_buffer *v, XPSNR_PLANE *p)
+{
+    if (PyObject_GetBuffer(o, v, PyBUF_STRIDED_RO | PyBUF_FORMAT) < 0) {
+        return 0;
+    }
+    if (v->ndim != 2 || v->itemsize != 1 || !is_u8(v->format)) {
+        PyErr_SetString(PyExc_TypeError, "a plane is a 2-D buffer of uint8 samples");
+        PyBuffer_Release(v);
+        return 0;
+    }
+    /* accum() indexes samples with an int from the first one */
+    if (v->shape[0] < 1 || v->shape[1] < 1 || v->shape[0] > INT_MAX || v->shape[1] > INT_MAX
+            || v->strides[0] < 1 || v->strides[1] < 1
+            || v->strides[0] > INT_MAX || v->strides[1] > INT_MAX
+            || (v->shape[0] - 1) * v->strides[0] + (v->shape[1] - 1) * v->strides[1] >= INT_MAX) {
+        PyErr_SetString(PyExc_ValueError, "planes need positive strides and fewer than 2 GB between the first and the last sample");
+        PyBuffer_Release(v);
+        return 0;
+    }
+    p->data = (uint8_t *) v->buf;
+    p->h = (int) v->shape[0];
+    p->w = (int) v->shape[1];
+    p->stride = (int) v->strides[0];
+    p->step = (int) v->strides[1];
+    p->len = (p->h - 1) * p->stride + (p->w - 1) * p->step + 1;
+    p->format = 0;
+    return 1;
+}
+
+/* a frame is a sequence of the Y, U and V planes. when only the luma is
+ * scored a single plane will do as well */
+static int
+get_frame(CONTEXT *c, PyObject *o, HELD *held, XPSNR_FRAME *f)
+{
+    const int n = (c->md.planes == 1 ? 1 : 3);
+    PyObject *seq;
+    int i;
+
+    memset(f, 0, sizeof(XPSNR_FRAME));
+    held->nview = 0;
+    if (n == 1 && PyObject_CheckBuffer(o)) {
+        if (!get_plane(o, &held->view[0], &f->planes[0])) {
+            return 0;
+        }
+        held->nview = 1;
+        return 1;
+    }
+    seq = PySequence_Fast(o, "a frame is a sequence of the Y, U and V planes");
+    if (seq == NULL) {
+        return 0;
+    }
+    if (PySequence_Fast_GET_SIZE(seq) != 3 && !(n == 1 && PySequence_Fast_GET_SIZE(seq) == 1)) {
+        PyErr_SetString(PyExc_ValueError, "a frame is a sequence of the Y, U and V planes");
+        Py_DECREF(seq);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (!get_plane(PySequence_Fast_GET_ITEM(seq, i), &held->view[i], &f->planes[i])) {
+            Py_DECREF(seq);
+            release_frame(held);
+            return 0;
+        }
+        held->nview++;
+    }
+    Py_DECREF(seq);
+    return 1;
+}
+
+/* both frames need the geometry of the first, which the sums are for */
+static int
+same_geometry(CONTEXT *c, XPSNR_FRAME *orig, XPSNR_FRAME *recon)
+{
+    const int n = (c->md.planes == 1 ? 1 : 3);
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (orig->planes[i].w != recon->planes[i].w || orig->planes[i].h != recon->planes[i].h) {
+            PyErr_SetString(PyExc_ValueError, "the planes of the two frames differ in size");
+            return 0;
+        }
+    }
+    if (xpsnr_block_size(orig->planes[0].w, orig->planes[0].h) == 0) {
+        PyErr_SetString(PyExc_ValueError, "the picture is too small to be scored");
+        return 0;
+    }
+    if (c->w[0] == 0) {
+        for (i = 0; i < 3; i++) {
+            c->w[i] = orig->planes[i].w;
+            c->h[i] = orig->planes[i].h;
+        }
+        c->md.width = c->w[0];
+        c->md.height = c->h[0];
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        if (orig->planes[i].w != c->w[i] || orig->planes[i].h != c->h[i]) {
+            PyErr_SetString(PyExc_ValueError, "every frame needs the size of the first, reset() to change it");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int
+context_init(CONTEXT *c, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "fps_num", "fps_den", "planes", NULL };
+    int fps_num = 30, fps_den = 1, planes = 3;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iii:Context", kwlist,
+            &fps_num, &fps_den, &planes)) {
+        return -1;
+    }
+    if (fps_num < 1 || fps_den < 1) {
+        PyErr_SetString(PyExc_ValueError, "fps_num and fps_den must be positive");
+        return -1;
+    }
+    if (planes != 1 && planes != 3) {
+        PyErr_SetString(PyExc_ValueError, "planes must be 1 (luma only) or 3");
+        return -1;
+    }
+    if (c->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is busy in another thread");
+        return -1;
+    }
+    xpsnr_release(&c->s);
+    memset(&c->s, 0, sizeof(XPSNRContext));
+    memset(&c->md, 0, sizeof(XPSNR_META));
+    memset(c->w, 0, sizeof(c->w));
+    memset(c->h, 0, sizeof(c->h));
+    c->md.fps_num = fps_num;
+    c->md.fps_den = fps_den;
+    c->md.planes = planes;
+    return 0;
+}
+
+static void
+context_dealloc(CONTEXT *c)
+{
+    xpsnr_release(&c->s);
+    Py_TYPE(c)->tp_free((PyObject *) c);
+}
+
+static PyObject *
+context_push(CONTEXT *c, PyObject *args)
+{
+    XPSNRContext *s = &c->s;
+    PyObject *ref, *dst;
+    XPSNR_FRAME orig, recon;
+    HELD ho, hr;
+    double wd[3], xp[3], cur[3];
+    int i;
+
+    if (!PyArg_ParseTuple(args, "OO:push", &ref, &dst)) {
+        return NULL;
+    }
+    /* getting the buffers may run Python code that lets other threads in */
+    if (c->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is busy in another thread");
+        return NULL;
+    }
+    c->busy = 1;
+    if (!get_frame(c, ref, &ho, &orig)) {
+        c->busy = 0;
+        return NULL;
+    }
+    if (!get_frame(c, dst, &hr, &recon)) {
+        release_frame(&ho);
+        c->busy = 0;
+        return NULL;
+    }
+    if (!same_geometry(c, &orig, &recon)) {
+        release_frame(&ho);
+        release_frame(&hr);
+        c->busy = 0;
+        return NULL;
+    }
+
+    /* score the frame on its own, the totals add up in the same order */
+    for (i = 0; i < 3; i++) {
+        wd[i] = s->sumWDist[i];
+        xp[i] = s->sumXPSNR[i];
+        s->sumWDist[i] = 0.0;
+        s->sumXPSNR[i] = 0.0;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    accum(s, &orig, &recon, &c->md);
+    Py_END_ALLOW_THREADS
+    for (i = 0; i < 3; i++) {
+        cur[i] = (i < s->numComps ? s->sumXPSNR[i] : NAN);
+        s->sumWDist[i] = wd[i] + s->sumWDist[i];
+        s->sumXPSNR[i] = xp[i] + s->sumXPSNR[i];
+    }
+    s->numFrames64++;
+
+    release_frame(&ho);
+    release_frame(&hr);
+    c->busy = 0;
+    return Py_BuildValue("(ddd)", cur[0], cur[1], cur[2]);
+}
+
+static PyObject *
+context_finalize(CONTEXT *c, PyObject *unused)
+{
+    const XPSNRContext *s = &c->s;
+    double v[3];
+    int i;
+
+    (void) unused;
+    if (c->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is busy in another thread");
+        return NULL;
+    }
+    for (i = 0; i < 3; i++) {
+        v[i] = NAN;
+        if (i == 0 || c->md.planes != 1) {
+            v[i] = getAvgXPSNR(s->sumWDist[i], s->sumXPSNR[i], c->w[i], c->h[i],
+                               s->maxError64, s->numFrames64);
+        }
+    }
+    return Py_BuildValue("(ddd)", v[0], v[1], v[2]);
+}
+
+static PyObject *
+context_reset(CONTEXT *c, PyObject *unused)
+{
+    (void) unused;
+    if (c->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is busy in another thread");
+        return NULL;
+    }
+    xpsnr_reset(&c->s);
+    memset(c->w, 0, sizeof(c->w));
+    memset(c->h, 0, sizeof(c->h));
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+context_frames(CONTEXT *c, void *closure)
+{
+    (void) closure;
+    return PyLong_FromUnsignedLongLong((unsigned long long) c->s.numFrames64);
+}
+
+static PyMethodDef context_methods[] = {
+    { "push", (PyCFunction) context_push, METH_VARARGS,
+        "push(ref, dst) -> (y, u, v)\n\n"
+        "Score a distorted frame against its reference and add it to the sums.\n"
+        "A frame is a sequence of the Y, U and V planes, each a 2-D uint8 buffer\n"
+        "(NumPy array, memoryview, ...) that is read in place with its strides,\n"
+        "so slices and the interleaved chroma of NV12 need no copy. With\n"
+        "planes=1 a single Y plane will do. Returns the XPSNR of this frame,\n"
+        "NaN for planes that are not scored. The GIL is released while scoring." },
+    { "finalize", (PyCFunction) context_finalize, METH_NOARGS,
+        "finalize() -> (y, u, v)\n\n"
+        "The XPSNR of the frames pushed so far, as printed by sxpsnr." },
+    { "reset", (PyCFunction) context_reset, METH_NOARGS,
+        "reset()\n\n"
+        "Clear the sums and the temporal history to score another sequence,\n"
+        "which may have another size. The buffers are kept." },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef context_getset[] = {
+    { "frames", (getter) context_frames, NULL, "number of frames pushed", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyTypeObject context_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "sxpsnr.Context",
+    .tp_basicsize = sizeof(CONTEXT),
+    .tp_dealloc = (destructor) context_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Context(fps_num=30, fps_den=1, planes=3)\n\n"
+              "XPSNR of a sequence of frames. planes=1 scores the luma alone.\n"
+              "Contexts are independent, several can score from threads at once.",
+    .tp_methods = context_methods,
+    .tp_getset = context_getset,
+    .tp_init = (initproc) context_init,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef sxpsnr_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "sxpsnr",
+    .m_doc = "XPSNR of 8 bit YUV frames held in NumPy arrays or other buffers.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC
+PyInit_sxpsnr(void)
+{
+    PyObject *m;
+
+    if (PyType_Ready(&context_type) < 0) {
+        return NULL;
+    }
+    m = PyModule_Create(&sxpsnr_module);
+    if (m == NULL) {
+        return NULL;
+    }
+    Py_INCREF(&context_type);
+    if (PyModule_AddObject(m, "Context", (PyObject *) &context_type) < 0) {
+        Py_DECREF(&context_type);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
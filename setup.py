@@ -0,0 +1,17 @@
+# Python bindings, see python/sxpsnrmodule.c. pip install .
+from setuptools import setup, Extension
+
+setup(
+    name="sxpsnr",
+    version="0.1.0",
+    description="Standalone XPSNR for frames in NumPy arrays or other buffers",
+    ext_modules=[
+        Extension(
+            "sxpsnr",
+            sources=["python/sxpsnrmodule.c", "src/xpsnr.c"],
+            include_dirs=["src"],
+            # as build.zig, lets sqrt() vectorize with the same results
+            extra_compile_args=["-fno-math-errno"],
+        )
+    ],
+)
@@ -0,0 +1,338 @@
+/*****************************************************************************/
+/*
+ * Asynchronous frame scoring for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#include "async.h"
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* one frame in flight, frame n lives in slot n % depth */
+typedef struct {
+    XPSNR_ASYNC *a;
+    uint64_t frame;
+    XPSNR_FRAME org; /* planar copies, stride = width */
+    XPSNR_FRAME rec;
+    XPSNR_META md;
+    uint8_t *buf;
+    double *sse;
+    double *weights;
+    XPSNR_DONE cb;
+    void *user;
+    int weighed;
+    int measured; /* block SSE done */
+    int failed; /* no weights, the frame is not added */
+} SLOT;
+
+struct XPSNR_ASYNC {
+    XPSNRContext *s;
+    POOL *pool;
+    SLOT *slot;
+    int depth;
+    int w[3], h[3]; /* geometry of the first frame, 0 before it */
+    int planes;
+    pthread_mutex_t lock;
+    pthread_cond_t room; /* a frame was delivered */
+    uint64_t submitted;
+    uint64_t weighed; /* next frame to weigh */
+    uint64_t done; /* next frame to deliver */
+    int weighing; /* a weigh task is queued or running */
+    int adding; /* some thread is delivering frames */
+    int failed; /* a frame could not be weighed, the history is off from then on */
+};
+
+/* add the frames that are complete to the sums, in order. whoever finds the
+ * next frame complete delivers it and any that are ready behind it */
+static void
+deliver(XPSNR_ASYNC *a)
+{
+    double v[3];
+
+    pthread_mutex_lock(&a->lock);
+    while (!a->adding && a->done < a->submitted) {
+        SLOT *sl = &a->slot[a->done % a->depth];
+
+        if (!sl->weighed || !sl->measured) {
+            break;
+        }
+        a->adding = 1;
+        pthread_mutex_unlock(&a->lock);
+
+        if (!sl->failed) {
+            xpsnr_add(a->s, &sl->org, &sl->md, sl->sse, sl->weights, v);
+        }
+        if (sl->cb != NULL) {
+            sl->cb(sl->user, sl->frame, sl->failed ? NULL : v);
+        }
+
+        pthread_mutex_lock(&a->lock);
+        a->adding = 0;
+        a->done++;
+        pthread_cond_broadcast(&a->room);
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* weights of one frame, then hands the history on to the next one. once a
+ * frame fails, the history is off for all the frames after it */
+static void
+weigh_task(void *arg, int worker)
+{
+    SLOT *sl = arg;
+    XPSNR_ASYNC *a = sl->a;
+    SLOT *next = NULL;
+    int failed;
+
+    pthread_mutex_lock(&a->lock);
+    failed = a->failed;
+    pthread_mutex_unlock(&a->lock);
+    if (!failed) {
+        failed = !xpsnr_weigh(a->s, &sl->org, &sl->md, sl->weights);
+    }
+
+    pthread_mutex_lock(&a->lock);
+    sl->failed = failed;
+    a->failed |= failed;
+    sl->weighed = 1;
+    a->weighed++;
+    if (a->weighed < a->submitted) {
+        next = &a->slot[a->weighed % a->depth];
+    } else {
+        a->weighing = 0;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    if (next != NULL) {
+        pool_submit(a->pool, worker, weigh_task, next);
+    }
+    deliver(a);
+}
+
+static void
+sse_task(void *arg, int worker)
+{
+    SLOT *sl = arg;
+    XPSNR_ASYNC *a = sl->a;
+
+    (void) worker;
+    xpsnr_block_sse(&sl->org, &sl->rec, &sl->md, sl->sse);
+
+    pthread_mutex_lock(&a->lock);
+    sl->measured = 1;
+    pthread_mutex_unlock(&a->lock);
+    deliver(a);
+}
+
+/* size the slots for the geometry of the first frame, 0 if out of memory */
+static int
+alloc_slots(XPSNR_ASYNC *a, XPSNR_FRAME *orig, XPSNR_META *meta)
+{
+    const uint32_t nsse = xpsnr_sse_count(orig, meta);
+    const uint32_t nwgt = xpsnr_block_count(orig->planes[0].w, orig->planes[0].h);
+    size_t len = 0;
+    int i, c;
+
+    for (c = 0; c < 3; c++) {
+        a->w[c] = orig->planes[c].w;
+        a->h[c] = orig->planes[c].h;
+        if (c == 0 || meta->planes != 1) {
+            len += (size_t) a->w[c] * a->h[c];
+        }
+    }
+    a->planes = meta->planes;
+    for (i = 0; i < a->depth; i++) {
+        SLOT *sl = &a->slot[i];
+        uint8_t *p;
+
+        sl->a = a;
+        sl->buf = xpsnr_alloc(2 * len, sizeof(FRAME_ELEM_TYPE));
+        sl->sse = xpsnr_alloc(nsse, sizeof(double));
+        sl->weights = xpsnr_alloc(nwgt + 1, sizeof(double));
+        if (sl->buf == NULL || sl->sse == NULL || sl->weights == NULL) {
+            for (; i >= 0; i--) {
+                xpsnr_free(a->slot[i].buf);
+                xpsnr_free(a->slot[i].sse);
+                xpsnr_free(a->slot[i].weights);
+                memset(&a->slot[i], 0, sizeof(SLOT));
+            }
+            a->w[0] = 0;
+            return 0;
+        }
+        p = sl->buf;
+        for (c = 0; c < 3; c++) {
+            XPSNR_PLANE *o = &sl->org.planes[c];
+            XPSNR_PLANE *r = &sl->rec.planes[c];
+
+            o->w = r->w = a->w[c];
+            o->h = r->h = a->h[c];
+            o->stride = r->stride = a->w[c];
+            o->step = r->step = 1;
+            o->len = r->len = a->w[c] * a->h[c];
+            o->data = r->data = NULL;
+            if (c > 0 && meta->planes == 1) {
+                continue;
+            }
+            o->data = p;
+            p += (size_t) o->len;
+            r->data = p;
+            p += (size_t) r->len;
+        }
+    }
+    return 1;
+}
+
+/* planar copy of the planes of f that are scored */
+static void
+copy_frame(XPSNR_FRAME *dst, XPSNR_FRAME *f)
+{
+    int c, x, y;
+
+    for (c = 0; c < 3; c++) {
+        XPSNR_PLANE *d = &dst->planes[c];
+        const XPSNR_PLANE *p = &f->planes[c];
+        const int step = (p->step > 1 ? p->step : 1);
+
+        if (d->data == NULL) {
+            continue;
+        }
+        for (y = 0; y < d->h; y++) {
+            const uint8_t *src = p->data + (size_t) y * p->stride;
+            uint8_t *row = d->data + (size_t) y * d->w;
+
+            if (step == 1) {
+                memcpy(row, src, d->w);
+                continue;
+            }
+            for (x = 0; x < d->w; x++) {
+                row[x] = src[x * step];
+            }
+        }
+    }
+}
+
+extern XPSNR_ASYNC *
+xpsnr_async_open(XPSNRContext *s, int threads, int depth)
+{
+    XPSNR_ASYNC *a;
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    a = calloc(1, sizeof(XPSNR_ASYNC));
+    if (a == NULL) {
+        return NULL;
+    }
+    a->s = s;
+    a->depth = (depth < 1 ? 2 * threads : depth);
+    a->slot = calloc(a->depth, sizeof(SLOT));
+    a->pool = pool_create(threads);
+    if (a->slot == NULL || a->pool == NULL) {
+        pool_destroy(a->pool);
+        free(a->slot);
+        free(a);
+        return NULL;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    pthread_cond_init(&a->room, NULL);
+    return a;
+}
+
+extern int
+xpsnr_submit(XPSNR_ASYNC *a, XPSNR_FRAME *orig, XPSNR_FRAME *recon, XPSNR_META *meta,
+             XPSNR_DONE cb, void *user)
+{
+    SLOT *sl;
+    int c, weigh = 0;
+
+    if (a->w[0] == 0) {
+        if (!alloc_slots(a, orig, meta)) {
+            return 0;
+        }
+    }
+    for (c = 0; c < 3; c++) {
+        if (orig->planes[c].w != a->w[c] || orig->planes[c].h != a->h[c]
+                || recon->planes[c].w != a->w[c] || recon->planes[c].h != a->h[c]) {
+            return 0;
+        }
+    }
+    if (meta->planes != a->planes) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    while (a->submitted - a->done >= (uint64_t) a->depth && !a->failed) {
+        pthread_cond_wait(&a->room, &a->lock);
+    }
+    if (a->failed) {
+        pthread_mutex_unlock(&a->lock);
+        return 0;
+    }
+    sl = &a->slot[a->submitted % a->depth];
+    pthread_mutex_unlock(&a->lock);
+
+    /* the slot is free and no task looks at it until it is counted */
+    copy_frame(&sl->org, orig);
+    copy_frame(&sl->rec, recon);
+    sl->md = *meta;
+    sl->cb = cb;
+    sl->user = user;
+    sl->weighed = 0;
+    sl->measured = 0;
+    sl->failed = 0;
+
+    pthread_mutex_lock(&a->lock);
+    sl->frame = a->submitted++;
+    if (!a->weighing) {
+        a->weighing = weigh = 1;
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    pool_submit(a->pool, -1, sse_task, sl);
+    if (weigh) {
+        pool_submit(a->pool, -1, weigh_task, sl);
+    }
+    return 1;
+}
+
+extern int
+xpsnr_flush(XPSNR_ASYNC *a)
+{
+    int ok;
+
+    pthread_mutex_lock(&a->lock);
+    while (a->done < a->submitted) {
+        pthread_cond_wait(&a->room, &a->lock);
+    }
+    ok = !a->failed;
+    pthread_mutex_unlock(&a->lock);
+    return ok;
+}
+
+extern void
+xpsnr_async_close(XPSNR_ASYNC *a)
+{
+    int i;
+
+    if (a == NULL) {
+        return;
+    }
+    xpsnr_flush(a);
+    pool_destroy(a->pool);
+    for (i = 0; i < a->depth; i++) {
+        xpsnr_free(a->slot[i].buf);
+        xpsnr_free(a->slot[i].sse);
+        xpsnr_free(a->slot[i].weights);
+    }
+    pthread_cond_destroy(&a->room);
+    pthread_mutex_destroy(&a->lock);
+    free(a->slot);
+    free(a);
+}
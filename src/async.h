@@ -0,0 +1,54 @@
+/*****************************************************************************/
+/*
+ * Asynchronous frame scoring for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _ASYNC_H_
+#define _ASYNC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xpsnr.h"
+
+/* called once per submitted frame, in submission order and never for two
+ * frames at once, from one of the worker threads. frame counts the
+ * submissions from 0, xpsnr is the XPSNR of Y, U and V of that frame alone,
+ * NAN for planes that are not scored. NULL if the frame could not be scored
+ * for lack of memory, it is then not in the sums */
+typedef void (*XPSNR_DONE)(void *user, uint64_t frame, const double *xpsnr);
+
+typedef struct XPSNR_ASYNC XPSNR_ASYNC;
+
+/* score frames into s on a pool of threads without making the caller wait
+ * for them. the weights of a frame depend on the originals before it, so
+ * they are computed one frame after the other, while the block SSE of the
+ * frames behind it runs on the other threads. at most depth frames are in
+ * flight (< 1 = twice the threads). s belongs to the pool until
+ * xpsnr_async_close() and should not have a mark callback.
+ * NULL if out of memory */
+extern XPSNR_ASYNC *xpsnr_async_open(XPSNRContext *s, int threads, int depth);
+/* queue a pair of frames. they are copied, so the caller can reuse them as
+ * soon as this returns. only blocks while depth frames are in flight.
+ * call from one thread, not from cb. all frames need the geometry and meta
+ * of the first. 0 if out of memory, the geometry changed or an earlier
+ * frame failed, as the history of the frames after it would be wrong */
+extern int xpsnr_submit(XPSNR_ASYNC *a, XPSNR_FRAME *orig, XPSNR_FRAME *recon, XPSNR_META *meta,
+                        XPSNR_DONE cb, void *user);
+/* wait until every submitted frame has been added to the sums of s and
+ * passed to its callback. as with accum(), counting the frames in
+ * s->numFrames64 is left to the caller. 0 if a frame failed */
+extern int xpsnr_flush(XPSNR_ASYNC *a);
+/* flush and stop the threads, s is left with its sums and history */
+extern void xpsnr_async_close(XPSNR_ASYNC *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+/*****************************************************************************/
+/*
+ * Result cache keys for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* bytes read at a time while hashing a file */
+#define HASH_CHUNK (1 << 20)
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3  1609587929392839161ULL
+#define P4  9650029242287828579ULL
+#define P5  2870177450012600261ULL
+
+static uint64_t
+rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+/* little endian on any host, so keys can be shared between machines */
+static uint64_t
+read64(const uint8_t *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24
+            | (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static uint64_t
+read32(const uint8_t *p)
+{
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24;
+}
+
+static uint64_t
+round64(uint64_t acc, uint64_t in)
+{
+    acc += in * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static uint64_t
+merge64(uint64_t acc, uint64_t v)
+{
+    acc ^= round64(0, v);
+    return acc * P1 + P4;
+}
+
+static void
+stripe(HASH64 *h, const uint8_t *p)
+{
+    h->v[0] = round64(h->v[0], read64(p));
+    h->v[1] = round64(h->v[1], read64(p + 8));
+    h->v[2] = round64(h->v[2], read64(p + 16));
+    h->v[3] = round64(h->v[3], read64(p + 24));
+}
+
+extern void
+hash64_init(HASH64 *h, uint64_t seed)
+{
+    memset(h, 0, sizeof(HASH64));
+    h->seed = seed;
+    h->v[0] = seed + P1 + P2;
+    h->v[1] = seed + P2;
+    h->v[2] = seed;
+    h->v[3] = seed - P1;
+}
+
+extern void
+hash64_update(HASH64 *h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    h->len += len;
+    if (h->nbuf > 0) {
+        size_t n = 32 - h->nbuf;
+
+        if (n > len) {
+            n = len;
+        }
+        memcpy(h->buf + h->nbuf, p, n);
+        h->nbuf += (int) n;
+        p += n;
+        len -= n;
+        if (h->nbuf < 32) {
+            return;
+        }
+        stripe(h, h->buf);
+        h->nbuf = 0;
+    }
+    for (; len >= 32; p += 32, len -= 32) {
+        stripe(h, p);
+    }
+    memcpy(h->buf, p, len);
+    h->nbuf = (int) len;
+}
+
+extern uint64_t
+hash64_final(const HASH64 *h)
+{
+    const uint8_t *p = h->buf;
+    int n = h->nbuf;
+    uint64_t r;
+
+    if (h->len >= 32) {
+        r = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        r = merge64(r, h->v[0]);
+        r = merge64(r, h->v[1]);
+        r = merge64(r, h->v[2]);
+        r = merge64(r, h->v[3]);
+    } else {
+        r = h->seed + P5;
+    }
+    r += h->len;
+    for (; n >= 8; p += 8, n -= 8) {
+        r ^= round64(0, read64(p));
+        r = rotl(r, 27) * P1 + P4;
+    }
+    if (n >= 4) {
+        r ^= read32(p) * P1;
+        r = rotl(r, 23) * P2 + P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        r ^= *p * P5;
+        r = rotl(r, 11) * P1;
+    }
+    r ^= r >> 33;
+    r *= P2;
+    r ^= r >> 29;
+    r *= P3;
+    r ^= r >> 32;
+    return r;
+}
+
+extern int
+cache_add_file(HASH64 *h, const char *path, int mode)
+{
+    struct stat st;
+    FILE *f;
+    uint8_t *buf;
+    size_t n;
+    int ok;
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    if (mode == CACHE_STAT) {
+        int64_t id[5];
+
+        id[0] = (int64_t) st.st_dev;
+        id[1] = (int64_t) st.st_ino;
+        id[2] = (int64_t) st.st_size;
+        id[3] = (int64_t) st.st_mtim.tv_sec;
+        id[4] = (int64_t) st.st_mtim.tv_nsec;
+        hash64_update(h, id, sizeof(id));
+        return 1;
+    }
+    f = fopen(path, "rb");
+    buf = malloc(HASH_CHUNK);
+    if (f == NULL || buf == NULL) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        free(buf);
+        return 0;
+    }
+    while ((n = fread(buf, 1, HASH_CHUNK, f)) > 0) {
+        hash64_update(h, buf, n);
+    }
+    ok = !ferror(f);
+    fclose(f);
+    free(buf);
+    return ok;
+}
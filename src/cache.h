@@ -0,0 +1,45 @@
+/*****************************************************************************/
+/*
+ * Result cache keys for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_CONTENT 0 /* inputs are known by a hash of their bytes */
+#define CACHE_STAT    1 /* by size, modification time and inode */
+
+/* streaming XXH64 */
+typedef struct {
+    uint64_t v[4];
+    uint64_t len;
+    uint8_t buf[32];
+    int nbuf;
+    uint64_t seed;
+} HASH64;
+
+extern void hash64_init(HASH64 *h, uint64_t seed);
+extern void hash64_update(HASH64 *h, const void *data, size_t len);
+extern uint64_t hash64_final(const HASH64 *h);
+
+/* add what identifies the file at path to h, its contents or its stat()
+ * identity depending on mode. 0 if it isn't a regular file or can't be
+ * read, the result must not be cached then */
+extern int cache_add_file(HASH64 *h, const char *path, int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,2748 @@
+/*****************************************************************************/
+/*
+ * Scoring jobs for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include "job.h"
+#include "util.h"
+#include "uring.h"
+#include "scale.h"
+#include "zst.h"
+#include "cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* a job is only split while both halves keep at least this many frames,
+ * so the warm-up frames of a donated chunk stay a small overhead */
+#define CHUNK_MIN 16
+/* frames of temporal history (bufOrgM1, bufOrgM2) a chunk must replay */
+#define CHUNK_WARMUP 2
+#define EXTRA_PAD 1
+/* frame pairs compared per candidate offset by -align= */
+#define ALIGN_FRAMES 24
+#define ALIGN_THUMB_SHIFT 3
+/* ref frames -autocrop looks at for borders */
+#define CROP_FRAMES 16
+/* a border row or column has at most this variance in every frame, and
+ * its mean moves by at most CROP_DRIFT between frames */
+#define CROP_VAR 2.0
+#define CROP_DRIFT 2.0
+/* contexts a worker keeps warm, one per recently seen geometry */
+#define CACHE_SLOTS 4
+/* two-sided 95% quantile of the normal distribution */
+#define SAMPLE_Z 1.959964
+#define CKPT_MAGIC "SXPSNRC3"
+#define CKPT_ENDIAN 0x01020304
+#define PART_MAGIC "SXPSNRP1"
+#define RESULT_MAGIC "SXPSNRR2"
+
+typedef struct {
+    XPSNRContext ctx;
+    uint8_t *refdata;
+    uint8_t *decdata;
+    size_t cap;
+    int w, h, subsamp;
+    unsigned long long lastuse;
+} WSLOT;
+
+typedef struct {
+    WSLOT slot[CACHE_SLOTS];
+    unsigned long long tick;
+} WCACHE;
+
+/* block weights of every frame of one reference file */
+typedef struct WENTRY {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtim, ctim;
+    long long hdrlen; /* first frame scored, ref frames before it are skipped */
+    int w, h, subsamp, scale;
+    int win[4];
+    unsigned frameRate;
+    long long nframes;
+    uint32_t nblk;
+    double *weights;
+    uint8_t *have; /* frames recorded so far */
+    JOB *owner; /* job recording into this entry */
+    int refs;
+    int stale; /* the file changed, freed once nobody uses it */
+    unsigned long long lastuse;
+    struct WENTRY *next;
+} WENTRY;
+
+struct RUNNER {
+    POOL *pool;
+    int nworkers;
+    WCACHE *cache;
+
+    pthread_mutex_t wlock;
+    WENTRY *wlist;
+    size_t wbytes;
+    size_t wbudget;
+    unsigned long long wtick;
+};
+
+/* followed by the xpsnr_save() state */
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    int32_t w, h, subsamp;
+    int32_t win[4];
+    int32_t fps_num, fps_den;
+    int32_t y4m;
+    int32_t offset;
+    int64_t start;
+    int64_t frame; /* next frame to score */
+    int64_t pos[2]; /* byte offset of that frame in ref and dst */
+    int64_t id[2][3]; /* size and mtime (s, ns) of ref and dst, -1 for pipes */
+} CKPT_HDR;
+
+/* partial record written by -part= */
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    int32_t fps_num, fps_den;
+    int32_t planeWidth[3];
+    int32_t planeHeight[3];
+    uint32_t andIsInf; /* bit per plane */
+    int64_t first, last; /* frames covered */
+    uint64_t numFrames64;
+    uint64_t maxError64;
+    double sumWDist[3];
+    double sumXPSNR[3];
+} PART_REC;
+
+/* result cache entry, named after its key. followed by res.nsegs JOBSEG
+ * and, with stats > 0, the JOBSTATS with room for that many worst frames */
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    uint64_t key;
+    int32_t w, h, subsamp;
+    int32_t dw, dh;
+    int32_t fps_num, fps_den;
+    int32_t offset;
+    int32_t win[4];
+    int32_t planeWidth[3];
+    int32_t planeHeight[3];
+    uint32_t andIsInf; /* bit per plane */
+    int32_t nsegs;
+    int32_t stats;
+    uint64_t numFrames64;
+    uint64_t maxError64;
+    double sumWDist[3];
+    double sumXPSNR[3];
+} RESULT_REC;
+
+typedef struct {
+    RUNNER *r;
+    JOB *j;
+    long long first;
+    long long last; /* exclusive, -1 = until EOF */
+} CHUNK;
+
+/* guards JOB.chunks and JOB.res, and serializes the done callbacks */
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+load_planar_frame(XPSNR_FRAME *f, int format, uint8_t *data, int width, int height)
+{
+    int hs, vs;
+
+    hs = DSV_FORMAT_H_SHIFT(format);
+    vs = DSV_FORMAT_V_SHIFT(format);
+
+    f->planes[0].format = format;
+    f->planes[0].w = width;
+    f->planes[0].h = height;
+    f->planes[0].stride = width;
+    f->planes[0].data = data;
+    f->planes[0].len = f->planes[0].stride * f->planes[0].h;
+
+    width = DSV_ROUND_SHIFT(width, hs);
+    height = DSV_ROUND_SHIFT(height, vs);
+
+    if (format & DSV_FMT_SEMIPLANAR) { /* both planes address one UV plane */
+        f->planes[0].step = 1;
+        f->planes[1].format = format;
+        f->planes[1].w = width;
+        f->planes[1].h = height;
+        f->planes[1].step = 2;
+        f->planes[1].stride = 2 * width;
+        f->planes[1].len = f->planes[1].stride * f->planes[1].h;
+        f->planes[1].data = f->planes[0].data + f->planes[0].len;
+        f->planes[2] = f->planes[1];
+        f->planes[2].data = f->planes[1].data + 1;
+        return;
+    }
+
+    f->planes[0].step = 1;
+    f->planes[1].format = format;
+    f->planes[1].w = width;
+    f->planes[1].h = height;
+    f->planes[1].step = 1;
+    f->planes[1].stride = f->planes[1].w;
+    f->planes[1].len = f->planes[1].stride * f->planes[1].h;
+    f->planes[1].data = f->planes[0].data + f->planes[0].len;
+
+    f->planes[2].format = format;
+    f->planes[2].w = width;
+    f->planes[2].h = height;
+    f->planes[2].step = 1;
+    f->planes[2].stride = f->planes[2].w;
+    f->planes[2].len = f->planes[2].stride * f->planes[2].h;
+    f->planes[2].data = f->planes[1].data + f->planes[1].len;
+}
+
+/* box filter one plane down by an integer factor. samples past the right and
+ * bottom edge repeat the last ones. step > 1 averages interleaved components
+ * separately. dst may be src or point before it in the same buffer, output
+ * samples only overwrite input that has already been read */
+static void
+box_plane(uint8_t *dst, const uint8_t *src, int sw, int sh, int dw, int dh, int f, int step)
+{
+    const unsigned area = f * f;
+    int x, y, k, i, n;
+
+    for (y = 0; y < dh; y++) {
+        for (x = 0; x < dw; x++) {
+            for (k = 0; k < step; k++) {
+                unsigned sum = 0;
+
+                for (i = 0; i < f; i++) {
+                    const uint8_t *row = src + (size_t) (y * f + i < sh ? y * f + i : sh - 1) * sw * step;
+
+                    for (n = 0; n < f; n++) {
+                        sum += row[(x * f + n < sw ? x * f + n : sw - 1) * step + k];
+                    }
+                }
+                dst[((size_t) y * dw + x) * step + k] = (sum + area / 2) / area;
+            }
+        }
+    }
+}
+
+/* box filter a frame read into data down by -scale= in place */
+static void
+scale_frame(JOB *j, uint8_t *data)
+{
+    const int hs = DSV_FORMAT_H_SHIFT(j->md.subsamp);
+    const int vs = DSV_FORMAT_V_SHIFT(j->md.subsamp);
+    const int sw = j->w / j->scale;
+    const int sh = j->h / j->scale;
+    const int cw = DSV_ROUND_SHIFT(j->w, hs);
+    const int ch = DSV_ROUND_SHIFT(j->h, vs);
+    const int scw = DSV_ROUND_SHIFT(sw, hs);
+    const int sch = DSV_ROUND_SHIFT(sh, vs);
+    uint8_t *src, *dst;
+
+    box_plane(data, data, j->w, j->h, sw, sh, j->scale, 1);
+    if (j->planes == 1) { /* the chroma was never read */
+        return;
+    }
+    src = data + (size_t) j->w * j->h;
+    dst = data + (size_t) sw * sh;
+    if (j->md.subsamp & DSV_FMT_SEMIPLANAR) {
+        box_plane(dst, src, cw, ch, scw, sch, j->scale, 2);
+    } else {
+        box_plane(dst, src, cw, ch, scw, sch, j->scale, 1);
+        box_plane(dst + (size_t) scw * sch, src + (size_t) cw * ch, cw, ch, scw, sch, j->scale, 1);
+    }
+}
+
+/* narrow the planes of f down to j->win. the rows keep their stride, so
+ * nothing is copied */
+static void
+crop_frame(JOB *j, XPSNR_FRAME *f)
+{
+    const int hs = DSV_FORMAT_H_SHIFT(j->md.subsamp);
+    const int vs = DSV_FORMAT_V_SHIFT(j->md.subsamp);
+    int c;
+
+    if (j->win[2] == f->planes[0].w && j->win[3] == f->planes[0].h) {
+        return;
+    }
+    for (c = 0; c < 3; c++) {
+        XPSNR_PLANE *p = &f->planes[c];
+        const int step = p->step > 1 ? p->step : 1;
+        const int x = c ? j->win[0] >> hs : j->win[0];
+        const int y = c ? j->win[1] >> vs : j->win[1];
+
+        p->data += (size_t) y * p->stride + (size_t) x * step;
+        p->w = c ? DSV_ROUND_SHIFT(j->win[2], hs) : j->win[2];
+        p->h = c ? DSV_ROUND_SHIFT(j->win[3], vs) : j->win[3];
+        p->len = (p->h - 1) * p->stride + p->w * step;
+    }
+}
+
+/* point f at the scored window of a frame read into data, downscaling it in
+ * place first with -scale= */
+static void
+load_frame(JOB *j, XPSNR_FRAME *f, uint8_t *data)
+{
+    if (j->scale > 1) {
+        scale_frame(j, data);
+    }
+    load_planar_frame(f, j->md.subsamp, data, j->w / j->scale, j->h / j->scale);
+    crop_frame(j, f);
+}
+
+/* bytes of a frame buffer for either input */
+static size_t
+frame_buf_size(JOB *j)
+{
+    size_t n = (size_t) j->w * j->h;
+
+    if (j->band) {
+        return j->bandsz;
+    }
+    if ((size_t) j->dw * j->dh > n) {
+        n = (size_t) j->dw * j->dh;
+    }
+    return n * (3 + EXTRA_PAD); /* allocate extra to be safe */
+}
+
+/* scaler bringing dst frames to the ref size, NULL if they match or on
+ * failure */
+static SCALER *
+dst_scaler(JOB *j)
+{
+    if (j->dscale == SCALE_NONE) {
+        return NULL;
+    }
+    return scaler_create(j->dscale, j->subsamp, j->planes == 1 ? 1 : 3, j->dw, j->dh, j->w, j->h);
+}
+
+/* "shm:name" opens a POSIX shared memory object holding the raw stream */
+static FILE *
+open_input(JOB *j, const char *name)
+{
+    if (zst_name(name)) {
+        return zst_open(name, j->zthreads);
+    }
+    if (strcmp(name, "-") == 0) {
+        return fdopen(STDIN_FILENO, "rb");
+    }
+    if (strncmp(name, "shm:", 4) == 0) {
+        FILE *f;
+        int fd;
+
+        fd = shm_open(name + 4, O_RDONLY, 0);
+        if (fd < 0) {
+            return NULL;
+        }
+        f = fdopen(fd, "rb");
+        if (f == NULL) {
+            close(fd);
+        }
+        return f;
+    }
+    return fopen(name, "rb");
+}
+
+static void
+open_error(JOB *j, const char *name)
+{
+    if (errno == ENOSYS) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "can't read %s, built without zstd support (zig build -Dzstd=true)", name);
+    } else {
+        snprintf(j->res.msg, JOB_MSG_LEN, "error opening input file %s", name);
+    }
+}
+
+/* bytes load_planar_frame() may touch, which rounds chroma sizes up */
+static size_t
+planar_size(int w, int h, int subsamp)
+{
+    size_t cw = DSV_ROUND_SHIFT(w, DSV_FORMAT_H_SHIFT(subsamp));
+    size_t ch = DSV_ROUND_SHIFT(h, DSV_FORMAT_V_SHIFT(subsamp));
+
+    return (size_t) w * h + 2 * cw * ch;
+}
+
+/* bytes in an input, -1 if it can't seek (pipes) */
+static long long
+input_size(FILE *f)
+{
+    struct stat st;
+    off_t cur, end;
+
+    if (fileno(f) >= 0) {
+        return (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode)) ? -1 : (long long) st.st_size;
+    }
+    /* decompressed .zst, seekable if it is indexed */
+    cur = ftello(f);
+    if (cur < 0 || fseeko(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    end = ftello(f);
+    return fseeko(f, cur, SEEK_SET) == 0 ? (long long) end : -1;
+}
+
+static long long
+count_frames(FILE *f, long long hdrlen, size_t frmsz)
+{
+    const long long size = input_size(f);
+
+    if (size < 0) {
+        return -1;
+    }
+    if (size < hdrlen) {
+        return 0;
+    }
+    return (size - hdrlen) / (long long) frmsz;
+}
+
+static void
+count_job_frames(JOB *j)
+{
+    long long nref, ndst;
+
+    nref = count_frames(j->fref, j->hdrlen[0], j->frmsz[0]);
+    ndst = count_frames(j->fdst, j->hdrlen[1], j->frmsz[1]);
+    j->nframes = (nref < 0 || ndst < 0) ? -1 : (nref < ndst ? nref : ndst);
+    if (j->nfr > 0 && j->nframes >= 0 && (long long) j->start + j->nfr < j->nframes) {
+        j->nframes = (long long) j->start + j->nfr;
+    }
+}
+
+/* sum of 8x8 luma blocks, enough to tell frames apart */
+static void
+thumbnail(const uint8_t *luma, int w, int tw, int th, uint16_t *t)
+{
+    int x, y, k;
+
+    for (y = 0; y < th; y++) {
+        uint16_t *row = t + (size_t) y * tw;
+
+        for (x = 0; x < tw; x++) {
+            row[x] = 0;
+        }
+        for (k = 0; k < (1 << ALIGN_THUMB_SHIFT); k++) {
+            const uint8_t *src = luma + (size_t) ((y << ALIGN_THUMB_SHIFT) + k) * w;
+
+            for (x = 0; x < tw; x++) {
+                const uint8_t *p = src + (x << ALIGN_THUMB_SHIFT);
+
+                row[x] += p[0] + p[1] + p[2] + p[3] + p[4] + p[5] + p[6] + p[7];
+            }
+        }
+    }
+}
+
+static int
+read_thumbs(JOB *j, const char *path, long long hdrlen, int n, int tw, int th,
+            uint16_t *t, uint8_t *buf)
+{
+    FILE *f;
+    int i;
+
+    f = open_input(j, path);
+    if (f == NULL) {
+        return 0;
+    }
+    if (fseeko(f, (off_t) hdrlen, SEEK_SET) != 0) {
+        fclose(f);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (dsv_luma_read_seq(f, buf, j->w, j->h, j->subsamp, j->y4m) < 0) {
+            break;
+        }
+        thumbnail(buf, j->w, tw, th, t + (size_t) i * tw * th);
+    }
+    fclose(f);
+    return i;
+}
+
+/* the offset within +-align frames for which the 1/8 scale luma of the
+ * first ALIGN_FRAMES dst frames is closest to the ref, preferring small
+ * offsets on ties (e.g. still pictures). returns 0 with res.msg set when
+ * it can't be searched */
+static int
+find_offset(JOB *j, int *offset)
+{
+    const int tw = j->w >> ALIGN_THUMB_SHIFT;
+    const int th = j->h >> ALIGN_THUMB_SHIFT;
+    const size_t tsz = (size_t) tw * th;
+    int n = ALIGN_FRAMES + j->align;
+    int nref, ndst, k, best = 0;
+    double bestsse = INFINITY;
+    uint16_t *tref, *tdst;
+    uint8_t *buf;
+
+    if (tsz == 0) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d is too small for -align=", j->w, j->h);
+        return 0;
+    }
+    /* the frames are read again from the start, which pipes can't do */
+    if (count_frames(j->fref, 0, 1) < 0 || count_frames(j->fdst, 0, 1) < 0) {
+        const char *name = count_frames(j->fref, 0, 1) < 0 ? j->ref : j->dst;
+
+        snprintf(j->res.msg, JOB_MSG_LEN, "-align= can't read %s twice, give the offset with -offset=",
+                strcmp(name, "-") == 0 ? "stdin" : name);
+        return 0;
+    }
+    tref = xpsnr_alloc(tsz * n, sizeof(uint16_t));
+    tdst = xpsnr_alloc(tsz * n, sizeof(uint16_t));
+    buf = xpsnr_alloc(planar_size(j->w, j->h, j->subsamp), 1);
+    if (tref == NULL || tdst == NULL || buf == NULL) {
+        xpsnr_free(tref);
+        xpsnr_free(tdst);
+        xpsnr_free(buf);
+        snprintf(j->res.msg, JOB_MSG_LEN, "not enough memory for -align=");
+        return 0;
+    }
+    nref = read_thumbs(j, j->ref, j->hdrlen[0], n, tw, th, tref, buf);
+    ndst = read_thumbs(j, j->dst, j->hdrlen[1], n, tw, th, tdst, buf);
+
+    for (k = 0; k <= 2 * j->align; k++) {
+        const int d = (k & 1) ? (k + 1) / 2 : -(k / 2); /* 0, 1, -1, 2, -2, ... */
+        uint64_t sse = 0;
+        int i, m = 0;
+
+        for (i = 0; i < ALIGN_FRAMES; i++) {
+            const int ri = i + (d > 0 ? d : 0);
+            const int di = i + (d < 0 ? -d : 0);
+            const uint16_t *a = tref + (size_t) ri * tsz;
+            const uint16_t *b = tdst + (size_t) di * tsz;
+            size_t p;
+
+            if (ri >= nref || di >= ndst) {
+                break;
+            }
+            for (p = 0; p < tsz; p++) {
+                const int64_t e = (int64_t) a[p] - b[p];
+
+                sse += (uint64_t) (e * e);
+            }
+            m++;
+        }
+        if (m > 0 && (double) sse / m < bestsse) {
+            bestsse = (double) sse / m;
+            best = d;
+        }
+    }
+    xpsnr_free(tref);
+    xpsnr_free(tdst);
+    xpsnr_free(buf);
+    *offset = best;
+    return 1;
+}
+
+/* start scoring ref at frame offset and dst at frame 0, or the other way
+ * around for negative offsets */
+static int
+apply_offset(JOB *j, int offset)
+{
+    long long skip[2];
+    int i;
+
+    skip[0] = offset > 0 ? offset : 0;
+    skip[1] = offset < 0 ? -(long long) offset : 0;
+    for (i = 0; i < 2; i++) {
+        FILE *f = i ? j->fdst : j->fref;
+        long long k;
+
+        if (skip[i] == 0) {
+            continue;
+        }
+        j->hdrlen[i] += skip[i] * (long long) j->frmsz[i];
+        if (fseeko(f, (off_t) j->hdrlen[i], SEEK_SET) == 0) {
+            continue;
+        }
+        for (k = 0; k < skip[i]; k++) { /* pipes can only be read past */
+            size_t n;
+
+            for (n = 0; n < j->frmsz[i]; n++) {
+                if (fgetc(f) == EOF) {
+                    return 0;
+                }
+            }
+        }
+    }
+    j->offset = offset;
+    count_job_frames(j);
+    return 1;
+}
+
+/* sums and sums of squares of every row (lines 0 to h - 1) and column
+ * (lines h to h + w - 1) of a luma plane, in one pass along the rows */
+static void
+line_sums(const uint8_t *luma, int w, int h, uint64_t *sum, uint64_t *sq)
+{
+    uint64_t *csum = sum + h;
+    uint64_t *csq = sq + h;
+    int x, y;
+
+    for (x = 0; x < w; x++) {
+        csum[x] = 0;
+        csq[x] = 0;
+    }
+    for (y = 0; y < h; y++) {
+        const uint8_t *row = luma + (size_t) y * w;
+        uint64_t rs = 0, rq = 0;
+
+        for (x = 0; x < w; x++) {
+            const uint32_t v = row[x];
+
+            rs += v;
+            rq += v * v;
+            csum[x] += v;
+            csq[x] += v * v;
+        }
+        sum[y] = rs;
+        sq[y] = rq;
+    }
+}
+
+/* x, y, w, h of the part of the ref inside its constant borders, from the
+ * luma of CROP_FRAMES frames spread over the job. a row or column is part of
+ * a border if it is flat in every frame and its mean stays the same. frames
+ * that are flat everywhere (fades, black leaders) are left out. crop is
+ * left alone if there are no borders or the ref can't be read again (pipes) */
+static void
+find_crop(JOB *j, int crop[4])
+{
+    const int w = j->w, h = j->h;
+    const int nl = w + h;
+    const int ax = 1 << DSV_FORMAT_H_SHIFT(j->subsamp);
+    const int ay = 1 << DSV_FORMAT_V_SHIFT(j->subsamp);
+    long long first = j->start, last, prev = -1;
+    uint64_t *sum, *sq;
+    double *lo, *hi;
+    uint8_t *buf, *flat;
+    FILE *f;
+    int k, l, n = 0;
+    int top, bottom, left, right, x0, y0, x1, y1;
+
+    last = count_frames(j->fref, j->hdrlen[0], j->frmsz[0]);
+    if (last < 0) {
+        return;
+    }
+    if (j->nframes >= 0 && j->nframes < last) {
+        last = j->nframes;
+    }
+    if (first >= last) {
+        first = 0;
+    }
+    f = open_input(j, j->ref);
+    if (f == NULL) {
+        return;
+    }
+    buf = xpsnr_alloc(planar_size(w, h, j->subsamp), 1);
+    sum = xpsnr_alloc(nl, sizeof(uint64_t));
+    sq = xpsnr_alloc(nl, sizeof(uint64_t));
+    lo = xpsnr_alloc(nl, sizeof(double));
+    hi = xpsnr_alloc(nl, sizeof(double));
+    flat = xpsnr_alloc(nl, 1);
+    if (buf == NULL || sum == NULL || sq == NULL || lo == NULL || hi == NULL || flat == NULL) {
+        goto done;
+    }
+    memset(flat, 1, nl);
+    for (k = 0; k < CROP_FRAMES; k++) {
+        const long long fr = first + (last - first) * k / CROP_FRAMES;
+        int content = 0;
+
+        if (fr == prev) {
+            continue;
+        }
+        prev = fr;
+        if (fseeko(f, (off_t) (j->hdrlen[0] + fr * (long long) j->frmsz[0]), SEEK_SET) != 0
+                || dsv_luma_read_seq(f, buf, w, h, j->subsamp, j->y4m) < 0) {
+            break;
+        }
+        line_sums(buf, w, h, sum, sq);
+        for (l = 0; l < h && !content; l++) {
+            const double mean = (double) sum[l] / w;
+
+            content = (double) sq[l] / w - mean * mean > CROP_VAR;
+        }
+        if (!content) {
+            continue;
+        }
+        for (l = 0; l < nl; l++) {
+            const int cnt = l < h ? w : h;
+            const double mean = (double) sum[l] / cnt;
+
+            if ((double) sq[l] / cnt - mean * mean > CROP_VAR) {
+                flat[l] = 0;
+            }
+            if (n == 0 || mean < lo[l]) {
+                lo[l] = mean;
+            }
+            if (n == 0 || mean > hi[l]) {
+                hi[l] = mean;
+            }
+        }
+        n++;
+    }
+    if (n == 0) {
+        goto done;
+    }
+    for (l = 0; l < nl; l++) {
+        flat[l] &= (hi[l] - lo[l] <= CROP_DRIFT);
+    }
+    for (top = 0; top < h && flat[top]; top++);
+    for (bottom = 0; bottom < h - top && flat[h - 1 - bottom]; bottom++);
+    for (left = 0; left < w && flat[h + left]; left++);
+    for (right = 0; right < w - left && flat[h + w - 1 - right]; right++);
+    /* widen the window onto the chroma grid, keeping every active sample */
+    x0 = left / ax * ax;
+    y0 = top / ay * ay;
+    x1 = (w - right + ax - 1) / ax * ax;
+    y1 = (h - bottom + ay - 1) / ay * ay;
+    x1 = x1 < w ? x1 : w;
+    y1 = y1 < h ? y1 : h;
+    if (x1 - x0 >= 16 && y1 - y0 >= 16 && (x1 - x0 < w || y1 - y0 < h)) {
+        crop[0] = x0;
+        crop[1] = y0;
+        crop[2] = x1 - x0;
+        crop[3] = y1 - y0;
+    }
+done:
+    fclose(f);
+    xpsnr_free(buf);
+    xpsnr_free(sum);
+    xpsnr_free(sq);
+    xpsnr_free(lo);
+    xpsnr_free(hi);
+    xpsnr_free(flat);
+}
+
+/* set the scored window from -crop= or the borders of the ref, in the
+ * samples of the frames after -scale=. returns 0 and sets res.msg if the
+ * crop does not fit */
+static int
+crop_setup(JOB *j)
+{
+    const int ax = 1 << DSV_FORMAT_H_SHIFT(j->subsamp);
+    const int ay = 1 << DSV_FORMAT_V_SHIFT(j->subsamp);
+    int crop[4];
+    int x0, y0, x1, y1;
+
+    crop[0] = 0;
+    crop[1] = 0;
+    crop[2] = j->w;
+    crop[3] = j->h;
+    if (j->crop[2] > 0) {
+        memcpy(crop, j->crop, sizeof(crop));
+        if (crop[0] < 0 || crop[1] < 0 || crop[3] <= 0
+                || crop[0] + crop[2] > j->w || crop[1] + crop[3] > j->h) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "crop %d:%d:%d:%d is not within %dx%d",
+                    crop[2], crop[3], crop[0], crop[1], j->w, j->h);
+            return 0;
+        }
+        if (crop[0] % ax != 0 || crop[1] % ay != 0) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "crop x and y must be multiples of %d and %d for this chroma format",
+                    ax, ay);
+            return 0;
+        }
+    } else if (j->autocrop) {
+        find_crop(j, crop);
+    }
+    /* -scale= may put the corner between chroma samples, move it inward */
+    x0 = (crop[0] / j->scale + ax - 1) / ax * ax;
+    y0 = (crop[1] / j->scale + ay - 1) / ay * ay;
+    x1 = (crop[0] + crop[2]) / j->scale;
+    y1 = (crop[1] + crop[3]) / j->scale;
+    if (x1 - x0 < 16 || y1 - y0 < 16) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "crop %d:%d:%d:%d is too small", crop[2], crop[3], crop[0], crop[1]);
+        return 0;
+    }
+    j->win[0] = x0;
+    j->win[1] = y0;
+    j->win[2] = x1 - x0;
+    j->win[3] = y1 - y0;
+    return 1;
+}
+
+/* geometry of the scored window of plane c and the offset of its first
+ * sample in a frame buffer, as load_planar_frame() and crop_frame() lay it
+ * out. stride is that of the whole plane */
+static size_t
+plane_layout(JOB *j, int c, XPSNR_PLANE *p)
+{
+    const int hs = DSV_FORMAT_H_SHIFT(j->subsamp);
+    const int vs = DSV_FORMAT_V_SHIFT(j->subsamp);
+    const int semi = (j->subsamp & DSV_FMT_SEMIPLANAR) != 0;
+    const int cw = DSV_ROUND_SHIFT(j->w, hs);
+    const int ch = DSV_ROUND_SHIFT(j->h, vs);
+    const size_t luma = (size_t) j->w * j->h;
+    size_t off;
+
+    memset(p, 0, sizeof(*p));
+    p->format = j->subsamp;
+    p->w = c ? DSV_ROUND_SHIFT(j->win[2], hs) : j->win[2];
+    p->h = c ? DSV_ROUND_SHIFT(j->win[3], vs) : j->win[3];
+    p->step = (c && semi) ? 2 : 1;
+    p->stride = (c ? cw : j->w) * p->step;
+    p->len = (p->h - 1) * p->stride + p->w * p->step;
+    off = c ? (size_t) (j->win[1] >> vs) * p->stride + (size_t) (j->win[0] >> hs) * p->step
+            : (size_t) j->win[1] * p->stride + j->win[0];
+    if (c == 0) {
+        return off;
+    }
+    if (semi) {
+        return luma + (c == 2) + off;
+    }
+    return luma + (c == 2 ? (size_t) cw * ch : 0) + off;
+}
+
+/* bytes of the largest band of a frame */
+static size_t
+band_size(JOB *j)
+{
+    const int nplanes = (j->planes == 1) ? 1 : ((j->subsamp & DSV_FMT_SEMIPLANAR) ? 2 : 3);
+    const uint32_t nb = xpsnr_band_count(j->win[2], j->win[3]);
+    size_t max = 0;
+    uint32_t b;
+    int c;
+
+    for (b = 0; b < nb; b++) {
+        size_t sz = 0;
+
+        for (c = 0; c < nplanes; c++) {
+            XPSNR_PLANE p;
+            int first, count;
+
+            plane_layout(j, c, &p);
+            xpsnr_band_rows(j->win[2], j->win[3], c, p.h, b, &first, &count);
+            sz += (size_t) count * p.stride;
+        }
+        if (sz > max) {
+            max = sz;
+        }
+    }
+    return max;
+}
+
+/* switch to bands if scoring whole frames takes more than -max_mem= */
+static int
+band_setup(JOB *j)
+{
+    const size_t n = (size_t) j->w * j->h;
+    const size_t budget = (size_t) j->max_mem << 20;
+    size_t need;
+
+    j->band = 0;
+    if (j->max_mem <= 0) {
+        return 1;
+    }
+    /* both frame buffers, the copies accum() makes of them, the temporal
+     * history and the luma of the last frame */
+    need = 2 * frame_buf_size(j) + 2 * planar_size(j->w, j->h, j->subsamp) + 3 * n;
+    if (need <= budget) {
+        return 1;
+    }
+    if (j->scale > 1 || j->dscale != SCALE_NONE || xpsnr_band_count(j->win[2], j->win[3]) == 0) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d needs %zu MB, scoring in bands does not work with -scale= or -dst_scale=",
+                j->w, j->h, (need + (1 << 20) - 1) >> 20);
+        return 0;
+    }
+    if (j->nframes < 0 || fileno(j->fref) < 0 || fileno(j->fdst) < 0) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d needs %zu MB, scoring in bands needs seekable uncompressed input files",
+                j->w, j->h, (need + (1 << 20) - 1) >> 20);
+        return 0;
+    }
+    j->bandsz = band_size(j);
+    /* band buffers, the copies accum_band() makes of them and the history */
+    need = 4 * j->bandsz + 2 * n;
+    if (need > budget) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d needs %zu MB even when scored in bands",
+                j->w, j->h, (need + (1 << 20) - 1) >> 20);
+        return 0;
+    }
+    j->band = 1;
+    return 1;
+}
+
+/* the options that change the result and what identifies both inputs. 0
+ * if the job can't be cached */
+static int
+result_key(JOB *j, uint64_t *key)
+{
+    HASH64 h;
+    int32_t opt[24];
+
+    if (j->cache == NULL || j->ckpt != NULL || j->wfn != NULL || j->pmu) {
+        return 0;
+    }
+    opt[0] = j->cache_key;
+    opt[1] = j->w;
+    opt[2] = j->h;
+    opt[3] = j->subsamp;
+    opt[4] = j->dw;
+    opt[5] = j->dh;
+    opt[6] = j->dscale;
+    opt[7] = j->start;
+    opt[8] = j->nfr;
+    opt[9] = j->fps_num;
+    opt[10] = j->fps_den;
+    opt[11] = j->y4m;
+    opt[12] = j->offset;
+    opt[13] = j->align;
+    opt[14] = j->scale;
+    opt[15] = j->planes;
+    opt[16] = j->crop[0];
+    opt[17] = j->crop[1];
+    opt[18] = j->crop[2];
+    opt[19] = j->crop[3];
+    opt[20] = j->autocrop;
+    opt[21] = j->stats;
+    opt[22] = j->seglen;
+    opt[23] = j->nseglist;
+    hash64_init(&h, 0);
+    hash64_update(&h, RESULT_MAGIC, 8);
+    hash64_update(&h, opt, sizeof(opt));
+    if (j->nseglist > 0) {
+        hash64_update(&h, j->seglist, j->nseglist * sizeof(long long));
+    }
+    if (!cache_add_file(&h, j->ref, j->cache_key) || !cache_add_file(&h, j->dst, j->cache_key)) {
+        return 0;
+    }
+    *key = hash64_final(&h);
+    return 1;
+}
+
+/* malloc'd name of the cache entry, with suffix */
+static char *
+result_path(JOB *j, const char *suffix)
+{
+    size_t len = strlen(j->cache) + strlen(suffix) + 24;
+    char *path = malloc(len);
+
+    if (path != NULL) {
+        snprintf(path, len, "%s/%016llx.res%s", j->cache, (unsigned long long) j->rkey, suffix);
+    }
+    return path;
+}
+
+/* fill in res and what job_open() would have found from the cache entry
+ * of j->rkey, 0 if there is none */
+static int
+result_load(JOB *j)
+{
+    JOBRES *res = &j->res;
+    RESULT_REC rec;
+    JOBSEG *segs = NULL;
+    JOBSTATS *st = NULL;
+    char *path;
+    FILE *f;
+    int c, ok;
+
+    path = result_path(j, "");
+    f = (path == NULL) ? NULL : fopen(path, "rb");
+    free(path);
+    if (f == NULL) {
+        return 0;
+    }
+    ok = fread(&rec, sizeof(rec), 1, f) == 1
+            && memcmp(rec.magic, RESULT_MAGIC, sizeof(rec.magic)) == 0
+            && rec.endian == CKPT_ENDIAN && rec.key == j->rkey
+            && rec.nsegs >= 0 && rec.stats == j->stats;
+    if (ok && rec.nsegs > 0) {
+        segs = malloc(rec.nsegs * sizeof(JOBSEG));
+        ok = segs != NULL && fread(segs, sizeof(JOBSEG), rec.nsegs, f) == (size_t) rec.nsegs;
+    }
+    if (ok && rec.stats > 0) {
+        const size_t len = sizeof(JOBSTATS) + (rec.stats - 1) * sizeof(JOBFRAME);
+
+        st = xpsnr_alloc(len, 1);
+        ok = st != NULL && fread(st, len, 1, f) == 1
+                && st->maxworst == rec.stats && st->nworst >= 0 && st->nworst <= st->maxworst;
+    }
+    fclose(f);
+    if (!ok) {
+        free(segs);
+        free(st);
+        return 0;
+    }
+    j->w = rec.w;
+    j->h = rec.h;
+    j->subsamp = rec.subsamp;
+    j->dw = rec.dw;
+    j->dh = rec.dh;
+    j->offset = rec.offset;
+    memcpy(j->win, rec.win, sizeof(j->win));
+    j->md.width = rec.w;
+    j->md.height = rec.h;
+    j->md.subsamp = rec.subsamp;
+    j->md.fps_num = rec.fps_num;
+    j->md.fps_den = rec.fps_den;
+    j->md.planes = (j->planes == 1 ? 1 : 3);
+    for (c = 0; c < 3; c++) {
+        res->planeWidth[c] = rec.planeWidth[c];
+        res->planeHeight[c] = rec.planeHeight[c];
+        res->andIsInf[c] = (rec.andIsInf >> c) & 1;
+        res->sumWDist[c] = rec.sumWDist[c];
+        res->sumXPSNR[c] = rec.sumXPSNR[c];
+    }
+    res->numFrames64 = rec.numFrames64;
+    res->maxError64 = rec.maxError64;
+    res->segs = segs;
+    res->nsegs = rec.nsegs;
+    res->stats = st;
+    return 1;
+}
+
+/* add a scored job to the cache. written under a temporary name and
+ * renamed, so concurrent runs never see half an entry */
+static void
+result_store(JOB *j)
+{
+    JOBRES *res = &j->res;
+    RESULT_REC rec;
+    char *path, *tmp;
+    char suffix[32];
+    FILE *f;
+    int c, ok;
+
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, RESULT_MAGIC, sizeof(rec.magic));
+    rec.endian = CKPT_ENDIAN;
+    rec.key = j->rkey;
+    rec.w = j->w;
+    rec.h = j->h;
+    rec.subsamp = j->subsamp;
+    rec.dw = j->dw;
+    rec.dh = j->dh;
+    rec.fps_num = j->md.fps_num;
+    rec.fps_den = j->md.fps_den;
+    rec.offset = j->offset;
+    memcpy(rec.win, j->win, sizeof(rec.win));
+    for (c = 0; c < 3; c++) {
+        rec.planeWidth[c] = res->planeWidth[c];
+        rec.planeHeight[c] = res->planeHeight[c];
+        rec.andIsInf |= (res->andIsInf[c] ? 1u : 0u) << c;
+        rec.sumWDist[c] = res->sumWDist[c];
+        rec.sumXPSNR[c] = res->sumXPSNR[c];
+    }
+    rec.nsegs = res->nsegs;
+    rec.stats = (res->stats != NULL ? res->stats->maxworst : 0);
+    rec.numFrames64 = res->numFrames64;
+    rec.maxError64 = res->maxError64;
+
+    mkdir(j->cache, 0777); /* usually there already */
+    snprintf(suffix, sizeof(suffix), ".%ld.%d", (long) getpid(), j->id);
+    path = result_path(j, "");
+    tmp = result_path(j, suffix);
+    f = (path == NULL || tmp == NULL) ? NULL : fopen(tmp, "wb");
+    if (f != NULL) {
+        ok = fwrite(&rec, sizeof(rec), 1, f) == 1;
+        if (res->nsegs > 0) {
+            ok &= fwrite(res->segs, sizeof(JOBSEG), res->nsegs, f) == (size_t) res->nsegs;
+        }
+        if (rec.stats > 0) {
+            ok &= fwrite(res->stats, sizeof(JOBSTATS) + (rec.stats - 1) * sizeof(JOBFRAME), 1, f) == 1;
+        }
+        ok &= fclose(f) == 0;
+        if (!ok || rename(tmp, path) != 0) {
+            remove(tmp);
+        }
+    }
+    free(path);
+    free(tmp);
+}
+
+extern int
+job_open(JOB *j)
+{
+    XPSNR_META *md = &j->md;
+    int c, offset;
+
+    memset(&j->res, 0, sizeof(j->res));
+    j->fref = NULL;
+    j->fdst = NULL;
+    j->hdrlen[0] = 0;
+    j->hdrlen[1] = 0;
+    j->rmode = RESULT_NONE;
+
+    if (result_key(j, &j->rkey)) {
+        if (result_load(j)) {
+            j->rmode = RESULT_CACHED;
+            return 1;
+        }
+        j->rmode = RESULT_STORE;
+    }
+
+    j->fdst = open_input(j, j->dst);
+    if (j->fdst == NULL) {
+        open_error(j, j->dst);
+        goto fail;
+    }
+    j->fref = open_input(j, j->ref);
+    if (j->fref == NULL) {
+        open_error(j, j->ref);
+        goto fail;
+    }
+
+    md->width = j->w;
+    md->height = j->h;
+    md->subsamp = j->subsamp;
+    md->fps_num = j->fps_num;
+    md->fps_den = j->fps_den;
+    md->planes = (j->planes == 1 ? 1 : 3);
+
+    if (j->y4m) {
+        int fr[2] = { 1, 1 };
+
+        if (!dsv_y4m_read_hdr(j->fref, &md->width, &md->height, &md->subsamp, fr)) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "(ref) bad Y4M file %s", j->ref);
+            goto fail;
+        }
+        j->w = md->width;
+        j->h = md->height;
+        if (!dsv_y4m_read_hdr(j->fdst, &md->width, &md->height, &md->subsamp, fr)) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "(dec) bad Y4M file %s", j->dst);
+            goto fail;
+        }
+        j->dw = md->width;
+        j->dh = md->height;
+        md->width = j->w;
+        md->height = j->h;
+        md->fps_num = fr[0];
+        md->fps_den = fr[1];
+        if (md->fps_den <= 0) {
+            fprintf(stderr, "fps denominator was <= 0. Setting to 1.");
+            md->fps_den = 1;
+        }
+        j->subsamp = md->subsamp;
+        j->hdrlen[0] = ftello(j->fref);
+        j->hdrlen[1] = ftello(j->fdst);
+    }
+
+    if (j->scale < 1) {
+        j->scale = 1;
+    }
+    if (j->scale != 1 && j->scale != 2 && j->scale != 4) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "-scale= must be 1, 1/2 or 1/4");
+        goto fail;
+    }
+    if (j->w / j->scale < 16 || j->h / j->scale < 16) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d is too small to scale down by %d", j->w, j->h, j->scale);
+        goto fail;
+    }
+    if (j->dw <= 0 || j->dh <= 0) {
+        j->dw = j->w;
+        j->dh = j->h;
+    }
+    if ((j->dw != j->w || j->dh != j->h) && j->dscale == SCALE_NONE) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "dst & ref dimensions do not match! %dx%d vs %dx%d (see -dst_scale=)",
+                j->dw, j->dh, j->w, j->h);
+        goto fail;
+    }
+    if (j->dw == j->w && j->dh == j->h) {
+        j->dscale = SCALE_NONE;
+    } else if (j->align > 0) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "-align= needs dst & ref of the same size");
+        goto fail;
+    } else if (j->dw > 10 * j->w || j->dh > 10 * j->h) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "dst is more than 10 times the size of the ref");
+        goto fail;
+    }
+    j->frmsz[0] = dsv_frame_size(j->w, j->h, j->subsamp);
+    j->frmsz[1] = dsv_frame_size(j->dw, j->dh, j->subsamp);
+    if (j->y4m) {
+        j->frmsz[0] += sizeof(Y4M_FRAME_HDR) - 1;
+        j->frmsz[1] += sizeof(Y4M_FRAME_HDR) - 1;
+    }
+    offset = j->offset;
+    if (j->align > 0 && !find_offset(j, &offset)) {
+        goto fail;
+    }
+    if (!apply_offset(j, offset)) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "error skipping %d frames", offset);
+        goto fail;
+    }
+    if (!crop_setup(j)) {
+        goto fail;
+    }
+    j->bsize = xpsnr_block_size(j->win[2], j->win[3]);
+    if (j->bsize == 0) { /* accum() divides by the block size */
+        if (j->scale > 1) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d is too small to score when scaled down by %d",
+                    j->win[2] * j->scale, j->win[3] * j->scale, j->scale);
+        } else {
+            snprintf(j->res.msg, JOB_MSG_LEN, "%dx%d is too small to score", j->win[2], j->win[3]);
+        }
+        goto fail;
+    }
+    j->wblk = (j->win[2] + j->bsize - 1) / j->bsize;
+    j->hblk = (j->win[3] + j->bsize - 1) / j->bsize;
+    if (!band_setup(j)) {
+        goto fail;
+    }
+    for (c = 0; c < 3; c++) {
+        j->res.andIsInf[c] = 1;
+    }
+    if (j->stats > 0 && j->res.stats == NULL) {
+        j->res.stats = xpsnr_allocz(sizeof(JOBSTATS) + (j->stats - 1) * sizeof(JOBFRAME));
+        if (j->res.stats == NULL) {
+            snprintf(j->res.msg, JOB_MSG_LEN, "out of memory");
+            goto fail;
+        }
+        j->res.stats->maxworst = j->stats;
+        for (c = 0; c < 3; c++) {
+            j->res.stats->min[c] = INFINITY;
+            j->res.stats->max[c] = -INFINITY;
+        }
+    }
+    return 1;
+fail:
+    j->res.err = 1;
+    job_close(j);
+    return 0;
+}
+
+extern void
+job_close(JOB *j)
+{
+    if (j->fref != NULL) {
+        fclose(j->fref);
+        j->fref = NULL;
+    }
+    if (j->fdst != NULL) {
+        fclose(j->fdst);
+        j->fdst = NULL;
+    }
+}
+
+/* nearest rank, the center of its bin */
+static double
+stats_quantile(const JOBSTATS *st, int c, double p)
+{
+    uint64_t need = (uint64_t) ceil(p * st->n), sum = 0;
+    int b;
+
+    if (need < 1) {
+        need = 1;
+    }
+    for (b = 0; b < STATS_BINS; b++) {
+        sum += st->hist[c][b];
+        if (sum >= need) {
+            const double v = (b + 0.5) / STATS_STEPS;
+
+            return v < st->min[c] ? st->min[c] : v;
+        }
+    }
+    /* 100 dB and up, inf when those frames are all lossless */
+    return st->max[c];
+}
+
+static int
+cmp_frame_wxp(const void *a, const void *b)
+{
+    const JOBFRAME *fa = a;
+    const JOBFRAME *fb = b;
+
+    return (fa->wxp > fb->wxp) - (fa->wxp < fb->wxp);
+}
+
+/* 4:1:1 weighted XPSNR of per-plane values, just the luma with -planes=y */
+static double
+weighted_xpsnr(int planes, const double x[3])
+{
+    if (planes == 1) {
+        return x[0];
+    }
+    return ((x[0] * 4.0) + x[1] + x[2]) / 6.0;
+}
+
+extern void
+job_score(JOB *j)
+{
+    JOBRES *res = &j->res;
+    int c, i;
+
+    for (c = 0; c < 3; c++) {
+        res->xpsnr[c] = getAvgXPSNR(res->sumWDist[c], res->sumXPSNR[c],
+                res->planeWidth[c], res->planeHeight[c], res->maxError64,
+                res->numFrames64);
+    }
+    if (j->planes == 1) { /* the chroma was not scored */
+        res->xpsnr[1] = res->xpsnr[2] = NAN;
+    }
+    res->yuv = (res->xpsnr[0] + res->xpsnr[1] + res->xpsnr[2]) / 3.0;
+    res->wxp = weighted_xpsnr(j->planes, res->xpsnr);
+    res->hm = 3.0 / ((1.0 / res->xpsnr[0]) + (1.0 / res->xpsnr[1]) + (1.0 / res->xpsnr[2]));
+    for (i = 0; i < res->nsegs; i++) {
+        JOBSEG *g = &res->segs[i];
+
+        for (c = 0; c < 3; c++) {
+            g->xpsnr[c] = getAvgXPSNR(g->sumWDist[c], g->sumXPSNR[c],
+                    res->planeWidth[c], res->planeHeight[c], res->maxError64,
+                    g->numFrames64);
+        }
+        g->wxp = weighted_xpsnr(j->planes, g->xpsnr);
+    }
+    if (res->stats != NULL && res->stats->n > 0) {
+        JOBSTATS *st = res->stats;
+
+        for (c = 0; c < 3; c++) {
+            st->p1[c] = stats_quantile(st, c, 0.01);
+            st->p5[c] = stats_quantile(st, c, 0.05);
+            st->p50[c] = stats_quantile(st, c, 0.50);
+        }
+        qsort(st->worst, st->nworst, sizeof(JOBFRAME), cmp_frame_wxp);
+    }
+}
+
+/* segment of a frame, -1 if segments are off */
+static int
+seg_index(JOB *j, long long fr)
+{
+    int lo, hi;
+
+    if (j->seglen > 0) {
+        return (int) (fr / j->seglen);
+    }
+    if (j->nseglist <= 0 || fr < j->seglist[0]) {
+        return -1;
+    }
+    lo = 0;
+    hi = j->nseglist - 1;
+    while (lo < hi) { /* last start <= fr */
+        int mid = (lo + hi + 1) / 2;
+
+        if (j->seglist[mid] <= fr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+/* add a chunk's sums of one segment to the job. called with joblock held */
+static int
+seg_add(JOB *j, int idx, const JOBSEG *add)
+{
+    JOBRES *res = &j->res;
+    JOBSEG *g;
+    int c;
+
+    if (idx < 0 || add->numFrames64 == 0) {
+        return 1;
+    }
+    if (idx >= res->nsegs) {
+        JOBSEG *n = realloc(res->segs, (size_t) (idx + 1) * sizeof(JOBSEG));
+
+        if (n == NULL) {
+            return 0;
+        }
+        memset(n + res->nsegs, 0, (size_t) (idx + 1 - res->nsegs) * sizeof(JOBSEG));
+        for (c = res->nsegs; c <= idx; c++) {
+            n[c].first = -1;
+        }
+        res->segs = n;
+        res->nsegs = idx + 1;
+    }
+    g = &res->segs[idx];
+    for (c = 0; c < 3; c++) {
+        g->sumWDist[c] += add->sumWDist[c];
+        g->sumXPSNR[c] += add->sumXPSNR[c];
+    }
+    g->numFrames64 += add->numFrames64;
+    if (g->first < 0 || add->first < g->first) {
+        g->first = add->first;
+    }
+    if (add->last > g->last) {
+        g->last = add->last;
+    }
+    return 1;
+}
+
+static void
+stats_add(JOBSTATS *st, int planes, long long fr, const double x[3])
+{
+    JOBFRAME f;
+    int c, i;
+
+    st->n++;
+    for (c = 0; c < 3; c++) {
+        const int bin = !(x[c] < 100.0) ? STATS_BINS : (x[c] < 0.0 ? 0 : (int) (x[c] * STATS_STEPS));
+
+        if (x[c] < st->min[c]) {
+            st->min[c] = x[c];
+        }
+        if (x[c] > st->max[c]) {
+            st->max[c] = x[c];
+        }
+        st->hist[c][bin]++;
+        f.xpsnr[c] = x[c];
+    }
+    f.frame = fr;
+    f.wxp = weighted_xpsnr(planes, x);
+    /* keep the maxworst lowest, the best of them on top */
+    if (st->nworst < st->maxworst) {
+        for (i = st->nworst++; i > 0 && st->worst[(i - 1) / 2].wxp < f.wxp; i = (i - 1) / 2) {
+            st->worst[i] = st->worst[(i - 1) / 2];
+        }
+        st->worst[i] = f;
+    } else if (f.wxp < st->worst[0].wxp) {
+        i = 0;
+        for (;;) {
+            int k = 2 * i + 1;
+
+            if (k >= st->nworst) {
+                break;
+            }
+            if (k + 1 < st->nworst && st->worst[k + 1].wxp > st->worst[k].wxp) {
+                k++;
+            }
+            if (st->worst[k].wxp <= f.wxp) {
+                break;
+            }
+            st->worst[i] = st->worst[k];
+            i = k;
+        }
+        st->worst[i] = f;
+    }
+}
+
+static void
+job_finish(JOB *j)
+{
+    job_score(j);
+    job_close(j);
+}
+
+extern int
+job_save_part(JOB *j, const char *path)
+{
+    JOBRES *res = &j->res;
+    PART_REC rec;
+    FILE *f;
+    int c, ok;
+
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, PART_MAGIC, sizeof(rec.magic));
+    rec.endian = CKPT_ENDIAN;
+    rec.fps_num = j->md.fps_num;
+    rec.fps_den = j->md.fps_den;
+    for (c = 0; c < 3; c++) {
+        rec.planeWidth[c] = res->planeWidth[c];
+        rec.planeHeight[c] = res->planeHeight[c];
+        rec.andIsInf |= (res->andIsInf[c] ? 1u : 0u) << c;
+        rec.sumWDist[c] = res->sumWDist[c];
+        rec.sumXPSNR[c] = res->sumXPSNR[c];
+    }
+    rec.first = j->start;
+    rec.last = j->start + (long long) res->numFrames64;
+    rec.numFrames64 = res->numFrames64;
+    rec.maxError64 = res->maxError64;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+    ok = fwrite(&rec, sizeof(rec), 1, f) == 1;
+    ok &= fclose(f) == 0;
+    return ok;
+}
+
+extern int
+job_merge_part(JOB *j, const char *path, long long range[2])
+{
+    JOBRES *res = &j->res;
+    PART_REC rec;
+    FILE *f;
+    int c, ok;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        snprintf(res->msg, JOB_MSG_LEN, "error opening partial record %s", path);
+        return 0;
+    }
+    ok = fread(&rec, sizeof(rec), 1, f) == 1;
+    fclose(f);
+    if (!ok || memcmp(rec.magic, PART_MAGIC, sizeof(rec.magic)) != 0 || rec.endian != CKPT_ENDIAN) {
+        snprintf(res->msg, JOB_MSG_LEN, "bad partial record %s", path);
+        return 0;
+    }
+    range[0] = rec.first;
+    range[1] = rec.last;
+    if (rec.numFrames64 == 0) {
+        return 1;
+    }
+    if (res->planeWidth[0] == 0) { /* first record */
+        j->md.fps_num = rec.fps_num;
+        j->md.fps_den = rec.fps_den;
+        res->maxError64 = rec.maxError64;
+        for (c = 0; c < 3; c++) {
+            res->planeWidth[c] = rec.planeWidth[c];
+            res->planeHeight[c] = rec.planeHeight[c];
+            res->andIsInf[c] = 1;
+        }
+    }
+    for (c = 0; c < 3; c++) {
+        ok &= res->planeWidth[c] == rec.planeWidth[c] && res->planeHeight[c] == rec.planeHeight[c];
+    }
+    ok &= j->md.fps_num == rec.fps_num && j->md.fps_den == rec.fps_den;
+    ok &= res->maxError64 == rec.maxError64;
+    if (!ok) {
+        snprintf(res->msg, JOB_MSG_LEN, "partial record %s was made from other inputs", path);
+        return 0;
+    }
+    for (c = 0; c < 3; c++) {
+        res->sumWDist[c] += rec.sumWDist[c];
+        res->sumXPSNR[c] += rec.sumXPSNR[c];
+        res->andIsInf[c] &= (rec.andIsInf >> c) & 1;
+    }
+    res->numFrames64 += rec.numFrames64;
+    return 1;
+}
+
+static void
+print_json_str(FILE *f, const char *str)
+{
+    fputc('"', f);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(f, "\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(f, "\\u%04x", *str);
+        } else {
+            fputc(*str, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void
+print_json_num(FILE *f, const char *key, double v)
+{
+    /* JSON has no infinity, identical inputs are reported as null */
+    if (isinf(v) || isnan(v)) {
+        fprintf(f, ",\"%s\":null", key);
+    } else {
+        fprintf(f, ",\"%s\":%f", key, v);
+    }
+}
+
+extern void
+job_print(FILE *f, JOB *j)
+{
+    JOBRES *res = &j->res;
+
+    fprintf(f, "{\"job\":%d,\"ref\":", j->id);
+    print_json_str(f, j->ref);
+    fprintf(f, ",\"dst\":");
+    print_json_str(f, j->dst);
+    if (res->err) {
+        fprintf(f, ",\"status\":\"error\",\"error\":");
+        print_json_str(f, res->msg);
+    } else {
+        fprintf(f, ",\"status\":\"ok\",\"frames\":%llu", (unsigned long long) res->numFrames64);
+        if (j->rmode == RESULT_CACHED) {
+            fprintf(f, ",\"cached\":true");
+        }
+        if (j->align > 0 || j->offset != 0) {
+            fprintf(f, ",\"offset\":%d", j->offset);
+        }
+        if (j->crop[2] > 0 || j->autocrop) {
+            fprintf(f, ",\"crop\":\"%d:%d:%d:%d\"", j->win[2], j->win[3], j->win[0], j->win[1]);
+        }
+        print_json_num(f, "y", res->xpsnr[0]);
+        print_json_num(f, "u", res->xpsnr[1]);
+        print_json_num(f, "v", res->xpsnr[2]);
+        print_json_num(f, "yuv", res->yuv);
+        print_json_num(f, "hm", res->hm);
+        print_json_num(f, "weighted", res->wxp);
+        if (j->pmu && res->pmu.threads > 0) {
+            pmu_print_json(f, &res->pmu);
+        }
+    }
+    fprintf(f, "}\n");
+    fflush(f);
+}
+
+static int
+seek_frame(FILE *f, long long hdrlen, size_t frmsz, long long frame)
+{
+    return fseeko(f, (off_t) (hdrlen + frame * (long long) frmsz), SEEK_SET);
+}
+
+/* read the next frame of input i (0 = ref, 1 = dst) at its own size. with
+ * -planes=y the chroma stays unread */
+static int
+read_input(JOB *j, FILE *f, int i, uint8_t *buf)
+{
+    const int w = i ? j->dw : j->w;
+    const int h = i ? j->dh : j->h;
+
+    if (j->planes == 1) {
+        return dsv_luma_read_seq(f, buf, w, h, j->subsamp, j->y4m) >= 0;
+    }
+    if (j->y4m) {
+        return dsv_y4m_read_seq(f, buf, w, h, j->subsamp) >= 0;
+    }
+    return dsv_yuv_read_seq(f, buf, w, h, j->subsamp) >= 0;
+}
+
+static int
+read_pair(JOB *j, FILE *fref, FILE *fdst, uint8_t *refdata, uint8_t *decdata)
+{
+    return read_input(j, fdst, 1, decdata) && read_input(j, fref, 0, refdata);
+}
+
+/* move a freshly opened input to byte pos, which is the start of the given
+ * frame. pipes can only be read past */
+static int
+skip_to(JOB *j, FILE *f, int i, long long pos, long long frame, uint8_t *buf)
+{
+    long long n;
+
+    if (pos >= 0 && fseeko(f, (off_t) pos, SEEK_SET) == 0) {
+        return 1;
+    }
+    for (n = 0; n < frame; n++) {
+        if (!read_input(j, f, i, buf)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* read n bytes from pos of a frame buffer holding frame fr of input i, with
+ * zeros past the end of the frame as in a buffer read by read_input() */
+static int
+read_span(JOB *j, int fd, int i, long long fr, size_t pos, size_t n, uint8_t *dst)
+{
+    const size_t hdrsz = j->y4m ? sizeof(Y4M_FRAME_HDR) - 1 : 0;
+    const size_t pix = j->frmsz[i] - hdrsz;
+    const off_t base = (off_t) (j->hdrlen[i] + fr * (long long) j->frmsz[i] + (long long) hdrsz);
+    size_t have = pos < pix ? (pix - pos < n ? pix - pos : n) : 0;
+
+    memset(dst + have, 0, n - have);
+    while (have > 0) {
+        ssize_t got = pread(fd, dst, have, base + (off_t) pos);
+
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        dst += got;
+        pos += got;
+        have -= got;
+    }
+    return 1;
+}
+
+static void
+mark_stage(void *user, int stage)
+{
+    pmu_mark(user, stage);
+}
+
+/* score frame fr with -max_mem= one band at a time, reading each band
+ * straight from the inputs. with score = 0 only the ref luma is read to
+ * advance the temporal history */
+static int
+band_frame(JOB *j, WSLOT *ws, FILE *fref, FILE *fdst, long long fr, int score)
+{
+    const int fd[2] = { fileno(fref), fileno(fdst) };
+    const uint32_t nb = xpsnr_band_count(j->win[2], j->win[3]);
+    const int semi = (j->subsamp & DSV_FMT_SEMIPLANAR) != 0;
+    const int nplanes = (j->planes == 1 || !score) ? 1 : 3;
+    uint8_t *buf[2] = { ws->refdata, ws->decdata };
+    XPSNR_FRAME f[2];
+    size_t off[3];
+    uint32_t b;
+    int i, c;
+
+    for (i = 0; i < 2; i++) {
+        for (c = 0; c < 3; c++) {
+            off[c] = plane_layout(j, c, &f[i].planes[c]);
+        }
+        if (j->y4m && (i == 0 || score)) {
+            char hdr[sizeof(Y4M_FRAME_HDR) - 1];
+            const off_t pos = (off_t) (j->hdrlen[i] + fr * (long long) j->frmsz[i]);
+
+            if (pread(fd[i], hdr, sizeof(hdr), pos) != (ssize_t) sizeof(hdr)
+                    || memcmp(hdr, Y4M_FRAME_HDR, sizeof(hdr)) != 0) {
+                return 0;
+            }
+        }
+    }
+    for (b = 0; b < nb; b++) {
+        if (ws->ctx.mark != NULL) {
+            pmu_mark(ws->ctx.markUser, PMU_READ);
+        }
+        for (i = 0; i < (score ? 2 : 1); i++) {
+            uint8_t *p = buf[i];
+
+            for (c = 0; c < nplanes; c++) {
+                XPSNR_PLANE *pl = &f[i].planes[c];
+                int first, count;
+
+                if (c == 2 && semi) { /* read along with Cb */
+                    pl->data = f[i].planes[1].data + 1;
+                    continue;
+                }
+                xpsnr_band_rows(j->win[2], j->win[3], c, pl->h, b, &first, &count);
+                if (!read_span(j, fd[i], i, fr, off[c] + (size_t) first * pl->stride,
+                        (size_t) count * pl->stride, p)) {
+                    return 0;
+                }
+                pl->data = p;
+                p += (size_t) count * pl->stride;
+            }
+        }
+        if (score) {
+            xpsnr_accum_band(&ws->ctx, b, &f[0], &f[1], &j->md);
+        } else {
+            xpsnr_history_band(&ws->ctx, b, &f[0], &j->md);
+        }
+    }
+    return 1;
+}
+
+/* size and modification time of an input file, all -1 for pipes. a .zst
+ * input is known by its compressed file */
+static void
+input_id(FILE *f, const char *name, int64_t *id)
+{
+    struct stat st;
+
+    id[0] = id[1] = id[2] = -1;
+    if ((fileno(f) >= 0 ? fstat(fileno(f), &st) : stat(name, &st)) == 0 && S_ISREG(st.st_mode)) {
+        id[0] = (int64_t) st.st_size;
+        id[1] = (int64_t) st.st_mtim.tv_sec;
+        id[2] = (int64_t) st.st_mtim.tv_nsec;
+    }
+}
+
+static void
+ckpt_header(JOB *j, CKPT_HDR *hdr, long long frame)
+{
+    int i;
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, CKPT_MAGIC, sizeof(hdr->magic));
+    hdr->endian = CKPT_ENDIAN;
+    hdr->w = j->w;
+    hdr->h = j->h;
+    hdr->subsamp = j->subsamp;
+    for (i = 0; i < 4; i++) {
+        hdr->win[i] = j->win[i];
+    }
+    hdr->fps_num = j->md.fps_num;
+    hdr->fps_den = j->md.fps_den;
+    hdr->y4m = j->y4m;
+    hdr->offset = j->offset;
+    hdr->start = j->start;
+    hdr->frame = frame;
+    hdr->pos[0] = j->hdrlen[0] < 0 ? -1 : j->hdrlen[0] + frame * (long long) j->frmsz[0];
+    hdr->pos[1] = j->hdrlen[1] < 0 ? -1 : j->hdrlen[1] + frame * (long long) j->frmsz[1];
+    input_id(j->fref, j->ref, hdr->id[0]);
+    input_id(j->fdst, j->dst, hdr->id[1]);
+}
+
+/* write to a temporary file first so a job killed while writing leaves the
+ * previous checkpoint intact */
+static int
+ckpt_write(JOB *j, XPSNRContext *s, long long frame)
+{
+    CKPT_HDR hdr;
+    FILE *f;
+    char *tmp;
+    int ok;
+
+    tmp = malloc(strlen(j->ckpt) + 5);
+    if (tmp == NULL) {
+        return 0;
+    }
+    sprintf(tmp, "%s.tmp", j->ckpt);
+    f = fopen(tmp, "wb");
+    if (f == NULL) {
+        free(tmp);
+        return 0;
+    }
+    ckpt_header(j, &hdr, frame);
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && xpsnr_save(s, f);
+    ok &= fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok &= fclose(f) == 0;
+    if (ok) {
+        ok = rename(tmp, j->ckpt) == 0;
+    }
+    if (!ok) {
+        remove(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+/* restore the state saved by ckpt_write() and position both inputs at the
+ * next frame, which is returned in frame. returns 0 if there is no checkpoint
+ * yet, so the job starts over, or -1 and sets the job's error message */
+static int
+ckpt_resume(JOB *j, WSLOT *ws, long long *frame)
+{
+    CKPT_HDR hdr, cur;
+    FILE *f;
+    long long k;
+    int ok;
+
+    f = fopen(j->ckpt, "rb");
+    if (f == NULL && errno == ENOENT) { /* not written yet */
+        return 0;
+    }
+    if (f == NULL) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "error opening checkpoint %s", j->ckpt);
+        return -1;
+    }
+    ok = fread(&hdr, sizeof(hdr), 1, f) == 1
+      && memcmp(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) == 0 && hdr.endian == CKPT_ENDIAN;
+    if (ok) {
+        ckpt_header(j, &cur, hdr.frame);
+        for (k = 0; k < 2; k++) { /* not known for pipes */
+            if (cur.pos[k] < 0 || hdr.pos[k] < 0) {
+                cur.pos[k] = hdr.pos[k];
+            }
+            if (cur.id[k][0] < 0 || hdr.id[k][0] < 0) {
+                memcpy(cur.id[k], hdr.id[k], sizeof(cur.id[k]));
+            }
+        }
+        if (memcmp(&hdr, &cur, sizeof(hdr)) != 0) {
+            fclose(f);
+            snprintf(j->res.msg, JOB_MSG_LEN, "checkpoint %s does not match the inputs", j->ckpt);
+            return -1;
+        }
+        for (k = 0; k < 2; k++) {
+            const long long size = input_size(k ? j->fdst : j->fref);
+
+            if (size >= 0 && hdr.pos[k] > size) {
+                fclose(f);
+                snprintf(j->res.msg, JOB_MSG_LEN, "checkpoint %s is past the end of %s", j->ckpt,
+                        k ? j->dst : j->ref);
+                return -1;
+            }
+        }
+        ok = xpsnr_load(&ws->ctx, f);
+    }
+    fclose(f);
+    if (!ok) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "bad checkpoint file %s", j->ckpt);
+        return -1;
+    }
+    if (!skip_to(j, j->fref, 0, hdr.pos[0], hdr.frame, ws->refdata)
+            || !skip_to(j, j->fdst, 1, hdr.pos[1], hdr.frame, ws->decdata)) {
+        snprintf(j->res.msg, JOB_MSG_LEN, "error skipping to frame %lld", (long long) hdr.frame);
+        return -1;
+    }
+    *frame = hdr.frame;
+    return 1;
+}
+
+/* memory held by an entry for nframes frames of nblk blocks */
+static size_t
+weights_bytes(long long nframes, uint32_t nblk)
+{
+    return sizeof(WENTRY) + (size_t) nframes * (nblk * sizeof(double) + 1);
+}
+
+static size_t
+wentry_bytes(WENTRY *e)
+{
+    return weights_bytes(e->nframes, e->nblk);
+}
+
+static void
+wentry_free(WENTRY *e)
+{
+    xpsnr_free(e->weights);
+    xpsnr_free(e->have);
+    xpsnr_free(e);
+}
+
+/* drop stale entries and then least recently used entries nobody is using
+ * until under budget */
+static void
+weights_evict(RUNNER *r)
+{
+    WENTRY **pp = &r->wlist;
+
+    while (*pp != NULL) {
+        WENTRY *e = *pp;
+
+        if (e->stale && e->refs == 0) {
+            *pp = e->next;
+            r->wbytes -= wentry_bytes(e);
+            wentry_free(e);
+        } else {
+            pp = &e->next;
+        }
+    }
+    while (r->wbytes > r->wbudget) {
+        WENTRY **pp, **victim = NULL;
+
+        for (pp = &r->wlist; *pp != NULL; pp = &(*pp)->next) {
+            if ((*pp)->refs == 0 && (victim == NULL || (*pp)->lastuse < (*victim)->lastuse)) {
+                victim = pp;
+            }
+        }
+        if (victim == NULL) {
+            break;
+        }
+        {
+            WENTRY *e = *victim;
+
+            *victim = e->next;
+            r->wbytes -= wentry_bytes(e);
+            wentry_free(e);
+        }
+    }
+}
+
+/* look up the recorded weights of this job's reference. the job either
+ * reuses them (all of its frames are there), records them (nobody else is),
+ * or computes its weights as usual */
+static void
+weights_attach(RUNNER *r, JOB *j)
+{
+    struct stat st;
+    WENTRY *e;
+    uint32_t nblk;
+    long long nref, i;
+
+    j->wentry = NULL;
+    j->wmode = WEIGHTS_NONE;
+    if (r->wbudget == 0 || j->nframes <= 0) {
+        return;
+    }
+    nblk = xpsnr_block_count(j->win[2], j->win[3]);
+    if (nblk == 0 || (fileno(j->fref) >= 0 ? fstat(fileno(j->fref), &st) : stat(j->ref, &st)) != 0
+            || !S_ISREG(st.st_mode)) {
+        return;
+    }
+    nref = count_frames(j->fref, j->hdrlen[0], j->frmsz[0]);
+
+    pthread_mutex_lock(&r->wlock);
+    for (e = r->wlist; e != NULL; e = e->next) {
+        if (e->stale || e->dev != st.st_dev || e->ino != st.st_ino) {
+            continue;
+        }
+        /* rewritten in place, whole seconds are too coarse to tell */
+        if (e->size != st.st_size
+                || e->mtim.tv_sec != st.st_mtim.tv_sec || e->mtim.tv_nsec != st.st_mtim.tv_nsec
+                || e->ctim.tv_sec != st.st_ctim.tv_sec || e->ctim.tv_nsec != st.st_ctim.tv_nsec) {
+            e->stale = 1;
+            continue;
+        }
+        if (e->hdrlen == j->hdrlen[0] && e->w == j->w && e->h == j->h
+                && e->subsamp == j->subsamp && e->scale == j->scale
+                && memcmp(e->win, j->win, sizeof(e->win)) == 0
+                && e->frameRate == (unsigned) (j->md.fps_num / j->md.fps_den)) {
+            break;
+        }
+    }
+    if (e == NULL) {
+        weights_evict(r);
+        /* an entry over the whole budget could never be evicted while in use */
+        if (weights_bytes(nref, nblk) > r->wbudget
+                || (e = xpsnr_allocz(sizeof(WENTRY))) == NULL) {
+            pthread_mutex_unlock(&r->wlock);
+            return;
+        }
+        e->dev = st.st_dev;
+        e->ino = st.st_ino;
+        e->size = st.st_size;
+        e->mtim = st.st_mtim;
+        e->ctim = st.st_ctim;
+        e->hdrlen = j->hdrlen[0];
+        e->w = j->w;
+        e->h = j->h;
+        e->subsamp = j->subsamp;
+        e->scale = j->scale;
+        memcpy(e->win, j->win, sizeof(e->win));
+        e->frameRate = j->md.fps_num / j->md.fps_den;
+        e->nframes = nref;
+        e->nblk = nblk;
+        e->weights = xpsnr_alloc((size_t) nref * nblk, sizeof(double));
+        e->have = xpsnr_allocz(nref);
+        if (e->weights == NULL || e->have == NULL) {
+            wentry_free(e);
+            pthread_mutex_unlock(&r->wlock);
+            return;
+        }
+        e->next = r->wlist;
+        r->wlist = e;
+        r->wbytes += wentry_bytes(e);
+    }
+    if (e->owner == NULL) {
+        j->wmode = WEIGHTS_USE;
+        for (i = j->start; i < j->nframes; i++) {
+            if (!e->have[i]) {
+                j->wmode = WEIGHTS_RECORD;
+                e->owner = j;
+                break;
+            }
+        }
+    }
+    if (j->wmode != WEIGHTS_NONE) {
+        e->refs++;
+        e->lastuse = ++r->wtick;
+        j->wentry = e;
+    }
+    /* the new entry may not fit next to the ones in use */
+    weights_evict(r);
+    pthread_mutex_unlock(&r->wlock);
+}
+
+static void
+weights_detach(RUNNER *r, JOB *j)
+{
+    WENTRY *e = j->wentry;
+
+    if (e == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&r->wlock);
+    if (e->owner == j) {
+        e->owner = NULL;
+    }
+    e->refs--;
+    weights_evict(r);
+    pthread_mutex_unlock(&r->wlock);
+    j->wentry = NULL;
+}
+
+static WSLOT *
+get_slot(WCACHE *wc, JOB *j)
+{
+    WSLOT *ws = &wc->slot[0];
+    size_t need;
+    int i;
+
+    for (i = 0; i < CACHE_SLOTS; i++) {
+        WSLOT *t = &wc->slot[i];
+
+        if (t->cap && t->w == j->w && t->h == j->h && t->subsamp == j->subsamp) {
+            ws = t;
+            break;
+        }
+        if (t->lastuse < ws->lastuse) {
+            ws = t;
+        }
+    }
+    if (ws->w != j->w || ws->h != j->h || ws->subsamp != j->subsamp) {
+        xpsnr_release(&ws->ctx);
+        ws->w = j->w;
+        ws->h = j->h;
+        ws->subsamp = j->subsamp;
+    }
+    need = frame_buf_size(j);
+    if (ws->cap < need) {
+        xpsnr_free(ws->refdata);
+        xpsnr_free(ws->decdata);
+        ws->refdata = xpsnr_allocz(need);
+        ws->decdata = xpsnr_allocz(need);
+        ws->cap = need;
+    }
+    ws->lastuse = ++wc->tick;
+    xpsnr_reset(&ws->ctx);
+    return ws;
+}
+
+/* called with joblock held */
+static void
+job_done(RUNNER *r, JOB *j)
+{
+    job_finish(j);
+    weights_detach(r, j);
+    if (j->rmode == RESULT_STORE && !j->res.err) {
+        result_store(j);
+    }
+    if (j->done != NULL) {
+        j->done(j, j->user);
+    }
+}
+
+static void
+run_chunk(void *arg, int worker)
+{
+    CHUNK *ck = arg;
+    RUNNER *r = ck->r;
+    JOB *j = ck->j;
+    WSLOT *ws;
+    XPSNRContext *s;
+    WENTRY *we;
+    FILE *fref, *fdst;
+    URING_READER *ur[2] = { NULL, NULL };
+    SCALER *sc;
+    JOBSEG seg;
+    PMU *pmu = NULL;
+    double *wout = NULL; /* weights handed to j->wfn */
+    long long fr, start;
+    int own = ck->first > 0, ok = 1, resumed = 0, c;
+    int segi = -1, segok = 1;
+
+    memset(&seg, 0, sizeof(seg));
+
+    if (!own && j->fref == NULL && !j->res.err && j->rmode != RESULT_CACHED) {
+        /* opened on the worker so a long job list doesn't hold every file open */
+        if (!job_open(j)) {
+            pthread_mutex_lock(&joblock);
+            free(ck);
+            j->chunks = 0;
+            if (j->done != NULL) {
+                j->done(j, j->user);
+            }
+            pthread_mutex_unlock(&joblock);
+            return;
+        }
+    }
+    if (j->rmode == RESULT_CACHED) { /* nothing to score */
+        pthread_mutex_lock(&joblock);
+        free(ck);
+        j->chunks = 0;
+        job_done(r, j);
+        pthread_mutex_unlock(&joblock);
+        return;
+    }
+    if (!own) {
+        ck->first = j->start;
+        ck->last = j->nframes;
+        weights_attach(r, j);
+    }
+    we = j->wentry;
+    ws = get_slot(&r->cache[worker], j);
+    s = &ws->ctx;
+    sc = dst_scaler(j);
+    if (j->dscale != SCALE_NONE && sc == NULL) {
+        ok = 0;
+    }
+    if (j->wfn != NULL) {
+        wout = xpsnr_alloc(j->wblk * j->hblk, sizeof(double));
+        ok &= wout != NULL;
+    }
+    if (j->pmu) {
+        pmu = pmu_open();
+        ok &= pmu != NULL;
+        s->mark = (pmu != NULL) ? mark_stage : NULL;
+        s->markUser = pmu;
+    }
+    if (!own && j->resume) { /* the job is never split, nobody else touches it */
+        resumed = ckpt_resume(j, ws, &ck->first);
+        if (resumed < 0) {
+            j->res.err = 1;
+            ok = 0;
+        }
+    }
+
+    if (own) {
+        fref = open_input(j, j->ref);
+        fdst = open_input(j, j->dst);
+        start = ck->first;
+        if (j->wmode != WEIGHTS_USE) { /* replay the history the weights depend on */
+            start -= (ck->first < CHUNK_WARMUP ? ck->first : CHUNK_WARMUP);
+        }
+        if (fref == NULL || fdst == NULL
+                || seek_frame(fref, j->hdrlen[0], j->frmsz[0], start) != 0
+                || seek_frame(fdst, j->hdrlen[1], j->frmsz[1], start) != 0) {
+            ok = 0;
+        }
+    } else {
+        fref = j->fref;
+        fdst = j->fdst;
+        start = ck->first;
+        if (ok && resumed == 0 && start > 0) { /* -start= */
+            if (j->wmode != WEIGHTS_USE) {
+                start -= (start < CHUNK_WARMUP ? start : CHUNK_WARMUP);
+            }
+            ok = skip_to(j, fref, 0, j->hdrlen[0] < 0 ? -1 : j->hdrlen[0] + start * (long long) j->frmsz[0], start, ws->refdata)
+              && skip_to(j, fdst, 1, j->hdrlen[1] < 0 ? -1 : j->hdrlen[1] + start * (long long) j->frmsz[1], start, ws->decdata);
+        }
+    }
+    if (ok && j->uring > 0 && !j->band && ck->last >= 0 && !zst_name(j->ref) && !zst_name(j->dst)) {
+        size_t hdrsz = j->y4m ? sizeof(Y4M_FRAME_HDR) - 1 : 0;
+        size_t extra[2], readsz[2];
+
+        extra[0] = planar_size(j->w, j->h, j->subsamp) - (j->frmsz[0] - hdrsz);
+        extra[1] = planar_size(j->dw, j->dh, j->subsamp) - (j->frmsz[1] - hdrsz);
+        /* -planes=y stops each read at the end of the luma */
+        readsz[0] = j->planes == 1 ? hdrsz + (size_t) j->w * j->h : j->frmsz[0];
+        readsz[1] = j->planes == 1 ? hdrsz + (size_t) j->dw * j->dh : j->frmsz[1];
+        ur[0] = uring_open(j->ref, j->hdrlen[0], j->frmsz[0], readsz[0], hdrsz, extra[0], start, ck->last, j->uring, j->direct);
+        ur[1] = uring_open(j->dst, j->hdrlen[1], j->frmsz[1], readsz[1], hdrsz, extra[1], start, ck->last, j->uring, j->direct);
+        if (ur[0] == NULL || ur[1] == NULL) { /* no io_uring here, stay with stdio */
+            uring_close(ur[0]);
+            uring_close(ur[1]);
+            ur[0] = ur[1] = NULL;
+        }
+    }
+
+    for (fr = start; ok && (ck->last < 0 || fr < ck->last); fr++) {
+        XPSNR_FRAME decf, reff;
+        uint8_t *refp, *decp;
+
+        if (r->pool != NULL && j->ckpt == NULL && j->wfn == NULL && fr >= ck->first && ck->last >= 0
+                && ck->last - fr >= 2 * CHUNK_MIN && pool_hungry(r->pool)) {
+            CHUNK *nck = malloc(sizeof(CHUNK));
+
+            /* without memory for it this chunk just keeps its whole range */
+            if (nck != NULL) {
+                *nck = *ck;
+                nck->first = fr + (ck->last - fr) / 2;
+                pthread_mutex_lock(&joblock);
+                j->chunks++;
+                pthread_mutex_unlock(&joblock);
+                if (pool_submit(r->pool, worker, run_chunk, nck)) {
+                    ck->last = nck->first;
+                } else {
+                    pthread_mutex_lock(&joblock);
+                    j->chunks--;
+                    pthread_mutex_unlock(&joblock);
+                    free(nck);
+                }
+            }
+        }
+        if (j->nfr > 0 && fr >= (long long) j->start + j->nfr) {
+            break;
+        }
+        if (pmu != NULL) {
+            pmu_mark(pmu, PMU_READ);
+        }
+        if (j->band) { /* read by band_frame() */
+            refp = decp = NULL;
+        } else if (ur[0] != NULL) { /* the metric reads straight from the I/O buffers */
+            refp = uring_next(ur[0]);
+            decp = uring_next(ur[1]);
+            if (refp == NULL || decp == NULL) {
+                ok = !uring_error(ur[0]) && !uring_error(ur[1]);
+                break;
+            }
+        } else {
+            if (!read_pair(j, fref, fdst, ws->refdata, ws->decdata)) {
+                break;
+            }
+            refp = ws->refdata;
+            decp = ws->decdata;
+        }
+        if (sc != NULL) {
+            decp = scaler_run(sc, decp);
+        }
+        if (!j->band) {
+            load_frame(j, &decf, decp);
+            load_frame(j, &reff, refp);
+        }
+        s->inWeights = (j->wmode == WEIGHTS_USE) ? we->weights + fr * we->nblk : NULL;
+        /* compute metrics and accumulate */
+        if ((j->seglen > 0 || j->nseglist > 0 || j->res.stats != NULL) && fr >= ck->first) {
+            const int idx = seg_index(j, fr);
+            double wd[3], xp[3], frx[3];
+
+            /* score the frame on its own, the totals add up in the same order */
+            for (c = 0; c < 3; c++) {
+                wd[c] = s->sumWDist[c];
+                xp[c] = s->sumXPSNR[c];
+                s->sumWDist[c] = 0.0;
+                s->sumXPSNR[c] = 0.0;
+            }
+            if (j->band) {
+                ok = band_frame(j, ws, fref, fdst, fr, 1);
+            } else {
+                accum(s, &reff, &decf, &j->md);
+            }
+            if (idx != segi) {
+                if (segi >= 0) {
+                    pthread_mutex_lock(&joblock);
+                    segok &= seg_add(j, segi, &seg);
+                    pthread_mutex_unlock(&joblock);
+                }
+                memset(&seg, 0, sizeof(seg));
+                seg.first = fr;
+                segi = idx;
+            }
+            for (c = 0; c < 3; c++) {
+                frx[c] = s->sumXPSNR[c];
+                seg.sumWDist[c] += s->sumWDist[c];
+                seg.sumXPSNR[c] += s->sumXPSNR[c];
+                s->sumWDist[c] = wd[c] + s->sumWDist[c];
+                s->sumXPSNR[c] = xp[c] + s->sumXPSNR[c];
+            }
+            seg.numFrames64++;
+            seg.last = fr;
+            if (j->res.stats != NULL) {
+                pthread_mutex_lock(&joblock);
+                stats_add(j->res.stats, j->planes, fr, frx);
+                pthread_mutex_unlock(&joblock);
+            }
+        } else if (j->band) { /* warm-up frames only need the ref luma */
+            ok = band_frame(j, ws, fref, fdst, fr, fr >= ck->first);
+        } else {
+            accum(s, &reff, &decf, &j->md);
+        }
+        if (!ok) {
+            break;
+        }
+        if (fr < ck->first) { /* warm-up frame, only the history is kept */
+            for (c = 0; c < 3; c++) {
+                s->sumWDist[c] = 0.0;
+                s->sumXPSNR[c] = 0.0;
+                s->andIsInf[c] = 0;
+            }
+        } else {
+            s->numFrames64++;
+            if (j->wmode == WEIGHTS_RECORD) {
+                memcpy(we->weights + fr * we->nblk, s->weights, we->nblk * sizeof(double));
+                we->have[fr] = 1;
+            }
+            if (wout != NULL) {
+                const double f = xpsnr_weight_scale(s);
+                const int nblk = j->wblk * j->hblk;
+
+                for (c = 0; c < nblk; c++) {
+                    wout[c] = s->weights[c] * f;
+                }
+                j->wfn(j, fr, wout, j->wuser);
+            }
+            if (j->ckpt != NULL && j->ckpt_frames > 0 && (fr + 1) % j->ckpt_frames == 0
+                    && !ckpt_write(j, s, fr + 1)) {
+                /* frame fr is in s already, so no final write for it either */
+                j->res.err = 1;
+                snprintf(j->res.msg, JOB_MSG_LEN, "error writing checkpoint %s", j->ckpt);
+                ok = 0;
+                break;
+            }
+        }
+    }
+    if (ok && j->ckpt != NULL && !ckpt_write(j, s, fr)) {
+        j->res.err = 1;
+        snprintf(j->res.msg, JOB_MSG_LEN, "error writing checkpoint %s", j->ckpt);
+    }
+    s->inWeights = NULL;
+    s->mark = NULL;
+    s->markUser = NULL;
+    scaler_destroy(sc);
+    xpsnr_free(wout);
+    uring_close(ur[0]);
+    uring_close(ur[1]);
+    if (own) {
+        if (fref != NULL) {
+            fclose(fref);
+        }
+        if (fdst != NULL) {
+            fclose(fdst);
+        }
+    }
+
+    pthread_mutex_lock(&joblock);
+    if (segi >= 0) {
+        segok &= seg_add(j, segi, &seg);
+    }
+    if (!segok && !j->res.err) {
+        j->res.err = 1;
+        snprintf(j->res.msg, JOB_MSG_LEN, "out of memory");
+    }
+    if (!ok && !j->res.err) {
+        j->res.err = 1;
+        snprintf(j->res.msg, JOB_MSG_LEN, "error reading frames %lld-%lld", ck->first, ck->last);
+    }
+    if (s->numFrames64 > 0) {
+        for (c = 0; c < 3; c++) {
+            j->res.sumWDist[c] += s->sumWDist[c];
+            j->res.sumXPSNR[c] += s->sumXPSNR[c];
+            j->res.planeWidth[c] = s->planeWidth[c];
+            j->res.planeHeight[c] = s->planeHeight[c];
+        }
+        j->res.maxError64 = s->maxError64;
+        j->res.numFrames64 += s->numFrames64;
+    }
+    for (c = 0; c < 3; c++) {
+        j->res.andIsInf[c] &= s->andIsInf[c];
+    }
+    pmu_close(pmu, &j->res.pmu);
+    free(ck);
+    if (--j->chunks == 0) {
+        job_done(r, j);
+    }
+    pthread_mutex_unlock(&joblock);
+}
+
+extern RUNNER *
+runner_create(int nthreads)
+{
+    RUNNER *r;
+
+    r = xpsnr_allocz(sizeof(RUNNER));
+    if (r == NULL) {
+        return NULL;
+    }
+    if (nthreads > 1) {
+        r->pool = pool_create(nthreads);
+    }
+    r->nworkers = r->pool ? pool_threads(r->pool) : 1;
+    r->cache = xpsnr_allocz(r->nworkers * sizeof(WCACHE));
+    pthread_mutex_init(&r->wlock, NULL);
+    return r;
+}
+
+extern void
+runner_destroy(RUNNER *r)
+{
+    WENTRY *e;
+    int i, k;
+
+    if (r == NULL) {
+        return;
+    }
+    pool_destroy(r->pool);
+    for (i = 0; i < r->nworkers; i++) {
+        for (k = 0; k < CACHE_SLOTS; k++) {
+            WSLOT *ws = &r->cache[i].slot[k];
+
+            xpsnr_release(&ws->ctx);
+            xpsnr_free(ws->refdata);
+            xpsnr_free(ws->decdata);
+        }
+    }
+    while ((e = r->wlist) != NULL) {
+        r->wlist = e->next;
+        wentry_free(e);
+    }
+    pthread_mutex_destroy(&r->wlock);
+    xpsnr_free(r->cache);
+    xpsnr_free(r);
+}
+
+extern void
+runner_weight_cache(RUNNER *r, size_t bytes)
+{
+    pthread_mutex_lock(&r->wlock);
+    r->wbudget = bytes;
+    weights_evict(r);
+    pthread_mutex_unlock(&r->wlock);
+}
+
+extern void
+runner_submit(RUNNER *r, JOB *j)
+{
+    CHUNK *ck = malloc(sizeof(CHUNK));
+
+    if (ck != NULL) {
+        ck->r = r;
+        ck->j = j;
+        ck->first = 0;
+        ck->last = -1; /* known once the job is opened */
+        j->chunks = 1;
+        if (r->pool == NULL) {
+            run_chunk(ck, 0);
+            return;
+        }
+        if (pool_submit(r->pool, -1, run_chunk, ck)) {
+            return;
+        }
+        free(ck);
+    }
+    pthread_mutex_lock(&joblock);
+    j->res.err = 1;
+    snprintf(j->res.msg, JOB_MSG_LEN, "out of memory");
+    j->chunks = 0;
+    job_done(r, j);
+    pthread_mutex_unlock(&joblock);
+}
+
+extern void
+runner_wait(RUNNER *r)
+{
+    if (r->pool != NULL) {
+        pool_wait(r->pool);
+    }
+}
+
+/* per-frame values of the live window */
+typedef struct {
+    double wdist[3];
+    double xpsnr[3];
+} LIVEFRAME;
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+static void
+live_report(FILE *out, JOB *j, XPSNRContext *s, LIVEFRAME *win, int n, long long fr)
+{
+    double wd[3] = { 0.0, 0.0, 0.0 };
+    double xp[3] = { 0.0, 0.0, 0.0 };
+    double v[3];
+    int i, c;
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < 3; c++) {
+            wd[c] += win[i].wdist[c];
+            xp[c] += win[i].xpsnr[c];
+        }
+    }
+    for (c = 0; c < 3; c++) {
+        v[c] = getAvgXPSNR(wd[c], xp[c], s->planeWidth[c], s->planeHeight[c], s->maxError64, n);
+    }
+    if (j->planes == 1) {
+        fprintf(out, "frame %lld\tY %f | scored %llu, dropped %llu\n", fr, v[0],
+                (unsigned long long) j->res.numFrames64, (unsigned long long) j->res.dropped);
+    } else {
+        fprintf(out, "frame %lld\tY %f U %f V %f | weighted %f | scored %llu, dropped %llu\n",
+                fr, v[0], v[1], v[2], weighted_xpsnr(j->planes, v),
+                (unsigned long long) j->res.numFrames64, (unsigned long long) j->res.dropped);
+    }
+    fflush(out);
+}
+
+extern int
+job_live(JOB *j, int window, FILE *out)
+{
+    const double period = (double) j->md.fps_den / j->md.fps_num;
+    const long long every = (j->md.fps_num / j->md.fps_den > 0) ? j->md.fps_num / j->md.fps_den : 1;
+    XPSNRContext ctx;
+    XPSNRContext *s = &ctx;
+    JOBRES *res = &j->res;
+    LIVEFRAME *win;
+    SCALER *sc;
+    uint8_t *refdata, *decdata;
+    size_t need = frame_buf_size(j);
+    long long fr;
+    double t0 = 0.0;
+    int n = 0, head = 0, c;
+
+    memset(&ctx, 0, sizeof(ctx));
+    win = xpsnr_alloc(window, sizeof(LIVEFRAME));
+    refdata = xpsnr_allocz(need);
+    decdata = xpsnr_allocz(need);
+    sc = dst_scaler(j);
+    if (win == NULL || refdata == NULL || decdata == NULL || (j->dscale != SCALE_NONE && sc == NULL)) {
+        res->err = 1;
+        snprintf(res->msg, JOB_MSG_LEN, "out of memory");
+        goto done;
+    }
+    for (fr = 0; j->nfr <= 0 || fr < (long long) j->start + j->nfr; fr++) {
+        XPSNR_FRAME decf, reff;
+
+        if (!read_pair(j, j->fref, j->fdst, refdata, decdata)) {
+            break;
+        }
+        load_frame(j, &decf, sc != NULL ? scaler_run(sc, decdata) : decdata);
+        load_frame(j, &reff, refdata);
+        if (fr < j->start) {
+            xpsnr_history(s, &reff, &j->md);
+            continue;
+        }
+        if (fr == j->start) { /* the clock starts with the first frame */
+            t0 = now_seconds();
+        }
+        if (fr > j->start && now_seconds() > t0 + (double) (fr - j->start + 1) * period) {
+            xpsnr_history(s, &reff, &j->md);
+            res->dropped++;
+        } else {
+            /* score the frame on its own, the totals add up in the same order */
+            for (c = 0; c < 3; c++) {
+                s->sumWDist[c] = 0.0;
+                s->sumXPSNR[c] = 0.0;
+                s->andIsInf[c] = 1;
+            }
+            accum(s, &reff, &decf, &j->md);
+            for (c = 0; c < 3; c++) {
+                res->sumWDist[c] += s->sumWDist[c];
+                res->sumXPSNR[c] += s->sumXPSNR[c];
+                res->andIsInf[c] &= s->andIsInf[c];
+                win[head].wdist[c] = s->sumWDist[c];
+                win[head].xpsnr[c] = s->sumXPSNR[c];
+            }
+            res->numFrames64++;
+            head = (head + 1) % window;
+            if (n < window) {
+                n++;
+            }
+        }
+        if ((fr - j->start + 1) % every == 0 && n > 0) {
+            live_report(out, j, s, win, n, fr);
+        }
+    }
+    if (res->numFrames64 > 0) {
+        for (c = 0; c < 3; c++) {
+            res->planeWidth[c] = s->planeWidth[c];
+            res->planeHeight[c] = s->planeHeight[c];
+        }
+        res->maxError64 = s->maxError64;
+    }
+done:
+    xpsnr_release(s);
+    scaler_destroy(sc);
+    xpsnr_free(win);
+    xpsnr_free(refdata);
+    xpsnr_free(decdata);
+    job_finish(j);
+    return !res->err;
+}
+
+/* read frame k of input i (0 = ref, 1 = dst), seeking from the frame at
+ * cur[i] if it is somewhere else. pipes can only go forward, going back
+ * in one is an error rather than the end of the input */
+static int
+read_frame_at(JOB *j, int i, long long k, long long *cur, uint8_t *buf)
+{
+    FILE *f = i ? j->fdst : j->fref;
+
+    if (cur[i] != k) {
+        if (j->hdrlen[i] >= 0 && seek_frame(f, j->hdrlen[i], j->frmsz[i], k) == 0) {
+            cur[i] = k;
+        } else if (k < cur[i]) {
+            j->res.err = 1;
+            snprintf(j->res.msg, JOB_MSG_LEN, "can't seek back to frame %lld of %s for -sample=",
+                     k, i ? j->dst : j->ref);
+            return 0;
+        } else if (!skip_to(j, f, i, -1, k - cur[i], buf)) {
+            return 0;
+        }
+    }
+    cur[i] = k + 1;
+    return read_input(j, f, i, buf);
+}
+
+/* reference frame k, kept with the nring - 1 frames before it so the
+ * history of a sample can overlap the frames of the one before without
+ * reading them again, which a pipe could not. NULL at the end or on error */
+static uint8_t *
+ref_frame_at(JOB *j, long long k, long long *cur, uint8_t **ring, long long *ringk, int nring)
+{
+    const int i = (int) (k % nring);
+
+    if (ringk[i] != k) {
+        ringk[i] = -1;
+        if (!read_frame_at(j, 0, k, cur, ring[i])) {
+            return NULL;
+        }
+        ringk[i] = k;
+    }
+    return ring[i];
+}
+
+extern int
+job_sample(JOB *j, int n)
+{
+    /* 1st-order temporal activity below 33 Hz, as in XPSNR itself */
+    const long long hist = (j->md.fps_num / j->md.fps_den <= 32) ? 1 : 2;
+    XPSNRContext ctx;
+    XPSNRContext *s = &ctx;
+    JOBRES *res = &j->res;
+    SCALER *sc;
+    uint8_t *ring[3] = { NULL, NULL, NULL }; /* ref frames k - hist to k */
+    long long ringk[3] = { -1, -1, -1 };
+    uint8_t *refdata, *decdata;
+    size_t need = frame_buf_size(j);
+    double sd[3] = { 0.0, 0.0, 0.0 }, sd2[3] = { 0.0, 0.0, 0.0 };
+    double sx[3] = { 0.0, 0.0, 0.0 }, sx2[3] = { 0.0, 0.0, 0.0 };
+    long long cur[2] = { 0, 0 };
+    long long end, k, h, total;
+    int c;
+
+    memset(&ctx, 0, sizeof(ctx));
+    for (h = 0; h <= hist; h++) {
+        ring[h] = xpsnr_allocz(need);
+    }
+    decdata = xpsnr_allocz(need);
+    sc = dst_scaler(j);
+    if (ring[0] == NULL || ring[1] == NULL || (hist > 1 && ring[2] == NULL) || decdata == NULL
+            || (j->dscale != SCALE_NONE && sc == NULL)) {
+        res->err = 1;
+        snprintf(res->msg, JOB_MSG_LEN, "out of memory");
+        goto done;
+    }
+    end = j->nframes;
+    if (j->nfr > 0 && (end < 0 || end > (long long) j->start + j->nfr)) {
+        end = (long long) j->start + j->nfr;
+    }
+    for (k = j->start; end < 0 || k < end; k += n) {
+        XPSNR_FRAME decf, reff;
+
+        /* the history a full run would have, from black before frame 0 */
+        xpsnr_reset(s);
+        for (h = (k < hist ? 0 : k - hist); h < k; h++) {
+            if ((refdata = ref_frame_at(j, h, cur, ring, ringk, hist + 1)) == NULL) {
+                goto end;
+            }
+            load_frame(j, &reff, refdata);
+            xpsnr_history(s, &reff, &j->md);
+        }
+        refdata = ref_frame_at(j, k, cur, ring, ringk, hist + 1);
+        if (refdata == NULL || !read_frame_at(j, 1, k, cur, decdata)) {
+            break;
+        }
+        load_frame(j, &decf, sc != NULL ? scaler_run(sc, decdata) : decdata);
+        load_frame(j, &reff, refdata);
+        for (c = 0; c < 3; c++) {
+            s->andIsInf[c] = 1;
+        }
+        accum(s, &reff, &decf, &j->md);
+        for (c = 0; c < 3; c++) {
+            res->sumWDist[c] += s->sumWDist[c];
+            res->sumXPSNR[c] += s->sumXPSNR[c];
+            res->andIsInf[c] &= s->andIsInf[c];
+            sd[c] += s->sumWDist[c];
+            sd2[c] += s->sumWDist[c] * s->sumWDist[c];
+            sx[c] += s->sumXPSNR[c];
+            sx2[c] += s->sumXPSNR[c] * s->sumXPSNR[c];
+        }
+        res->numFrames64++;
+    }
+end:
+    if (!res->err && res->numFrames64 > 0) {
+        const double m = (double) res->numFrames64;
+        /* frames sampled from, known unless reading pipes */
+        total = (end >= 0 ? end - j->start : (k - j->start));
+        for (c = 0; c < 3; c++) {
+            const double fpc = (total > 0 && m < total) ? 1.0 - m / total : (m > 1 ? 1.0 : 0.0);
+            double vd = 0.0, vx = 0.0, ed, ex;
+
+            if (m > 1) {
+                vd = (sd2[c] - sd[c] * sd[c] / m) / (m - 1);
+                vx = (sx2[c] - sx[c] * sx[c] / m) / (m - 1);
+            }
+            ed = SAMPLE_Z * sqrt((vd > 0 ? vd : 0.0) * fpc / m);
+            ex = SAMPLE_Z * sqrt((vx > 0 ? vx : 0.0) * fpc / m);
+            res->planeWidth[c] = s->planeWidth[c];
+            res->planeHeight[c] = s->planeHeight[c];
+            /* more distortion is the lower bound */
+            res->ci[c][0] = getAvgXPSNR(sd[c] + m * ed, sx[c] - m * ex, s->planeWidth[c], s->planeHeight[c],
+                                        s->maxError64, res->numFrames64);
+            res->ci[c][1] = getAvgXPSNR(sd[c] > m * ed ? sd[c] - m * ed : 0.0, sx[c] + m * ex,
+                                        s->planeWidth[c], s->planeHeight[c], s->maxError64, res->numFrames64);
+        }
+        res->maxError64 = s->maxError64;
+    }
+done:
+    xpsnr_release(s);
+    scaler_destroy(sc);
+    for (h = 0; h <= hist; h++) {
+        xpsnr_free(ring[h]);
+    }
+    xpsnr_free(decdata);
+    job_finish(j);
+    return !res->err;
+}
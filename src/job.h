@@ -0,0 +1,221 @@
+/*****************************************************************************/
+/*
+ * Scoring jobs for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _JOB_H_
+#define _JOB_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "xpsnr.h"
+#include "pool.h"
+#include "pmu.h"
+
+#include <stdio.h>
+
+#define JOB_MSG_LEN 256
+/* search window of -align=auto */
+#define ALIGN_AUTO 16
+
+/* sums of the frames of one -segment= range */
+typedef struct JOBSEG {
+    long long first, last; /* frames scored, last inclusive, first -1 = none */
+    double sumWDist[3];
+    double sumXPSNR[3];
+    uint64_t numFrames64;
+    /* filled in by job_score() */
+    double xpsnr[3];
+    double wxp;
+} JOBSEG;
+
+/* per-frame XPSNR up to 100 dB in steps of 1/STATS_STEPS dB */
+#define STATS_STEPS 128
+#define STATS_BINS (100 * STATS_STEPS)
+
+typedef struct JOBFRAME {
+    long long frame;
+    double xpsnr[3];
+    double wxp;
+} JOBFRAME;
+
+/* distribution of per-frame XPSNR for -stats=, constant size */
+typedef struct JOBSTATS {
+    uint64_t n;
+    double min[3], max[3];
+    uint32_t hist[3][STATS_BINS + 1]; /* the last bin is 100 dB and up */
+    /* filled in by job_score() */
+    double p1[3], p5[3], p50[3];
+    /* max-heap on wxp of the worst frames, sorted best last by job_score() */
+    int nworst, maxworst;
+    JOBFRAME worst[1];
+} JOBSTATS;
+
+typedef struct JOBRES {
+    double sumWDist[3];
+    double sumXPSNR[3];
+    bool andIsInf[3];
+    uint64_t numFrames64;
+    uint64_t maxError64;
+    uint64_t dropped; /* frames only read for the history by job_live() */
+    double ci[3][2]; /* 95% confidence interval of xpsnr[] from job_sample() */
+    JOBSEG *segs; /* per segment sums, malloc'd, freed by the caller */
+    int nsegs;
+    JOBSTATS *stats; /* set by job_open() with -stats=, freed by the caller */
+    PMU_STATS pmu; /* per-stage counters with -pmu */
+    int planeWidth[3];
+    int planeHeight[3];
+    /* filled in once the last chunk is done */
+    double xpsnr[3];
+    double yuv;
+    double hm;
+    double wxp;
+    int err;
+    char msg[JOB_MSG_LEN];
+} JOBRES;
+
+typedef struct JOB JOB;
+
+/* called once per job after its last chunk has finished.
+ * calls are serialized, so it is safe to write output from here.
+ * the runner is done with the job once this is called */
+typedef void (*JOB_DONE)(JOB *j, void *user);
+
+/* called with the block weights of every scored frame in frame order, from
+ * the thread scoring it. w holds j->wblk * j->hblk weights in raster order
+ * that scale the luma SSE of their block, see xpsnr_weight_scale(). w is
+ * only valid during the call */
+typedef void (*JOB_WEIGHTS)(JOB *j, long long frame, const double *w, void *user);
+
+struct JOB {
+    /* input */
+    int id;
+    char *ref;
+    char *dst;
+    int w, h;
+    int subsamp;
+    int dw, dh; /* dst size if it differs from the ref, 0 = the same */
+    int dscale; /* SCALE_ filter resizing dst frames to the ref size */
+    int start; /* first frame scored, the ones before only fill the history */
+    int nfr; /* frames from start, -1 = as many as possible */
+    int fps_num, fps_den;
+    int y4m;
+    int uring; /* frames in flight per input with io_uring, 0 = stdio */
+    int direct; /* O_DIRECT with io_uring */
+    int zthreads; /* threads decompressing each .zst input ahead of the reader */
+    int offset; /* ref frame = dst frame + offset, updated by the search */
+    int align; /* search +-align frames for the offset, 0 = off */
+    int scale; /* score both inputs box filtered down by this factor, 1 = off */
+    int planes; /* 1 = luma only, the chroma is skipped unread, 3 = all */
+    /* x, y, w, h of the part of the ref luma scored in both inputs, w = 0 =
+     * the whole picture. x and y must be on the chroma sample grid */
+    int crop[4];
+    int autocrop; /* find the crop from the constant borders of the ref */
+    char *ckpt; /* checkpoint file, NULL = none. the job isn't split if set */
+    int ckpt_frames; /* frames between checkpoints, 0 = only at the end */
+    int resume; /* continue from the checkpoint in ckpt */
+    /* segments scored separately: every seglen frames from frame 0, or
+     * starting at each of the nseglist sorted frames in seglist */
+    int seglen;
+    const long long *seglist;
+    int nseglist;
+    int stats; /* per-frame statistics and this many worst frames, 0 = off */
+    /* MB a scoring thread may hold. larger frames are read and scored in
+     * row bands of one block row each, 0 = no limit */
+    int max_mem;
+    int pmu; /* count time and hardware events per stage into res.pmu */
+    /* directory of the result cache, NULL = off. jobs with ckpt, wfn or pmu
+     * and inputs that aren't regular files are always scored */
+    char *cache;
+    int cache_key; /* CACHE_CONTENT or CACHE_STAT, see cache.h */
+    JOB_DONE done;
+    void *user;
+    JOB_WEIGHTS wfn; /* the job isn't split if set */
+    void *wuser;
+
+    /* filled in by job_open(), fref is NULL until then */
+    XPSNR_META md;
+    FILE *fref;
+    FILE *fdst;
+    long long hdrlen[2]; /* Y4M stream header bytes, ref/dst */
+    long long nframes; /* end of the frames to score, -1 if unknown (pipes) */
+    size_t frmsz[2]; /* bytes per frame on disk, including the Y4M frame header */
+    /* x, y, w, h of the scored pictures within the frames after -scale=,
+     * from crop[] or the borders found by autocrop */
+    int win[4];
+    int bsize; /* block weight grid of the scored pictures, see JOB_WEIGHTS */
+    int wblk, hblk;
+    int band; /* scored in bands, see xpsnr_band_count() */
+    size_t bandsz; /* bytes of the largest band of either input */
+    int rmode; /* RESULT_ */
+    uint64_t rkey; /* key of the result in the cache */
+
+    /* owned by the runner */
+    int chunks;
+    void *wentry;
+    int wmode;
+    JOBRES res;
+};
+
+#define WEIGHTS_NONE   0
+#define WEIGHTS_USE    1 /* every frame's weights were recorded before */
+#define WEIGHTS_RECORD 2
+
+#define RESULT_NONE   0
+#define RESULT_STORE  1 /* scored and added to the cache when done */
+#define RESULT_CACHED 2 /* res was read from the cache, the inputs aren't open */
+
+/* open both inputs and fill in the geometry, or with a result cache fill in
+ * res from it if the same inputs were scored the same way before. returns 0
+ * and sets res.err and res.msg on failure */
+extern int job_open(JOB *j);
+extern void job_close(JOB *j);
+/* write the result as a single line JSON record */
+extern void job_print(FILE *f, JOB *j);
+/* compute the averages in res from the summed up frames */
+extern void job_score(JOB *j);
+/* save the sums of a scored job to a partial record. records of disjoint
+ * frame ranges of the same inputs add up to the result of one run over all
+ * of them. returns 0 on failure */
+extern int job_save_part(JOB *j, const char *path);
+/* add a partial record to the job's sums. the first record sets the
+ * geometry, later ones must match it. range is set to the frames the record
+ * covers. returns 0 and sets res.msg on failure */
+extern int job_merge_part(JOB *j, const char *path, long long range[2]);
+
+typedef struct RUNNER RUNNER;
+
+/* nthreads <= 1 scores everything on the calling thread */
+extern RUNNER *runner_create(int nthreads);
+extern void runner_destroy(RUNNER *r);
+/* score a job, opening it on a worker first unless job_open() was already
+ * called. large jobs donate frame ranges to idle workers */
+extern void runner_submit(RUNNER *r, JOB *j);
+/* keep the block weights of recently scored reference files, up to the given
+ * number of bytes, so later jobs on the same reference only compute the SSE.
+ * 0 (the default) disables the cache */
+extern void runner_weight_cache(RUNNER *r, size_t bytes);
+extern void runner_wait(RUNNER *r);
+
+/* score an opened job on the calling thread as its frames arrive, printing
+ * the XPSNR of the last window scored frames once per second of video.
+ * frames that are due before the previous one was scored at the declared
+ * frame rate are only read into the temporal history, so latency stays
+ * bounded. returns 0 and sets res.err on failure */
+extern int job_live(JOB *j, int window, FILE *out);
+/* estimate the XPSNR of an opened job from every n-th frame, reading only
+ * the one or two reference frames before each one for the temporal history
+ * and seeking past the rest. returns 0 and sets res.err on failure */
+extern int job_sample(JOB *j, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
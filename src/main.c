@@ -11,12 +11,21 @@
 /*****************************************************************************/
 #include "xpsnr.h"
 #include "util.h"
+#include "job.h"
+#include "serve.h"
+#include "tee.h"
+#include "wmap.h"
+#include "scale.h"
+#include "cache.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define DRV_VERSION "1.0.1"
 #define DRV_HEADER "Standalone XPSNR CLI | \x1b[36mv"DRV_VERSION"\x1b[0m\n"
@@ -28,6 +37,7 @@ static int verbose = 0;
 #define INP_FMT_422 1
 #define INP_FMT_420 2
 #define INP_FMT_411 3
+#define INP_FMT_NV12 4
 
 #ifndef CLAMP
 #define CLAMP(x, a, b) ((x) < (a) ? (a) : ((x) > (b) ? (b) : (x)))
@@ -45,6 +55,8 @@ fmt_to_subsamp(int fmt)
             return DSV_SUBSAMP_420;
         case INP_FMT_411:
             return DSV_SUBSAMP_411;
+        case INP_FMT_NV12:
+            return DSV_SUBSAMP_NV12;
     }
     return DSV_SUBSAMP_420;
 }
@@ -62,8 +74,16 @@ static struct PARAM dec_params[] = {
             "width of input video. 352 = default" },
     { "h=", 288, 16, (1 << 24), NULL,
             "height of input video. 288 = default" },
-    { "fmt=", DSV_SUBSAMP_420, 0, 3, fmt_to_subsamp,
-            "chroma subsampling format of input video. 0 = 4:4:4, 1 = 4:2:2, 2 = 4:2:0, 3 = 4:1:1, 2 = default" },
+    { "fmt=", DSV_SUBSAMP_420, 0, 4, fmt_to_subsamp,
+            "chroma subsampling format of input video. 0 = 4:4:4, 1 = 4:2:2, 2 = 4:2:0, 3 = 4:1:1, 4 = 4:2:0 semi-planar (NV12), 2 = default" },
+    { "dst_w=", 0, 0, (1 << 24), NULL,
+            "width of the distorted video if it differs from the reference (raw YUV). 0 = same as w. 0 = default" },
+    { "dst_h=", 0, 0, (1 << 24), NULL,
+            "height of the distorted video if it differs from the reference (raw YUV). 0 = same as h. 0 = default" },
+    { "dst_scale=", 0, 0, 2, NULL,
+            "filter resizing distorted frames to the reference size. 0 = none, 1 = bicubic, 2 = lanczos. 0 = default" },
+    { "start=", 0, 0, INT_MAX, NULL,
+            "first frame to score. the two frames before it are read for the temporal history. 0 = default" },
     { "nfr=", -1, -1, INT_MAX, NULL,
             "number of frames to compress. -1 means as many as possible. -1 = default" },
     { "fps_num=", 30, 1, (1 << 24), NULL,
@@ -72,12 +92,68 @@ static struct PARAM dec_params[] = {
             "fps denominator of input video. 1 = default" },
     { "y4m=", 0, 0, 1, NULL,
             "set to 1 if input is in Y4M format, 0 if raw YUV. 0 = default" },
+    { "threads=", 1, 1, 256, NULL,
+            "number of worker threads. long inputs are split between idle threads. 1 = default" },
+    { "uring=", 0, 0, 64, NULL,
+            "frames kept in flight per input by the io_uring reader (Linux), 0 = stdio. 0 = default" },
+    { "direct=", 0, 0, 1, NULL,
+            "set to 1 to bypass the page cache (O_DIRECT) with -uring=. 0 = default" },
+    { "zst_threads=", 2, 1, 64, NULL,
+            "threads decompressing each .zst input ahead of the reader (needs a build with -Dzstd=true). 2 = default" },
+    { "offset=", 0, -(1 << 24), (1 << 24), NULL,
+            "frame offset between the inputs, ref frame = dst frame + offset. 0 = default" },
+    { "align=", 0, 0, 1024, NULL,
+            "search +-N frames for the offset that best matches dst to ref, 0 = off. auto = 16. 0 = default" },
+    { "scale=", 1, 1, 4, NULL,
+            "score both inputs box filtered down by N in each direction for a quick preview, 1/2 or 1/4. 1 = default" },
+    { "planes=", 3, 1, 3, NULL,
+            "planes to score, y (1) = luma only without reading the chroma, yuv (3) = all. 3 = default" },
+    { "crop_w=", 0, 0, (1 << 24), NULL,
+            "width of the part of the picture to score, see -crop=. 0 = all. 0 = default" },
+    { "crop_h=", 0, 0, (1 << 24), NULL,
+            "height of the part of the picture to score. 0 = default" },
+    { "crop_x=", 0, 0, (1 << 24), NULL,
+            "left edge of the part of the picture to score, a multiple of the chroma subsampling. 0 = default" },
+    { "crop_y=", 0, 0, (1 << 24), NULL,
+            "top edge of the part of the picture to score, a multiple of the chroma subsampling. 0 = default" },
+    { "autocrop=", 0, 0, 1, NULL,
+            "set to 1 (or -autocrop) to only score the part of the picture inside constant borders of the reference. 0 = default" },
+    { "max_mem=", 0, 0, (1 << 20), NULL,
+            "MB a scoring thread may use. larger frames are read and scored one block row at a time, same results. 0 = no limit. 0 = default" },
+    { "pmu=", 0, 0, 1, NULL,
+            "set to 1 (or -pmu) to print the time, cycles, instructions and last level cache misses of each stage. 0 = default" },
+    { "wcache=", 256, 0, (1 << 20), NULL,
+            "MB of reference block weights kept for later jobs on the same reference (-jobs=, -serve=). 256 = default" },
+    { "live=", 0, 0, (1 << 20), NULL,
+            "score as the frames arrive and print the XPSNR of the last N frames every second of video, dropping frames when behind. 0 = off. 0 = default" },
+    { "sample=", 0, 0, INT_MAX, NULL,
+            "estimate the XPSNR from every N-th frame, seeking past the others, with a 95% confidence interval. 0 = off. 0 = default" },
+    { "stats=", 0, 0, 10000, NULL,
+            "print the minimum, 1st, 5th and 50th percentile of the per-frame XPSNR and the N worst frames. 0 = off. 0 = default" },
+    { "weights_fmt=", WMAP_F32, WMAP_F32, WMAP_U8, NULL,
+            "format of -weights_out=, 0 = 32-bit float, 1 = 8-bit log2 scale. 0 = default" },
+    { "cache_key=", CACHE_CONTENT, CACHE_CONTENT, CACHE_STAT, NULL,
+            "what -cache= knows the inputs by, content (0) = a hash of their bytes, stat (1) = their size, modification time and inode. 0 = default" },
+    { "ckpt_frames=", 1000, 0, INT_MAX, NULL,
+            "frames between checkpoints written by -checkpoint= or -resume=, 0 = only at the end. 1000 = default" },
     { NULL, 0, 0, 0, NULL, "" }
 };
 
+#define NUM_PARAMS (sizeof(dec_params) / sizeof(dec_params[0]))
+
 static struct {
    char *inp_dec;
    char *inp_ref;
+   char *jobs;
+   char *serve;
+   char *client;
+   char *ckpt;
+   int resume;
+   char *part;
+   char *segment;
+   char *wout;
+   char *cache;
+   int tee;
 } opts;
 
 static int
@@ -93,6 +169,18 @@ get_optval(struct PARAM *pars, char *name)
     return 0;
 }
 
+static void
+set_optval(struct PARAM *pars, char *name, int value)
+{
+    int i;
+    for (i = 0; pars[i].prefix != NULL; i++) {
+        struct PARAM *par = &pars[i];
+        if (strcmp(par->prefix, name) == 0) {
+            par->value = value;
+        }
+    }
+}
+
 static void
 print_params(struct PARAM *pars)
 {
@@ -105,9 +193,29 @@ print_params(struct PARAM *pars)
         printf("\t-%s : %s\n", par->prefix, par->desc);
         printf("\t      [min = %d, max = %d]\n", par->min, par->max);
     }
-    printf("\t-dst= : distorted input file.\n");
+    printf("\t-dst= : distorted input file. - = stdin\n");
     printf("\t-ref= : reference input file.\n");
+    printf("\t-crop= : w:h:x:y of the part of the picture to score, in reference luma samples.\n");
+    printf("\t        sets -crop_w=, -crop_h=, -crop_x= and -crop_y=.\n");
+    printf("\t-jobs= : manifest file, one job per line made of the options above\n");
+    printf("\t        (e.g. -ref=a.y4m -dst=b.y4m -y4m=1). prints one JSON record per job.\n");
+    printf("\t-serve= : run as a daemon on this Unix socket, one job per request line.\n");
+    printf("\t-client= : send the job given by the other options to a -serve= daemon.\n");
+    printf("\t-checkpoint= : periodically save the scoring state to this file.\n");
+    printf("\t-resume= : continue from the state saved in this checkpoint file, if it exists,\n");
+    printf("\t        and keep updating it. gives the same result as an uninterrupted run.\n");
+    printf("\t-part= : also write the sums to this partial record, see merge below.\n");
+    printf("\t-segment= : also print the XPSNR of every N frames (frames:N) or of the segments\n");
+    printf("\t        starting at the frame numbers listed in this file, one per line.\n");
+    printf("\t-weights_out= : also write the block weights of every scored frame to this file,\n");
+    printf("\t        for the adaptive quantization of an encoder.\n");
+    printf("\t-cache= : directory of scored results. a job scored the same way before on the same\n");
+    printf("\t        inputs is answered from there (see -cache_key=).\n");
+    printf("\t-tee  : pass the distorted video read from stdin on to stdout unchanged.\n");
+    printf("\t        results are printed to stderr.\n");
     printf("\t-v    : set verbose\n");
+    printf("\tmerge part.bin... : print the XPSNR of all frames covered by partial records\n");
+    printf("\t        (made with -start=, -nfr= and -part=) as if scored in one run.\n");
 }
 
 static void
@@ -115,6 +223,11 @@ sample_usage(char* p)
 {
     printf("\x1b[2mSample usage: %s -dst=decoded.y4m -ref=original.y4m -y4m=1\x1b[0m\n", p);
     printf("\x1b[2mSample usage: %s -dst=decoded.yuv -ref=original.yuv -w=352 -h=288 -fmt=2 -fps_num=30\x1b[0m\n", p);
+    printf("\x1b[2mSample usage: %s -jobs=manifest.txt -threads=8\x1b[0m\n", p);
+    printf("\x1b[2mSample usage: decoder | %s -tee -ref=original.y4m -y4m=1 | encoder\x1b[0m\n", p);
+    printf("\x1b[2mSample usage: %s -dst=decoded.y4m -ref=original.y4m -y4m=1 -resume=title.ckpt\x1b[0m\n", p);
+    printf("\x1b[2mSample usage: %s -dst=decoded.y4m -ref=original.y4m -y4m=1 -start=1000 -nfr=1000 -part=part1.bin; %s merge part*.bin\x1b[0m\n", p, p);
+    printf("\x1b[2mSample usage: %s -serve=/tmp/sxpsnr.sock -threads=8 & %s -client=/tmp/sxpsnr.sock -dst=decoded.y4m -ref=original.y4m -y4m=1\x1b[0m\n", p, p);
 }
 
 static void
@@ -162,33 +275,68 @@ prefixcmp(char *pref, char **s)
     return 0;
 }
 
+/* options that make up a job, shared by the command line and manifest lines */
 static int
-get_param(char *argv)
+get_job_param(char *p, struct PARAM *params, char **dst, char **ref)
 {
     int i;
-    char *p = argv;
     int err = 0;
-    struct PARAM *params;
 
-    if (*p != '-') {
-        fprintf(stderr, "\x1b[33mStrange argument: %s\x1b[0m\n", p);
-        return 0;
+    if (prefixcmp("dst=", &p)) {
+        *dst = p;
+        return 1;
     }
+    if (prefixcmp("ref=", &p)) {
+        *ref = p;
+        return 1;
+    }
+    if (strcmp("align=auto", p) == 0) {
+        set_optval(params, "align=", ALIGN_AUTO);
+        return 1;
+    }
+    if (strcmp("dst_scale=bicubic", p) == 0) {
+        set_optval(params, "dst_scale=", SCALE_BICUBIC);
+        return 1;
+    }
+    if (strcmp("dst_scale=lanczos", p) == 0) {
+        set_optval(params, "dst_scale=", SCALE_LANCZOS);
+        return 1;
+    }
+    if (strcmp("planes=y", p) == 0 || strcmp("planes=yuv", p) == 0) {
+        set_optval(params, "planes=", p[8] == '\0' ? 1 : 3);
+        return 1;
+    }
+    if (strcmp("autocrop", p) == 0) {
+        set_optval(params, "autocrop=", 1);
+        return 1;
+    }
+    if (prefixcmp("crop=", &p)) { /* w:h:x:y */
+        int v[4];
+        char end;
 
-    p++;
-    if (strcmp("v", p) == 0) {
-        verbose = 1;
+        if (sscanf(p, "%d:%d:%d:%d%c", &v[0], &v[1], &v[2], &v[3], &end) != 4
+                || v[0] <= 0 || v[1] <= 0 || v[2] < 0 || v[3] < 0) {
+            fprintf(stderr, "\x1b[31mError reading argument: \"crop=\"\x1b[0m\n");
+            return 0;
+        }
+        set_optval(params, "crop_w=", v[0]);
+        set_optval(params, "crop_h=", v[1]);
+        set_optval(params, "crop_x=", v[2]);
+        set_optval(params, "crop_y=", v[3]);
         return 1;
     }
-    if (prefixcmp("dst=", &p)) {
-        opts.inp_dec = p;
+    if (strcmp("cache_key=content", p) == 0 || strcmp("cache_key=stat", p) == 0) {
+        set_optval(params, "cache_key=", p[10] == 's' ? CACHE_STAT : CACHE_CONTENT);
         return 1;
     }
-    if (prefixcmp("ref=", &p)) {
-        opts.inp_ref = p;
+    if (strcmp("pmu", p) == 0) {
+        set_optval(params, "pmu=", 1);
+        return 1;
+    }
+    if (strcmp("scale=1/2", p) == 0 || strcmp("scale=1/4", p) == 0) {
+        set_optval(params, "scale=", p[8] - '0');
         return 1;
     }
-    params = dec_params;
     for (i = 0; params[i].prefix != NULL; i++) {
         struct PARAM *par = &params[i];
         if (!prefixcmp(par->prefix, &p)) {
@@ -206,6 +354,65 @@ get_param(char *argv)
     return 0;
 }
 
+static int
+get_param(char *argv)
+{
+    char *p = argv;
+
+    if (*p != '-') {
+        fprintf(stderr, "\x1b[33mStrange argument: %s\x1b[0m\n", p);
+        return 0;
+    }
+
+    p++;
+    if (strcmp("v", p) == 0) {
+        verbose = 1;
+        return 1;
+    }
+    if (strcmp("tee", p) == 0) {
+        opts.tee = 1;
+        return 1;
+    }
+    if (prefixcmp("jobs=", &p)) {
+        opts.jobs = p;
+        return 1;
+    }
+    if (prefixcmp("serve=", &p)) {
+        opts.serve = p;
+        return 1;
+    }
+    if (prefixcmp("client=", &p)) {
+        opts.client = p;
+        return 1;
+    }
+    if (prefixcmp("checkpoint=", &p)) {
+        opts.ckpt = p;
+        return 1;
+    }
+    if (prefixcmp("resume=", &p)) {
+        opts.ckpt = p;
+        opts.resume = 1;
+        return 1;
+    }
+    if (prefixcmp("part=", &p)) {
+        opts.part = p;
+        return 1;
+    }
+    if (prefixcmp("segment=", &p)) {
+        opts.segment = p;
+        return 1;
+    }
+    if (prefixcmp("weights_out=", &p)) {
+        opts.wout = p;
+        return 1;
+    }
+    if (prefixcmp("cache=", &p)) {
+        opts.cache = p;
+        return 1;
+    }
+    return get_job_param(p, dec_params, &opts.inp_dec, &opts.inp_ref);
+}
+
 static int
 init_params(int argc, char **argv)
 {
@@ -230,200 +437,639 @@ init_params(int argc, char **argv)
     return 1;
 }
 
-static XPSNR_FRAME *
-load_planar_frame(int format, void *data, int width, int height)
+static void
+job_from_params(JOB *j, struct PARAM *pars)
 {
-    XPSNR_FRAME *f;
-    int hs, vs;
-
-    f = xpsnr_allocz(sizeof(XPSNR_FRAME));
-    hs = DSV_FORMAT_H_SHIFT(format);
-    vs = DSV_FORMAT_V_SHIFT(format);
-
-    f->planes[0].format = format;
-    f->planes[0].w = width;
-    f->planes[0].h = height;
-    f->planes[0].stride = width;
-    f->planes[0].data = data;
-    f->planes[0].len = f->planes[0].stride * f->planes[0].h;
-
-    width = DSV_ROUND_SHIFT(width, hs);
-    height = DSV_ROUND_SHIFT(height, vs);
-
-    f->planes[1].format = format;
-    f->planes[1].w = width;
-    f->planes[1].h = height;
-    f->planes[1].stride = f->planes[1].w;
-    f->planes[1].len = f->planes[1].stride * f->planes[1].h;
-    f->planes[1].data = f->planes[0].data + f->planes[0].len;
-
-    f->planes[2].format = format;
-    f->planes[2].w = width;
-    f->planes[2].h = height;
-    f->planes[2].stride = f->planes[2].w;
-    f->planes[2].len = f->planes[2].stride * f->planes[2].h;
-    f->planes[2].data = f->planes[1].data + f->planes[1].len;
-    return f;
+    j->w = get_optval(pars, "w=");
+    j->h = get_optval(pars, "h=");
+    j->subsamp = get_optval(pars, "fmt=");
+    j->dw = get_optval(pars, "dst_w=");
+    j->dh = get_optval(pars, "dst_h=");
+    j->dscale = get_optval(pars, "dst_scale=");
+    j->start = get_optval(pars, "start=");
+    j->nfr = get_optval(pars, "nfr=");
+    j->fps_num = get_optval(pars, "fps_num=");
+    j->fps_den = get_optval(pars, "fps_den=");
+    j->y4m = get_optval(pars, "y4m=");
+    j->uring = get_optval(pars, "uring=");
+    j->direct = get_optval(pars, "direct=");
+    j->zthreads = get_optval(pars, "zst_threads=");
+    j->offset = get_optval(pars, "offset=");
+    j->align = get_optval(pars, "align=");
+    j->scale = get_optval(pars, "scale=");
+    j->planes = get_optval(pars, "planes=");
+    j->crop[0] = get_optval(pars, "crop_x=");
+    j->crop[1] = get_optval(pars, "crop_y=");
+    j->crop[2] = get_optval(pars, "crop_w=");
+    j->crop[3] = get_optval(pars, "crop_h=");
+    j->autocrop = get_optval(pars, "autocrop=");
+    j->stats = get_optval(pars, "stats=");
+    j->max_mem = get_optval(pars, "max_mem=");
+    j->pmu = get_optval(pars, "pmu=");
+    j->cache_key = get_optval(pars, "cache_key=");
 }
 
-static int
-readframes(void)
+static char *
+read_file(char *name)
 {
-    XPSNR_META md;
-    uint32_t frno = 0;
-    int w, h;
-    FILE *decfile, *reffile;
-    int y4m_in = 0;
-    int maxframe, nfr;
-    uint8_t *refdata;
-    uint8_t *decdata;
-    XPSNRContext xpctx;
-    double lxp, uxp, vxp, yuvxp, wxp, hm;
-
-    decfile = fopen(opts.inp_dec, "rb");
-    if (decfile == NULL) {
-        fprintf(stderr, "error opening input file %s\n", opts.inp_dec);
-        return EXIT_FAILURE;
-    }
-    reffile = fopen(opts.inp_ref, "rb");
-    if (reffile == NULL) {
-        fprintf(stderr, "error opening input file %s\n", opts.inp_ref);
-        return EXIT_FAILURE;
+    FILE *f;
+    char *buf = NULL;
+    size_t len = 0, cap = 0, n;
+
+    f = fopen(name, "rb");
+    if (f == NULL) {
+        return NULL;
     }
+    do {
+        if (cap - len < 4096) {
+            char *nbuf;
 
-    w = get_optval(dec_params, "w=");
-    h = get_optval(dec_params, "h=");
-    md.width = w;
-    md.height = h;
-    md.subsamp = get_optval(dec_params, "fmt=");
-    md.fps_num = get_optval(dec_params, "fps_num=");
-    md.fps_den = get_optval(dec_params, "fps_den=");
+            cap = cap ? cap * 2 : 65536;
+            nbuf = realloc(buf, cap + 1);
+            if (nbuf == NULL) {
+                free(buf);
+                fclose(f);
+                return NULL;
+            }
+            buf = nbuf;
+        }
+        n = fread(buf + len, 1, cap - len, f);
+        len += n;
+    } while (n > 0);
+    fclose(f);
+    buf[len] = '\0';
+    return buf;
+}
+
+static int
+cmp_frame(const void *a, const void *b)
+{
+    const long long *fa = a;
+    const long long *fb = b;
 
-    y4m_in = get_optval(dec_params, "y4m=");
-    if (y4m_in) {
-        int fr[2] = { 1, 1 };
+    return (*fa > *fb) - (*fa < *fb);
+}
 
-        if (!dsv_y4m_read_hdr(reffile, &md.width, &md.height, &md.subsamp, fr)) {
-            fprintf(stderr, "(ref) bad Y4M file %s\n", opts.inp_ref);
-            return EXIT_FAILURE;
+/* -segment=frames:N or a file of segment start frames. returns 0 on error */
+static int
+parse_segments(JOB *j, const char *spec, long long **list)
+{
+    char *text, *p, *end;
+    long long *l = NULL;
+    int n = 0, cap = 0, k;
+
+    *list = NULL;
+    if (strncmp(spec, "frames:", 7) == 0) {
+        j->seglen = strtol(spec + 7, &end, 10);
+        return *end == '\0' && j->seglen > 0;
+    }
+    text = read_file((char *) spec);
+    if (text == NULL) {
+        return 0;
+    }
+    for (p = text; *p; ) {
+        long long f;
+
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+            p++;
         }
-        w = md.width;
-        h = md.height;
-        if (!dsv_y4m_read_hdr(decfile, &md.width, &md.height, &md.subsamp, fr)) {
-            fprintf(stderr, "(dec) bad Y4M file %s\n", opts.inp_dec);
-            return EXIT_FAILURE;
+        if (*p == '#') { /* comment */
+            p += strcspn(p, "\n");
+            continue;
         }
-        if (w != md.width || h != md.height) {
-            fprintf(stderr, "dst & ref dimensions do not match! %dx%d vs %dx%d\n", md.width, md.height, w, h);
-            return EXIT_FAILURE;
+        if (*p == '\0') {
+            break;
         }
-        md.fps_num = fr[0];
-        md.fps_den = fr[1];
-        if (md.fps_den <= 0) {
-            fprintf(stderr, "fps denominator was <= 0. Setting to 1.");
-            md.fps_den = 1;
+        f = strtoll(p, &end, 10);
+        if (end == p || f < 0) {
+            free(l);
+            free(text);
+            return 0;
+        }
+        p = end;
+        if (n == cap) {
+            long long *nl;
+
+            cap = cap ? cap * 2 : 64;
+            nl = realloc(l, cap * sizeof(long long));
+            if (nl == NULL) {
+                free(l);
+                free(text);
+                return 0;
+            }
+            l = nl;
+        }
+        l[n++] = f;
+    }
+    free(text);
+    qsort(l, n, sizeof(long long), cmp_frame);
+    for (k = 0; n > 0 && k < n - 1; ) { /* drop duplicates */
+        if (l[k] == l[k + 1]) {
+            memmove(l + k, l + k + 1, (n - k - 1) * sizeof(long long));
+            n--;
+        } else {
+            k++;
         }
     }
+    j->seglist = l;
+    j->nseglist = n;
+    *list = l;
+    return n > 0;
+}
+
+static void
+print_result(FILE *out, JOB *j)
+{
+    JOBRES *res = &j->res;
 
-#define EXTRA_PAD 1
-    decdata = xpsnr_allocz(w * h * (3 + EXTRA_PAD)); /* allocate extra to be safe */
-    refdata = xpsnr_allocz(w * h * (3 + EXTRA_PAD));
+    if (j->planes == 1) {
+        fprintf(out, "XPSNR Y \t= %f\n", res->xpsnr[0]);
+        return;
+    }
+    fprintf(out, "XPSNR Y \t= %f | XPSNR YUV\t\t= %f\n", res->xpsnr[0], res->yuv);
+    fprintf(out, "XPSNR U \t= %f | HarmMean YUV\t= %f\n", res->xpsnr[1], res->hm);
+    fprintf(out, "XPSNR V \t= %f | Weighted XPSNR\t= %f\n", res->xpsnr[2], res->wxp);
+}
+
+static void
+write_weights(JOB *j, long long frame, const double *w, void *user)
+{
+    (void) j;
+    wmap_frame(user, frame, w);
+}
+
+static int
+readframes(FILE *out)
+{
+    JOB job;
+    RUNNER *runner;
+    JOBRES *res = &job.res;
+    WMAP *wmap = NULL;
+    long long *seglist = NULL;
+    int ret, i;
+
+    memset(&job, 0, sizeof(job));
+    job.dst = opts.inp_dec;
+    job.ref = opts.inp_ref;
+    job_from_params(&job, dec_params);
+    job.ckpt = opts.ckpt;
+    job.ckpt_frames = get_optval(dec_params, "ckpt_frames=");
+    if (get_optval(dec_params, "live=") == 0 && get_optval(dec_params, "sample=") <= 1) {
+        job.cache = opts.cache;
+    }
+    if ((opts.segment || job.stats > 0)
+            && (opts.ckpt || get_optval(dec_params, "live=") > 0 || get_optval(dec_params, "sample=") > 1)) {
+        fprintf(stderr, "-segment= and -stats= can't be combined with -checkpoint=, -live= or -sample=\n");
+        return EXIT_FAILURE;
+    }
+    if (opts.wout
+            && (opts.resume || get_optval(dec_params, "live=") > 0 || get_optval(dec_params, "sample=") > 1)) {
+        fprintf(stderr, "-weights_out= can't be combined with -resume=, -live= or -sample=\n");
+        return EXIT_FAILURE;
+    }
+    if ((job.max_mem > 0 || job.pmu) && (get_optval(dec_params, "live=") > 0 || get_optval(dec_params, "sample=") > 1)) {
+        fprintf(stderr, "-max_mem= and -pmu can't be combined with -live= or -sample=\n");
+        return EXIT_FAILURE;
+    }
+    if (opts.wout) {
+        job.wfn = write_weights;
+    }
+    if (opts.segment) {
+        if (!parse_segments(&job, opts.segment, &seglist)) {
+            fprintf(stderr, "error reading segments %s\n", opts.segment);
+            return EXIT_FAILURE;
+        }
+    }
+    job.resume = opts.resume;
+    if (!job_open(&job)) {
+        fprintf(stderr, "%s\n", res->msg);
+        free(res->stats);
+        free(seglist);
+        return EXIT_FAILURE;
+    }
+    if (opts.wout) {
+        WMAP_HDR hdr;
 
-    nfr = get_optval(dec_params, "nfr=");
-    if (nfr > 0) {
-        maxframe = frno + nfr;
-    } else {
-        maxframe = -1;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, WMAP_MAGIC, sizeof(hdr.magic));
+        hdr.endian = WMAP_ENDIAN;
+        hdr.w = job.win[2];
+        hdr.h = job.win[3];
+        hdr.bsize = job.bsize;
+        hdr.wblk = job.wblk;
+        hdr.hblk = job.hblk;
+        hdr.format = get_optval(dec_params, "weights_fmt=");
+        hdr.fps_num = job.md.fps_num;
+        hdr.fps_den = job.md.fps_den;
+        wmap = wmap_open(opts.wout, &hdr);
+        if (wmap == NULL) {
+            fprintf(stderr, "error opening %s\n", opts.wout);
+            job_close(&job);
+            free(res->stats);
+            free(seglist);
+            return EXIT_FAILURE;
+        }
+        job.wuser = wmap;
     }
+
     if (verbose) {
-        printf("%s video | ", y4m_in ? "YUV4MPEG2" : "Raw YUV");
-        printf("%dx%d @ %d/%d frames per second | ", w, h, md.fps_num, md.fps_den);
-        switch (md.subsamp) {
+        fprintf(out, "%s video | ", job.y4m ? "YUV4MPEG2" : "Raw YUV");
+        fprintf(out, "%dx%d @ %d/%d frames per second | ", job.w, job.h, job.md.fps_num, job.md.fps_den);
+        switch (job.md.subsamp) {
             case DSV_SUBSAMP_444:
-                puts("Planar YUV 4:4:4");
+                fprintf(out, "Planar YUV 4:4:4\n");
                 break;
             case DSV_SUBSAMP_422:
-                puts("Planar YUV 4:2:2");
+                fprintf(out, "Planar YUV 4:2:2\n");
                 break;
             case DSV_SUBSAMP_420:
-                puts("Planar YUV 4:2:0");
+                fprintf(out, "Planar YUV 4:2:0\n");
                 break;
             case DSV_SUBSAMP_411:
-                puts("Planar YUV 4:1:1");
+                fprintf(out, "Planar YUV 4:1:1\n");
+                break;
+            case DSV_SUBSAMP_NV12:
+                fprintf(out, "Semi-planar YUV 4:2:0 (NV12)\n");
                 break;
         }
     }
-    puts("Calculating XPSNR...");
-    memset(&xpctx, 0, sizeof(xpctx));
+    fprintf(out, "Calculating XPSNR...\n");
 
-    while (1) {
-        XPSNR_FRAME *decf, *reff;
-        if (maxframe > 0 && frno >= (unsigned) maxframe) {
-            break;
+    if (get_optval(dec_params, "live=") > 0) {
+        if (!job_live(&job, get_optval(dec_params, "live="), out)) {
+            fprintf(stderr, "%s\n", res->msg);
+            return EXIT_FAILURE;
         }
-        if (y4m_in) {
-            if (dsv_y4m_read_seq(decfile, decdata, w, h, md.subsamp) < 0) {
-                break;
-            }
-            if (dsv_y4m_read_seq(reffile, refdata, w, h, md.subsamp) < 0) {
-                break;
-            }
+        fprintf(out, "---\n");
+        fprintf(out, "Frames scored\t= %llu of %llu\n", (unsigned long long) res->numFrames64,
+                (unsigned long long) (res->numFrames64 + res->dropped));
+        print_result(out, &job);
+        return EXIT_SUCCESS;
+    }
+    if (get_optval(dec_params, "sample=") > 1) {
+        if (!job_sample(&job, get_optval(dec_params, "sample="))) {
+            fprintf(stderr, "%s\n", res->msg);
+            return EXIT_FAILURE;
+        }
+        fprintf(out, "---\n");
+        fprintf(out, "Frames scored\t= %llu (every %d)\n", (unsigned long long) res->numFrames64,
+                get_optval(dec_params, "sample="));
+        print_result(out, &job);
+        fprintf(out, "95%% CI Y \t= [%f, %f]\n", res->ci[0][0], res->ci[0][1]);
+        if (job.planes != 1) {
+            fprintf(out, "95%% CI U \t= [%f, %f]\n", res->ci[1][0], res->ci[1][1]);
+            fprintf(out, "95%% CI V \t= [%f, %f]\n", res->ci[2][0], res->ci[2][1]);
+        }
+        return EXIT_SUCCESS;
+    }
+    runner = runner_create(get_optval(dec_params, "threads="));
+    if (runner == NULL) {
+        fprintf(stderr, "error creating worker threads\n");
+        job_close(&job);
+        wmap_close(wmap);
+        free(res->stats);
+        free(seglist);
+        return EXIT_FAILURE;
+    }
+    runner_submit(runner, &job);
+    runner_wait(runner);
+    runner_destroy(runner);
+    ret = EXIT_SUCCESS;
+    if (!wmap_close(wmap)) {
+        fprintf(stderr, "error writing block weights %s\n", opts.wout);
+        ret = EXIT_FAILURE;
+    }
+    if (res->err) {
+        fprintf(stderr, "%s\n", res->msg);
+        ret = EXIT_FAILURE;
+        goto done;
+    }
+
+    fprintf(out, "---\n");
+    if (job.rmode == RESULT_CACHED) {
+        fprintf(out, "Cached result\t= %s/%016llx.res\n", job.cache, (unsigned long long) job.rkey);
+    }
+    if (job.align > 0) {
+        fprintf(out, "Frame offset\t= %d (ref frame = dst frame + offset)\n", job.offset);
+    }
+    if (job.scale > 1) {
+        fprintf(out, "Preview scale\t= 1/%d (%dx%d)\n", job.scale, job.w / job.scale, job.h / job.scale);
+    }
+    if (job.crop[2] > 0 || job.autocrop) {
+        fprintf(out, "Scored window\t= %dx%d at %d,%d\n", job.win[2], job.win[3], job.win[0], job.win[1]);
+    }
+    print_result(out, &job);
+    for (i = 0; i < res->nsegs; i++) {
+        JOBSEG *g = &res->segs[i];
+
+        if (g->numFrames64 == 0) {
+            continue;
+        }
+        if (job.planes == 1) {
+            fprintf(out, "segment %d\tframes %lld-%lld\tY %f\n", i, g->first, g->last, g->xpsnr[0]);
         } else {
-            if (dsv_yuv_read_seq(decfile, decdata, w, h, md.subsamp) < 0) {
-                break;
-            }
-            if (dsv_yuv_read_seq(reffile, refdata, w, h, md.subsamp) < 0) {
-                break;
+            fprintf(out, "segment %d\tframes %lld-%lld\tY %f U %f V %f | weighted %f\n", i,
+                    g->first, g->last, g->xpsnr[0], g->xpsnr[1], g->xpsnr[2], g->wxp);
+        }
+    }
+    if (res->stats != NULL && res->stats->n > 0) {
+        JOBSTATS *st = res->stats;
+        const char *pl = "YUV";
+
+        for (i = 0; i < (job.planes == 1 ? 1 : 3); i++) {
+            fprintf(out, "Frame XPSNR %c \t= min %f | P1 %f | P5 %f | P50 %f\n", pl[i],
+                    st->min[i], st->p1[i], st->p5[i], st->p50[i]);
+        }
+        for (i = 0; i < st->nworst; i++) {
+            JOBFRAME *f = &st->worst[i];
+
+            if (job.planes == 1) {
+                fprintf(out, "worst %d\tframe %lld\tY %f\n", i + 1, f->frame, f->xpsnr[0]);
+            } else {
+                fprintf(out, "worst %d\tframe %lld\tY %f U %f V %f | weighted %f\n", i + 1,
+                        f->frame, f->xpsnr[0], f->xpsnr[1], f->xpsnr[2], f->wxp);
             }
         }
-        decf = load_planar_frame(md.subsamp, decdata, w, h);
-        reff = load_planar_frame(md.subsamp, refdata, w, h);
-        /* compute metrics and accumulate */
-        accum(&xpctx, reff, decf, &md);
-
-        xpsnr_free(reff);
-        xpsnr_free(decf);
-        xpctx.numFrames64++;
-        frno++;
-    }
-    lxp = getAvgXPSNR(xpctx.sumWDist[0], xpctx.sumXPSNR[0],
-            xpctx.planeWidth[0], xpctx.planeHeight[0], xpctx.maxError64,
-            xpctx.numFrames64);
-    uxp = getAvgXPSNR(xpctx.sumWDist[1], xpctx.sumXPSNR[1],
-            xpctx.planeWidth[1], xpctx.planeHeight[1], xpctx.maxError64,
-            xpctx.numFrames64);
-    vxp = getAvgXPSNR(xpctx.sumWDist[2], xpctx.sumXPSNR[2],
-            xpctx.planeWidth[2], xpctx.planeHeight[2], xpctx.maxError64,
-            xpctx.numFrames64);
-    yuvxp = (lxp + uxp + vxp) / 3.0;
-    wxp = ((lxp * 4.0) + uxp + vxp) / 6.0;
-    hm = 3.0 / ((1.0 / lxp) + (1.0 / uxp) + (1.0 / vxp));
-    printf("---\n");
-    printf("XPSNR Y \t= %f | XPSNR YUV\t\t= %f\n", lxp, yuvxp);
-    printf("XPSNR U \t= %f | HarmMean YUV\t= %f\n", uxp, hm);
-    printf("XPSNR V \t= %f | Weighted XPSNR\t= %f\n", vxp, wxp);
-
-    fclose(decfile);
-    fclose(reffile);
-    xpsnr_free(decdata);
-    xpsnr_free(refdata);
+    }
+    if (job.pmu && res->pmu.threads > 0) {
+        pmu_print(out, &res->pmu);
+    }
+    if (opts.part && !job_save_part(&job, opts.part)) {
+        fprintf(stderr, "error writing partial record %s\n", opts.part);
+        ret = EXIT_FAILURE;
+    }
+done:
+    free(res->segs);
+    free(res->stats);
+    free(seglist);
+    return ret;
+}
+
+/* -tee: score the distorted video arriving on stdin while passing it on to
+ * stdout unchanged. the results go to stderr */
+static int
+runtee(void)
+{
+    TEE *tee;
+    struct stat pst, st;
+    int in, rfd, ret;
 
+    if (opts.inp_dec != NULL && strcmp(opts.inp_dec, "-") != 0) {
+        fprintf(stderr, "-tee needs the distorted video on stdin (-dst=-)\n");
+        return EXIT_FAILURE;
+    }
+    opts.inp_dec = "-";
+    in = dup(STDIN_FILENO);
+    tee = (in < 0) ? NULL : tee_open(in, STDOUT_FILENO, &rfd);
+    if (tee == NULL) {
+        fprintf(stderr, "error setting up -tee\n");
+        return EXIT_FAILURE;
+    }
+    /* the scorer reads the copy on stdin as usual */
+    dup2(rfd, STDIN_FILENO);
+    close(rfd);
+    fstat(STDIN_FILENO, &pst);
+    ret = readframes(stderr);
+    /* the job closes stdin once it opened it, only close our end if it failed
+     * before that. the rest is then only passed on */
+    if (fstat(STDIN_FILENO, &st) == 0 && st.st_dev == pst.st_dev && st.st_ino == pst.st_ino) {
+        close(STDIN_FILENO);
+    }
+    if (!tee_close(tee)) {
+        fprintf(stderr, "error writing to stdout\n");
+        ret = EXIT_FAILURE;
+    }
+    close(in);
+    return ret;
+}
+
+static int
+cmp_range(const void *a, const void *b)
+{
+    const long long *ra = a;
+    const long long *rb = b;
+
+    return (ra[0] > rb[0]) - (ra[0] < rb[0]);
+}
+
+/* sxpsnr merge part.bin... */
+static int
+runmerge(int nparts, char **parts)
+{
+    JOB job;
+    long long (*ranges)[2];
+    int i;
+
+    if (nparts < 1) {
+        fprintf(stderr, "merge: no partial records given\n");
+        return EXIT_FAILURE;
+    }
+    ranges = malloc(nparts * sizeof(*ranges));
+    if (ranges == NULL) {
+        return EXIT_FAILURE;
+    }
+    memset(&job, 0, sizeof(job));
+    for (i = 0; i < nparts; i++) {
+        if (!job_merge_part(&job, parts[i], ranges[i])) {
+            fprintf(stderr, "%s\n", job.res.msg);
+            free(ranges);
+            return EXIT_FAILURE;
+        }
+    }
+    qsort(ranges, nparts, sizeof(*ranges), cmp_range);
+    for (i = 1; i < nparts; i++) {
+        if (ranges[i][0] < ranges[i - 1][1]) {
+            fprintf(stderr, "merge: partial records overlap at frame %lld\n", ranges[i][0]);
+            free(ranges);
+            return EXIT_FAILURE;
+        }
+        if (ranges[i][0] > ranges[i - 1][1]) {
+            fprintf(stderr, "\x1b[33mwarning: frames %lld-%lld are not covered\x1b[0m\n",
+                    ranges[i - 1][1], ranges[i][0] - 1);
+        }
+    }
+    free(ranges);
+    job_score(&job);
+    if (verbose) {
+        printf("%llu frames\n", (unsigned long long) job.res.numFrames64);
+    }
+    print_result(stdout, &job);
     return EXIT_SUCCESS;
 }
 
+static void
+print_record(JOB *j, void *user)
+{
+    (void) user;
+    job_print(stdout, j);
+}
+
+/* parse one manifest line in place. options not given on the line keep the
+ * values given on the command line */
+static int
+parse_job(JOB *j, char *line)
+{
+    struct PARAM pars[NUM_PARAMS];
+    char *tok = line;
+
+    memcpy(pars, dec_params, sizeof(pars));
+    j->dst = opts.inp_dec;
+    j->ref = opts.inp_ref;
+    while (*tok) {
+        char *end;
+
+        while (*tok == ' ' || *tok == '\t' || *tok == '\r') {
+            tok++;
+        }
+        if (*tok == '\0') {
+            break;
+        }
+        end = tok;
+        while (*end && *end != ' ' && *end != '\t' && *end != '\r') {
+            end++;
+        }
+        if (*end) {
+            *end++ = '\0';
+        }
+        if (!get_job_param(*tok == '-' ? tok + 1 : tok, pars, &j->dst, &j->ref)) {
+            return 0;
+        }
+        tok = end;
+    }
+    job_from_params(j, pars);
+    j->cache = opts.cache;
+    return j->dst != NULL && j->ref != NULL;
+}
+
+static int
+runjobs(void)
+{
+    char *text, *line;
+    JOB *jobs;
+    RUNNER *runner;
+    int njobs = 0, cap = 0, lineno = 0, i, failed = 0;
+
+    text = read_file(opts.jobs);
+    if (text == NULL) {
+        fprintf(stderr, "error reading job manifest %s\n", opts.jobs);
+        return EXIT_FAILURE;
+    }
+    jobs = NULL;
+    for (line = text; line != NULL && *line; ) {
+        char *next = strchr(line, '\n');
+
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        lineno++;
+        while (*line == ' ' || *line == '\t') {
+            line++;
+        }
+        if (*line != '\0' && *line != '#' && *line != '\r') {
+            if (njobs == cap) {
+                cap = cap ? cap * 2 : 256;
+                jobs = realloc(jobs, cap * sizeof(JOB));
+                if (jobs == NULL) {
+                    fprintf(stderr, "out of memory reading job manifest\n");
+                    free(text);
+                    return EXIT_FAILURE;
+                }
+            }
+            memset(&jobs[njobs], 0, sizeof(JOB));
+            if (!parse_job(&jobs[njobs], line)) {
+                fprintf(stderr, "%s:%d: bad job, needs -dst= and -ref=\n", opts.jobs, lineno);
+                free(jobs);
+                free(text);
+                return EXIT_FAILURE;
+            }
+            jobs[njobs].id = njobs;
+            jobs[njobs].done = print_record;
+            njobs++;
+        }
+        line = next;
+    }
+
+    runner = runner_create(get_optval(dec_params, "threads="));
+    if (runner == NULL) {
+        fprintf(stderr, "error creating worker threads\n");
+        free(jobs);
+        free(text);
+        return EXIT_FAILURE;
+    }
+    runner_weight_cache(runner, (size_t) get_optval(dec_params, "wcache=") << 20);
+    for (i = 0; i < njobs; i++) {
+        runner_submit(runner, &jobs[i]);
+    }
+    runner_wait(runner);
+    runner_destroy(runner);
+    for (i = 0; i < njobs; i++) {
+        failed |= jobs[i].res.err;
+    }
+    free(jobs);
+    free(text);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int
+runserver(void)
+{
+    RUNNER *runner;
+    int ret;
+
+    runner = runner_create(get_optval(dec_params, "threads="));
+    if (runner == NULL) {
+        fprintf(stderr, "error creating worker threads\n");
+        return EXIT_FAILURE;
+    }
+    runner_weight_cache(runner, (size_t) get_optval(dec_params, "wcache=") << 20);
+    if (verbose) {
+        printf("listening on %s\n", opts.serve);
+        fflush(stdout);
+    }
+    ret = serve(opts.serve, runner, parse_job);
+    runner_destroy(runner);
+    return ret;
+}
+
 static int
 startup(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        if (argc > 2 && strcmp(argv[2], "-v") == 0) {
+            verbose = 1;
+            return runmerge(argc - 3, argv + 3);
+        }
+        return runmerge(argc - 2, argv + 2);
+    }
     if (!init_params(argc, argv)) {
         return EXIT_SUCCESS;
     }
-    if (!opts.inp_dec || !opts.inp_ref) {
+    if (opts.client) {
+        int i, n = 0;
+
+        /* pass on every job option, the daemon fills in its own defaults */
+        for (i = 1; i < argc; i++) {
+            if (strncmp(argv[i], "-client=", 8) != 0 && strcmp(argv[i], "-v") != 0) {
+                argv[1 + n++] = argv[i];
+            }
+        }
+        return serve_client(opts.client, n, argv + 1, stdout);
+    }
+    if (opts.serve) {
+        return runserver();
+    }
+    if (opts.jobs) {
+        return runjobs();
+    }
+    if ((!opts.inp_dec && !opts.tee) || !opts.inp_ref) {
         fprintf(stderr, "dst= or ref= was not specified!\n");
         usage();
         return EXIT_FAILURE;
     }
-
-    return readframes();
+    if (opts.tee) {
+        return runtee();
+    }
+    return readframes(stdout);
 }
 
 int
@@ -0,0 +1,283 @@
+/*****************************************************************************/
+/*
+ * Hardware performance counters for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _GNU_SOURCE /* syscall() */
+#include "pmu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+static const char *stage_names[PMU_STAGES] = {
+    "read", "copy", "sse", "spatial", "temporal", "chroma", "finalize"
+};
+
+struct PMU {
+    int fd[PMU_EVENTS]; /* -1 = not counted */
+    int slot[PMU_EVENTS]; /* position in the group read */
+    int group; /* fd of the group leader, -1 = time only */
+    int nslots;
+    int stage;
+    double t;
+    uint64_t last[PMU_EVENTS];
+    PMU_STATS st;
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+#if defined(__linux__)
+
+static int
+open_event(uint64_t config, int group)
+{
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HARDWARE;
+    pe.size = sizeof(pe);
+    pe.config = config;
+    pe.disabled = (group < 0);
+    pe.exclude_kernel = 1; /* allowed up to perf_event_paranoid = 2 */
+    pe.exclude_hv = 1;
+    pe.read_format = PERF_FORMAT_GROUP;
+    return (int) syscall(__NR_perf_event_open, &pe, 0, -1, group, 0);
+}
+
+/* current values of the counted events, 0 on failure */
+static int
+read_group(PMU *p, uint64_t *val)
+{
+    uint64_t buf[1 + PMU_EVENTS];
+    ssize_t want = (ssize_t) ((1 + p->nslots) * sizeof(uint64_t));
+    int e;
+
+    if (read(p->group, buf, want) != want || buf[0] != (uint64_t) p->nslots) {
+        return 0;
+    }
+    for (e = 0; e < PMU_EVENTS; e++) {
+        val[e] = p->fd[e] < 0 ? 0 : buf[1 + p->slot[e]];
+    }
+    return 1;
+}
+
+static void
+open_counters(PMU *p)
+{
+    static const uint64_t config[PMU_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    int e;
+
+    for (e = 0; e < PMU_EVENTS; e++) {
+        p->fd[e] = open_event(config[e], p->group);
+        if (p->fd[e] < 0) {
+            continue;
+        }
+        if (p->group < 0) {
+            p->group = p->fd[e];
+        }
+        p->slot[e] = p->nslots++;
+    }
+    if (p->group >= 0) {
+        ioctl(p->group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        if (!read_group(p, p->last)) {
+            for (e = 0; e < PMU_EVENTS; e++) {
+                if (p->fd[e] >= 0) {
+                    close(p->fd[e]);
+                }
+                p->fd[e] = -1;
+            }
+            p->group = -1;
+            p->nslots = 0;
+        }
+    }
+}
+
+static void
+close_counters(PMU *p)
+{
+    int e;
+
+    for (e = 0; e < PMU_EVENTS; e++) {
+        if (p->fd[e] >= 0) {
+            close(p->fd[e]);
+        }
+    }
+}
+
+#else /* no perf_event_open() on this platform, time only */
+
+static int
+read_group(PMU *p, uint64_t *val)
+{
+    (void) p; (void) val;
+    return 0;
+}
+
+static void
+open_counters(PMU *p)
+{
+    (void) p;
+}
+
+static void
+close_counters(PMU *p)
+{
+    (void) p;
+}
+
+#endif
+
+extern PMU *
+pmu_open(void)
+{
+    PMU *p;
+    int e;
+
+    p = calloc(1, sizeof(PMU));
+    if (p == NULL) {
+        return NULL;
+    }
+    for (e = 0; e < PMU_EVENTS; e++) {
+        p->fd[e] = -1;
+    }
+    p->group = -1;
+    p->stage = PMU_READ;
+    open_counters(p);
+    p->t = now();
+    return p;
+}
+
+extern void
+pmu_mark(PMU *p, int stage)
+{
+    uint64_t val[PMU_EVENTS];
+    double t;
+    int e;
+
+    if (p->group >= 0 && read_group(p, val)) {
+        for (e = 0; e < PMU_EVENTS; e++) {
+            p->st.count[p->stage][e] += val[e] - p->last[e];
+            p->last[e] = val[e];
+        }
+    }
+    t = now();
+    p->st.sec[p->stage] += t - p->t;
+    p->t = t;
+    p->stage = stage;
+}
+
+extern void
+pmu_close(PMU *p, PMU_STATS *st)
+{
+    int i, e;
+
+    if (p == NULL) {
+        return;
+    }
+    pmu_mark(p, p->stage);
+    close_counters(p);
+    st->threads++;
+    for (e = 0; e < PMU_EVENTS; e++) {
+        st->have[e] += (p->fd[e] >= 0);
+    }
+    for (i = 0; i < PMU_STAGES; i++) {
+        st->sec[i] += p->st.sec[i];
+        for (e = 0; e < PMU_EVENTS; e++) {
+            st->count[i][e] += p->st.count[i][e];
+        }
+    }
+    free(p);
+}
+
+/* 1 if every thread had counter e */
+static int
+have(const PMU_STATS *st, int e)
+{
+    return st->threads > 0 && st->have[e] == st->threads;
+}
+
+extern void
+pmu_print(FILE *f, const PMU_STATS *st)
+{
+    int i;
+
+    fprintf(f, "stage   \tseconds\t      cycles\tinstructions\t IPC\t LLC misses\tMB/s\n");
+    for (i = 0; i < PMU_STAGES; i++) {
+        const uint64_t *c = st->count[i];
+
+        fprintf(f, "%-8s\t%7.3f", stage_names[i], st->sec[i]);
+        if (have(st, PMU_CYCLES)) {
+            fprintf(f, "\t%12llu", (unsigned long long) c[PMU_CYCLES]);
+        } else {
+            fprintf(f, "\t%12s", "-");
+        }
+        if (have(st, PMU_INSTR)) {
+            fprintf(f, "\t%12llu", (unsigned long long) c[PMU_INSTR]);
+        } else {
+            fprintf(f, "\t%12s", "-");
+        }
+        if (have(st, PMU_CYCLES) && have(st, PMU_INSTR) && c[PMU_CYCLES] > 0) {
+            fprintf(f, "\t%4.2f", (double) c[PMU_INSTR] / (double) c[PMU_CYCLES]);
+        } else {
+            fprintf(f, "\t%4s", "-");
+        }
+        if (have(st, PMU_MISSES)) {
+            fprintf(f, "\t%11llu", (unsigned long long) c[PMU_MISSES]);
+            if (st->sec[i] > 0.0) {
+                fprintf(f, "\t%.0f", (double) c[PMU_MISSES] * PMU_LINE / st->sec[i] / 1e6);
+            } else {
+                fprintf(f, "\t-");
+            }
+        } else {
+            fprintf(f, "\t%11s\t-", "-");
+        }
+        fprintf(f, "\n");
+    }
+    if (!have(st, PMU_CYCLES) && !have(st, PMU_INSTR) && !have(st, PMU_MISSES)) {
+        fprintf(f, "hardware counters not available (see /proc/sys/kernel/perf_event_paranoid), times only\n");
+    }
+}
+
+extern void
+pmu_print_json(FILE *f, const PMU_STATS *st)
+{
+    static const char *names[PMU_EVENTS] = { "cycles", "instructions", "llc_misses" };
+    int i, e;
+
+    fprintf(f, ",\"pmu\":{");
+    for (i = 0; i < PMU_STAGES; i++) {
+        fprintf(f, "%s\"%s\":{\"seconds\":%f", i ? "," : "", stage_names[i], st->sec[i]);
+        for (e = 0; e < PMU_EVENTS; e++) {
+            if (have(st, e)) {
+                fprintf(f, ",\"%s\":%llu", names[e], (unsigned long long) st->count[i][e]);
+            } else {
+                fprintf(f, ",\"%s\":null", names[e]);
+            }
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "}");
+}
@@ -0,0 +1,66 @@
+/*****************************************************************************/
+/*
+ * Hardware performance counters for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _PMU_H_
+#define _PMU_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* stages 1 to 6 are the XPSNR_STAGE_ of xpsnr.h */
+#define PMU_READ     0
+#define PMU_COPY     1
+#define PMU_SSE      2
+#define PMU_SPATIAL  3
+#define PMU_TEMPORAL 4
+#define PMU_CHROMA   5
+#define PMU_FINAL    6
+#define PMU_STAGES   7
+
+#define PMU_CYCLES 0
+#define PMU_INSTR  1
+#define PMU_MISSES 2 /* last level cache misses */
+#define PMU_EVENTS 3
+
+/* bytes moved from memory per last level cache miss */
+#define PMU_LINE 64
+
+typedef struct PMU_STATS {
+    int threads; /* pmu_close() calls added up */
+    int have[PMU_EVENTS]; /* threads that had the counter */
+    double sec[PMU_STAGES];
+    uint64_t count[PMU_STAGES][PMU_EVENTS];
+} PMU_STATS;
+
+typedef struct PMU PMU;
+
+/* count the user space work of the calling thread from now on, starting in
+ * PMU_READ. counters the kernel does not allow (perf_event_paranoid, no PMU
+ * in a VM, not Linux) are left out, the time per stage is always measured.
+ * NULL if out of memory */
+extern PMU *pmu_open(void);
+/* charge everything since the previous call to the current stage and go on
+ * in the given one */
+extern void pmu_mark(PMU *p, int stage);
+/* add the counts to st and stop counting */
+extern void pmu_close(PMU *p, PMU_STATS *st);
+/* per-stage table */
+extern void pmu_print(FILE *f, const PMU_STATS *st);
+/* "pmu" member of a JSON record, with a leading comma */
+extern void pmu_print_json(FILE *f, const PMU_STATS *st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
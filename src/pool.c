@@ -0,0 +1,280 @@
+/*****************************************************************************/
+/*
+ * Work-stealing thread pool for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+typedef struct {
+    POOL_FN fn;
+    void *arg;
+} TASK;
+
+/* owner pushes and pops at the tail, thieves take from the head */
+typedef struct {
+    pthread_mutex_t lock;
+    TASK *buf;
+    int cap;
+    int head;
+    int count;
+} DEQUE;
+
+typedef struct {
+    POOL *pool;
+    int id;
+} WORKER;
+
+struct POOL {
+    int nthreads;
+    int nq;
+    pthread_t *threads;
+    WORKER *workers;
+    DEQUE *q;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int queued;  /* tasks sitting in deques */
+    int pending; /* tasks queued or running */
+    int idle;
+    int quit;
+    unsigned rr;
+};
+
+/* returns 0 if a full deque can't grow, the queued tasks are kept */
+static int
+deque_push(DEQUE *d, POOL_FN fn, void *arg)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->cap) {
+        int i, ncap = d->cap ? d->cap * 2 : 16;
+        TASK *nbuf = malloc(ncap * sizeof(TASK));
+
+        if (nbuf == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            return 0;
+        }
+        for (i = 0; i < d->count; i++) {
+            nbuf[i] = d->buf[(d->head + i) % d->cap];
+        }
+        free(d->buf);
+        d->buf = nbuf;
+        d->cap = ncap;
+        d->head = 0;
+    }
+    d->buf[(d->head + d->count) % d->cap].fn = fn;
+    d->buf[(d->head + d->count) % d->cap].arg = arg;
+    d->count++;
+    pthread_mutex_unlock(&d->lock);
+    return 1;
+}
+
+static int
+deque_take(DEQUE *d, int steal, TASK *t)
+{
+    int ok = 0;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        if (steal) {
+            *t = d->buf[d->head];
+            d->head = (d->head + 1) % d->cap;
+        } else {
+            *t = d->buf[(d->head + d->count - 1) % d->cap];
+        }
+        d->count--;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int
+find_task(POOL *p, int id, TASK *t)
+{
+    int i;
+
+    if (deque_take(&p->q[id], 0, t)) {
+        return 1;
+    }
+    for (i = 1; i < p->nthreads; i++) {
+        if (deque_take(&p->q[(id + i) % p->nthreads], 1, t)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *
+worker_main(void *arg)
+{
+    WORKER *w = arg;
+    POOL *p = w->pool;
+    TASK t;
+
+    while (1) {
+        if (find_task(p, w->id, &t)) {
+            pthread_mutex_lock(&p->lock);
+            p->queued--;
+            pthread_mutex_unlock(&p->lock);
+
+            t.fn(t.arg, w->id);
+
+            pthread_mutex_lock(&p->lock);
+            if (--p->pending == 0) {
+                pthread_cond_broadcast(&p->done);
+            }
+            pthread_mutex_unlock(&p->lock);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        while (p->queued <= 0 && !p->quit) {
+            p->idle++;
+            pthread_cond_wait(&p->work, &p->lock);
+            p->idle--;
+        }
+        if (p->quit) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+extern POOL *
+pool_create(int nthreads)
+{
+    POOL *p;
+    int i;
+
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    p = calloc(1, sizeof(POOL));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->nthreads = nthreads;
+    p->nq = nthreads;
+    p->threads = calloc(nthreads, sizeof(pthread_t));
+    p->workers = calloc(nthreads, sizeof(WORKER));
+    p->q = calloc(nthreads, sizeof(DEQUE));
+    if (p->threads == NULL || p->workers == NULL || p->q == NULL) {
+        free(p->q);
+        free(p->workers);
+        free(p->threads);
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->done, NULL);
+    for (i = 0; i < nthreads; i++) {
+        pthread_mutex_init(&p->q[i].lock, NULL);
+    }
+    for (i = 0; i < nthreads; i++) {
+        p->workers[i].pool = p;
+        p->workers[i].id = i;
+        if (pthread_create(&p->threads[i], NULL, worker_main, &p->workers[i]) != 0) {
+            p->nthreads = i;
+            break;
+        }
+    }
+    if (p->nthreads == 0) {
+        pool_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+extern void
+pool_destroy(POOL *p)
+{
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < p->nthreads; i++) {
+        pthread_join(p->threads[i], NULL);
+    }
+    /* deques were created for every requested thread */
+    for (i = 0; i < p->nq; i++) {
+        pthread_mutex_destroy(&p->q[i].lock);
+        free(p->q[i].buf);
+    }
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->work);
+    pthread_mutex_destroy(&p->lock);
+    free(p->q);
+    free(p->workers);
+    free(p->threads);
+    free(p);
+}
+
+extern int
+pool_submit(POOL *p, int worker, POOL_FN fn, void *arg)
+{
+    if (worker < 0 || worker >= p->nthreads) {
+        pthread_mutex_lock(&p->lock);
+        worker = p->rr++ % p->nthreads;
+        pthread_mutex_unlock(&p->lock);
+    }
+    pthread_mutex_lock(&p->lock);
+    p->pending++;
+    pthread_mutex_unlock(&p->lock);
+
+    if (!deque_push(&p->q[worker], fn, arg)) {
+        pthread_mutex_lock(&p->lock);
+        if (--p->pending == 0) {
+            pthread_cond_broadcast(&p->done);
+        }
+        pthread_mutex_unlock(&p->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->queued++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+    return 1;
+}
+
+extern void
+pool_wait(POOL *p)
+{
+    pthread_mutex_lock(&p->lock);
+    while (p->pending > 0) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+extern int
+pool_hungry(POOL *p)
+{
+    int r;
+
+    pthread_mutex_lock(&p->lock);
+    r = p->idle > p->queued;
+    pthread_mutex_unlock(&p->lock);
+    return r;
+}
+
+extern int
+pool_threads(POOL *p)
+{
+    return p->nthreads;
+}
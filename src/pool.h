@@ -0,0 +1,39 @@
+/*****************************************************************************/
+/*
+ * Work-stealing thread pool for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* task callback, worker is the index of the thread running it */
+typedef void (*POOL_FN)(void *arg, int worker);
+
+typedef struct POOL POOL;
+
+extern POOL *pool_create(int nthreads);
+extern void pool_destroy(POOL *p);
+
+/* queue a task. worker < 0 when called from outside of the pool, otherwise
+ * the task goes onto the calling worker's own deque where idle workers
+ * can steal it. returns 0 if it could not be queued (out of memory) */
+extern int pool_submit(POOL *p, int worker, POOL_FN fn, void *arg);
+/* block until every submitted task has finished */
+extern void pool_wait(POOL *p);
+/* nonzero if some worker is idle with nothing left to steal */
+extern int pool_hungry(POOL *p);
+extern int pool_threads(POOL *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+/*****************************************************************************/
+/*
+ * Frame scaler for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#include "scale.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* filter taps of one direction, taps per output sample with the input
+ * indices already clamped to the plane */
+typedef struct AXIS {
+    int taps;
+    int *idx;
+    float *coef;
+} AXIS;
+
+typedef struct SPLANE {
+    int sw, sh, dw, dh;
+    int step; /* interleaved components, 2 for NV12 chroma */
+    size_t soff, doff;
+    AXIS x, y;
+} SPLANE;
+
+struct SCALER {
+    int nplanes;
+    int nscale; /* planes scaled by scaler_run(), 1 = luma only */
+    SPLANE p[3];
+    float *tmp; /* horizontally scaled rows of the largest plane */
+    float *acc;
+    uint8_t *out;
+};
+
+static double
+kernel(int kind, double x)
+{
+    x = fabs(x);
+    if (kind == SCALE_LANCZOS) {
+        if (x < 1e-8) {
+            return 1.0;
+        }
+        if (x >= 3.0) {
+            return 0.0;
+        }
+        return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+    }
+    /* Catmull-Rom, a = -0.5 */
+    if (x < 1.0) {
+        return (1.5 * x - 2.5) * x * x + 1.0;
+    }
+    if (x < 2.0) {
+        return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    }
+    return 0.0;
+}
+
+static int
+axis_init(AXIS *a, int kind, int in, int out)
+{
+    const double ratio = (double) in / out;
+    const double fscale = ratio > 1.0 ? ratio : 1.0; /* widen when shrinking */
+    const double support = (kind == SCALE_LANCZOS ? 3.0 : 2.0) * fscale;
+    int i, k;
+
+    a->taps = 2 * (int) ceil(support);
+    a->idx = malloc((size_t) out * a->taps * sizeof(int));
+    a->coef = malloc((size_t) out * a->taps * sizeof(float));
+    if (a->idx == NULL || a->coef == NULL) {
+        return 0;
+    }
+    for (i = 0; i < out; i++) {
+        const double center = (i + 0.5) * ratio - 0.5;
+        const int first = (int) floor(center - support) + 1;
+        double w[64], sum = 0.0;
+
+        for (k = 0; k < a->taps; k++) {
+            w[k] = kernel(kind, (first + k - center) / fscale);
+            sum += w[k];
+        }
+        for (k = 0; k < a->taps; k++) {
+            int pos = first + k;
+
+            a->idx[i * a->taps + k] = pos < 0 ? 0 : (pos >= in ? in - 1 : pos);
+            a->coef[i * a->taps + k] = (float) (w[k] / sum);
+        }
+    }
+    return 1;
+}
+
+extern SCALER *
+scaler_create(int kind, int format, int planes, int sw, int sh, int dw, int dh)
+{
+    const int hs = DSV_FORMAT_H_SHIFT(format);
+    const int vs = DSV_FORMAT_V_SHIFT(format);
+    SCALER *s;
+    size_t soff = 0, doff = 0, tmpsz = 0;
+    int i;
+
+    /* w[] in axis_init() holds up to 64 taps, a shrink factor of 10 */
+    if (sw > 10 * dw || sh > 10 * dh) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(SCALER));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->nplanes = (format & DSV_FMT_SEMIPLANAR) ? 2 : 3;
+    s->nscale = (planes == 1) ? 1 : s->nplanes;
+    for (i = 0; i < s->nplanes; i++) {
+        SPLANE *p = &s->p[i];
+
+        p->sw = i ? DSV_ROUND_SHIFT(sw, hs) : sw;
+        p->sh = i ? DSV_ROUND_SHIFT(sh, vs) : sh;
+        p->dw = i ? DSV_ROUND_SHIFT(dw, hs) : dw;
+        p->dh = i ? DSV_ROUND_SHIFT(dh, vs) : dh;
+        p->step = (i && s->nplanes == 2) ? 2 : 1;
+        p->soff = soff;
+        p->doff = doff;
+        soff += (size_t) p->sw * p->sh * p->step;
+        doff += (size_t) p->dw * p->dh * p->step;
+        if ((size_t) p->dw * p->sh * p->step > tmpsz) {
+            tmpsz = (size_t) p->dw * p->sh * p->step;
+        }
+        if (!axis_init(&p->x, kind, p->sw, p->dw) || !axis_init(&p->y, kind, p->sh, p->dh)) {
+            scaler_destroy(s);
+            return NULL;
+        }
+    }
+    s->tmp = malloc(tmpsz * sizeof(float));
+    s->acc = malloc((size_t) dw * 2 * sizeof(float));
+    s->out = calloc(doff, 1);
+    if (s->tmp == NULL || s->acc == NULL || s->out == NULL) {
+        scaler_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+static void
+scale_plane(SCALER *s, SPLANE *p, const uint8_t *src, uint8_t *dst)
+{
+    const int rw = p->dw * p->step; /* samples per scaled row */
+    int x, y, k, c;
+
+    /* horizontal pass over every input row */
+    for (y = 0; y < p->sh; y++) {
+        const uint8_t *in = src + (size_t) y * p->sw * p->step;
+        float *t = s->tmp + (size_t) y * rw;
+
+        for (x = 0; x < p->dw; x++) {
+            const int *idx = p->x.idx + x * p->x.taps;
+            const float *cf = p->x.coef + x * p->x.taps;
+
+            for (c = 0; c < p->step; c++) {
+                float sum = 0.0f;
+
+                for (k = 0; k < p->x.taps; k++) {
+                    sum += cf[k] * in[idx[k] * p->step + c];
+                }
+                t[x * p->step + c] = sum;
+            }
+        }
+    }
+    /* vertical pass, whole rows at a time */
+    for (y = 0; y < p->dh; y++) {
+        const int *idx = p->y.idx + y * p->y.taps;
+        const float *cf = p->y.coef + y * p->y.taps;
+        uint8_t *out = dst + (size_t) y * rw;
+
+        for (x = 0; x < rw; x++) {
+            s->acc[x] = 0.0f;
+        }
+        for (k = 0; k < p->y.taps; k++) {
+            const float *t = s->tmp + (size_t) idx[k] * rw;
+            const float w = cf[k];
+
+            for (x = 0; x < rw; x++) {
+                s->acc[x] += w * t[x];
+            }
+        }
+        for (x = 0; x < rw; x++) {
+            const float v = s->acc[x] + 0.5f;
+
+            out[x] = v <= 0.0f ? 0 : (v >= 255.0f ? 255 : (uint8_t) v);
+        }
+    }
+}
+
+extern uint8_t *
+scaler_run(SCALER *s, const uint8_t *src)
+{
+    int i;
+
+    for (i = 0; i < s->nscale; i++) {
+        scale_plane(s, &s->p[i], src + s->p[i].soff, s->out + s->p[i].doff);
+    }
+    return s->out;
+}
+
+extern void
+scaler_destroy(SCALER *s)
+{
+    int i;
+
+    if (s == NULL) {
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        free(s->p[i].x.idx);
+        free(s->p[i].x.coef);
+        free(s->p[i].y.idx);
+        free(s->p[i].y.coef);
+    }
+    free(s->tmp);
+    free(s->acc);
+    free(s->out);
+    free(s);
+}
@@ -0,0 +1,39 @@
+/*****************************************************************************/
+/*
+ * Frame scaler for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _SCALE_H_
+#define _SCALE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define SCALE_NONE    0
+#define SCALE_BICUBIC 1
+#define SCALE_LANCZOS 2 /* 3 lobes */
+
+typedef struct SCALER SCALER;
+
+/* separable resampling of 8-bit frames in one of the DSV_SUBSAMP_ formats
+ * from sw x sh to dw x dh. every plane is scaled on its own with centers
+ * aligned, planes = 1 only scales the luma. a scaler keeps scratch space,
+ * use one per thread. NULL on failure */
+extern SCALER *scaler_create(int kind, int format, int planes, int sw, int sh, int dw, int dh);
+/* scale one frame, returns the scaled frame, which stays valid until the
+ * next call */
+extern uint8_t *scaler_run(SCALER *s, const uint8_t *src);
+extern void scaler_destroy(SCALER *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
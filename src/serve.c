@@ -0,0 +1,331 @@
+/*****************************************************************************/
+/*
+ * Unix domain socket scoring daemon for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _XOPEN_SOURCE 700
+#include "serve.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define REQ_MAX 65536
+
+typedef struct CONN {
+    int fd;
+    FILE *out;
+    char *buf;
+    size_t len;
+    int nreq;
+    int refs; /* requests still being scored */
+    int closed;
+    struct CONN *next;
+} CONN;
+
+typedef struct {
+    JOB job;
+    CONN *conn;
+    char line[1];
+} REQ;
+
+/* guards CONN.refs, CONN.closed and writes to CONN.out */
+static pthread_mutex_t connlock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t quit = 0;
+
+static void
+on_signal(int sig)
+{
+    (void) sig;
+    quit = 1;
+}
+
+static void
+conn_free(CONN *c)
+{
+    fclose(c->out);
+    free(c->buf);
+    free(c);
+}
+
+static void
+reply_done(JOB *j, void *user)
+{
+    REQ *q = user;
+    CONN *c = q->conn;
+
+    pthread_mutex_lock(&connlock);
+    job_print(c->out, j);
+    if (--c->refs == 0 && c->closed) {
+        conn_free(c);
+    }
+    pthread_mutex_unlock(&connlock);
+    free(q);
+}
+
+static void
+handle_line(CONN *c, char *line, RUNNER *r, SERVE_PARSE parse)
+{
+    size_t n = strlen(line);
+    REQ *q;
+
+    if (n > 0 && line[n - 1] == '\r') {
+        line[--n] = '\0';
+    }
+    if (n == 0) {
+        return;
+    }
+    q = malloc(sizeof(REQ) + n);
+    if (q == NULL) {
+        pthread_mutex_lock(&connlock);
+        fprintf(c->out, "{\"job\":%d,\"status\":\"error\",\"error\":\"out of memory\"}\n", c->nreq++);
+        fflush(c->out);
+        pthread_mutex_unlock(&connlock);
+        return;
+    }
+    memset(&q->job, 0, sizeof(JOB));
+    memcpy(q->line, line, n + 1);
+    q->conn = c;
+    q->job.id = c->nreq++;
+    if (!parse(&q->job, q->line)) {
+        pthread_mutex_lock(&connlock);
+        fprintf(c->out, "{\"job\":%d,\"status\":\"error\",\"error\":\"bad request\"}\n", q->job.id);
+        fflush(c->out);
+        pthread_mutex_unlock(&connlock);
+        free(q);
+        return;
+    }
+    q->job.done = reply_done;
+    q->job.user = q;
+    pthread_mutex_lock(&connlock);
+    c->refs++;
+    pthread_mutex_unlock(&connlock);
+    runner_submit(r, &q->job);
+}
+
+/* returns 0 once the peer is done sending */
+static int
+conn_read(CONN *c, RUNNER *r, SERVE_PARSE parse)
+{
+    ssize_t n;
+    char *line, *nl;
+
+    n = read(c->fd, c->buf + c->len, REQ_MAX - c->len);
+    if (n < 0 && errno == EINTR) {
+        return 1;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    c->len += n;
+    line = c->buf;
+    while ((nl = memchr(line, '\n', c->len - (line - c->buf))) != NULL) {
+        *nl = '\0';
+        handle_line(c, line, r, parse);
+        line = nl + 1;
+    }
+    c->len -= line - c->buf;
+    memmove(c->buf, line, c->len);
+    if (c->len == REQ_MAX) {
+        fprintf(stderr, "request too long, dropping connection\n");
+        return 0;
+    }
+    return 1;
+}
+
+static int
+open_socket(const char *path, struct sockaddr_un *addr)
+{
+    int fd;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "error creating socket: %s\n", strerror(errno));
+    }
+    return fd;
+}
+
+extern int
+serve(const char *path, RUNNER *r, SERVE_PARSE parse)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    struct stat st;
+    struct pollfd *pfd = NULL;
+    CONN *conns = NULL, *c, **pc;
+    int lfd, npfd = 16, i;
+
+    pfd = malloc(npfd * sizeof(struct pollfd));
+    if (pfd == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+    lfd = open_socket(path, &addr);
+    if (lfd < 0) {
+        free(pfd);
+        return EXIT_FAILURE;
+    }
+    /* a stale socket from an earlier run, never any other kind of file */
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(lfd, 64) != 0) {
+        fprintf(stderr, "error listening on %s: %s\n", path, strerror(errno));
+        close(lfd);
+        free(pfd);
+        return EXIT_FAILURE;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN; /* clients that hang up early */
+    sigaction(SIGPIPE, &sa, NULL);
+
+    while (!quit) {
+        int n = 1;
+
+        for (c = conns; c != NULL; c = c->next) {
+            n++;
+        }
+        if (n > npfd) {
+            struct pollfd *npf = malloc(n * 2 * sizeof(struct pollfd));
+
+            if (npf != NULL) {
+                free(pfd);
+                pfd = npf;
+                npfd = n * 2;
+            } else { /* the connections that don't fit wait for memory */
+                n = npfd;
+            }
+        }
+        pfd[0].fd = lfd;
+        pfd[0].events = POLLIN;
+        for (i = 1, c = conns; i < n; c = c->next, i++) {
+            pfd[i].fd = c->fd;
+            pfd[i].events = POLLIN;
+        }
+        if (poll(pfd, n, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll: %s\n", strerror(errno));
+            break;
+        }
+        /* connections first, a new one is appended to the list */
+        for (i = 1, pc = &conns; *pc != NULL; i++) {
+            c = *pc;
+            if (i < n && (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) && !conn_read(c, r, parse)) {
+                *pc = c->next;
+                pthread_mutex_lock(&connlock);
+                c->closed = 1;
+                if (c->refs == 0) {
+                    conn_free(c);
+                }
+                pthread_mutex_unlock(&connlock);
+                continue;
+            }
+            pc = &c->next;
+        }
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept(lfd, NULL, NULL);
+
+            if (fd >= 0) {
+                c = calloc(1, sizeof(CONN));
+                if (c == NULL) {
+                    close(fd);
+                    continue;
+                }
+                c->fd = fd;
+                c->out = fdopen(fd, "w");
+                c->buf = malloc(REQ_MAX);
+                if (c->out == NULL || c->buf == NULL) {
+                    if (c->out != NULL) {
+                        fclose(c->out);
+                    } else {
+                        close(fd);
+                    }
+                    free(c->buf);
+                    free(c);
+                } else {
+                    c->next = conns;
+                    conns = c;
+                }
+            }
+        }
+    }
+
+    close(lfd);
+    unlink(path);
+    runner_wait(r);
+    while ((c = conns) != NULL) {
+        conns = c->next;
+        conn_free(c);
+    }
+    free(pfd);
+    return EXIT_SUCCESS;
+}
+
+extern int
+serve_client(const char *path, int argc, char **argv, FILE *out)
+{
+    struct sockaddr_un addr;
+    char buf[4096];
+    ssize_t n;
+    size_t total = 0;
+    int fd, i;
+    FILE *f;
+
+    fd = open_socket(path, &addr);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "error connecting to %s: %s\n", path, strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    f = fdopen(fd, "w");
+    for (i = 0; i < argc; i++) {
+        char *a = argv[i];
+        char full[PATH_MAX];
+
+        /* the daemon has its own working directory */
+        if ((strncmp(a, "-ref=", 5) == 0 || strncmp(a, "-dst=", 5) == 0)
+                && strncmp(a + 5, "shm:", 4) != 0 && realpath(a + 5, full) != NULL) {
+            fprintf(f, "%.5s%s ", a, full);
+        } else {
+            fprintf(f, "%s ", a);
+        }
+    }
+    fprintf(f, "\n");
+    fflush(f);
+    shutdown(fd, SHUT_WR);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        fwrite(buf, 1, n, out);
+        total += n;
+    }
+    fclose(f);
+    return total > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
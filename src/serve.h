@@ -0,0 +1,33 @@
+/*****************************************************************************/
+/*
+ * Unix domain socket scoring daemon for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "job.h"
+
+/* fill in a job from one request line, returns 0 on a bad request.
+ * the line stays valid until the job is done */
+typedef int (*SERVE_PARSE)(JOB *j, char *line);
+
+/* accept requests on the socket at path until SIGINT/SIGTERM.
+ * every request is a line of job options and gets a JSON record line back */
+extern int serve(const char *path, RUNNER *r, SERVE_PARSE parse);
+/* send one request made of the given job options and print the reply */
+extern int serve_client(const char *path, int argc, char **argv, FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/*****************************************************************************/
+/*
+ * Stream passthrough for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _GNU_SOURCE /* tee(), splice() */
+#include "tee.h"
+
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define TEE_CHUNK 65536
+
+struct TEE {
+    int in;
+    int out; /* -1 once the consumer went away */
+    int wfd; /* our end of the scoring pipe, -1 once the scorer closed it */
+    int ok;
+    pthread_t thread;
+};
+
+/* 0 on EPIPE, the other side is gone */
+static int
+write_all(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        buf += w;
+        n -= w;
+    }
+    return 1;
+}
+
+#if defined(__linux__)
+static int
+is_pipe(int fd)
+{
+    struct stat st;
+
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/* duplicate the pipe's contents to out with tee() and then move the same
+ * bytes to the scoring pipe with splice(). returns 0 when it can't be used
+ * (any more), the rest is left for the copying loop */
+static int
+tee_splice(TEE *t)
+{
+    for (;;) {
+        ssize_t n = tee(t->in, t->out, TEE_CHUNK, 0);
+
+        if (n == 0) {
+            return 1; /* EOF */
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        while (n > 0) {
+            ssize_t m = splice(t->in, NULL, t->wfd, NULL, n, 0);
+
+            if (m < 0 && errno == EINTR) {
+                continue;
+            }
+            if (m <= 0) {
+                /* out already has these n bytes, drop them from the input */
+                char buf[4096];
+
+                while (n > 0) {
+                    ssize_t r = read(t->in, buf, n < (ssize_t) sizeof(buf) ? (size_t) n : sizeof(buf));
+
+                    if (r < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (r <= 0) {
+                        return 1;
+                    }
+                    n -= r;
+                }
+                close(t->wfd);
+                t->wfd = -1;
+                return 0;
+            }
+            n -= m;
+        }
+    }
+}
+#endif
+
+static void *
+tee_thread(void *arg)
+{
+    TEE *t = arg;
+    char *buf;
+
+#if defined(__linux__)
+    if (is_pipe(t->in) && is_pipe(t->out) && is_pipe(t->wfd) && tee_splice(t)) {
+        goto done;
+    }
+#endif
+    buf = malloc(TEE_CHUNK);
+    if (buf == NULL) {
+        t->ok = 0;
+        goto done;
+    }
+    while (t->out >= 0 || t->wfd >= 0) {
+        ssize_t n = read(t->in, buf, TEE_CHUNK);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        if (t->out >= 0 && !write_all(t->out, buf, n)) {
+            t->ok = 0;
+            t->out = -1;
+        }
+        if (t->wfd >= 0 && !write_all(t->wfd, buf, n)) {
+            close(t->wfd);
+            t->wfd = -1;
+        }
+    }
+    free(buf);
+done:
+    if (t->wfd >= 0) {
+        close(t->wfd); /* EOF for the scorer */
+        t->wfd = -1;
+    }
+    return NULL;
+}
+
+extern TEE *
+tee_open(int in, int out, int *rfd)
+{
+    TEE *t;
+    int fds[2];
+
+    /* a reader that stops early must not kill the process */
+    signal(SIGPIPE, SIG_IGN);
+    t = calloc(1, sizeof(TEE));
+    if (t == NULL) {
+        return NULL;
+    }
+    if (pipe(fds) != 0) {
+        free(t);
+        return NULL;
+    }
+    t->in = in;
+    t->out = out;
+    t->wfd = fds[1];
+    t->ok = 1;
+    if (pthread_create(&t->thread, NULL, tee_thread, t) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        free(t);
+        return NULL;
+    }
+    *rfd = fds[0];
+    return t;
+}
+
+extern int
+tee_close(TEE *t)
+{
+    int ok;
+
+    if (t == NULL) {
+        return 1;
+    }
+    pthread_join(t->thread, NULL);
+    ok = t->ok;
+    free(t);
+    return ok;
+}
@@ -0,0 +1,32 @@
+/*****************************************************************************/
+/*
+ * Stream passthrough for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _TEE_H_
+#define _TEE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct TEE TEE;
+
+/* forward everything that arrives on fd in to fd out, unchanged, on a
+ * separate thread. the same bytes can be read from the returned pipe in
+ * *rfd. when both fds are pipes on Linux the data is passed on with
+ * tee()/splice() and never copied through user space. NULL on failure */
+extern TEE *tee_open(int in, int out, int *rfd);
+/* close *rfd first. forwards what the reader did not consume, up to the end
+ * of the input, and returns 0 if not all of it could be written */
+extern int tee_close(TEE *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
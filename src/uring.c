@@ -0,0 +1,395 @@
+/*****************************************************************************/
+/*
+ * io_uring frame reader for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _GNU_SOURCE /* O_DIRECT */
+#include "uring.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+#if defined(__linux__)
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* O_DIRECT wants the file offset, length and buffer aligned to the logical
+ * block size of the device, 4096 covers all current ones */
+#define URING_ALIGN 4096
+#define ALIGN_DOWN(x) ((x) & ~(long long) (URING_ALIGN - 1))
+#define ALIGN_UP(x) ALIGN_DOWN((x) + URING_ALIGN - 1)
+
+typedef struct {
+    uint8_t *buf;
+    struct iovec iov;
+    long long frame;
+    size_t skip; /* alignment slack in front of the frame */
+    int busy;
+    int done;
+    int res;
+} SLOT;
+
+struct URING_READER {
+    int ring;
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_sqe *sqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqe_len;
+
+    SLOT *slots;
+    int depth;
+    long long hdrlen;
+    size_t frmsz;
+    size_t readsz; /* bytes read from the start of each frame */
+    size_t hdrsz;
+    size_t extra;
+    long long next_submit;
+    long long next_read;
+    long long last;
+    int cur; /* slot handed out by the previous uring_next() */
+    int err; /* a read failed, as opposed to reaching the end */
+};
+
+static int
+sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_enter(int fd, unsigned submit, unsigned complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int
+ring_init(URING_READER *r, unsigned entries)
+{
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    r->ring = sys_setup(entries, &p);
+    if (r->ring < 0) {
+        return 0;
+    }
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) {
+            r->sq_len = r->cq_len;
+        }
+        r->cq_len = r->sq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            r->ring, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        r->sq_ptr = NULL;
+        return 0;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                r->ring, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            return 0;
+        }
+    }
+    r->sqe_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            r->ring, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        return 0;
+    }
+    r->sq_tail = (unsigned *) ((uint8_t *) r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *) ((uint8_t *) r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) ((uint8_t *) r->sq_ptr + p.sq_off.array);
+    r->cq_head = (unsigned *) ((uint8_t *) r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *) ((uint8_t *) r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *) ((uint8_t *) r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((uint8_t *) r->cq_ptr + p.cq_off.cqes);
+    return 1;
+}
+
+/* queue the read of the next frame into a free slot */
+static int
+submit(URING_READER *r, int i)
+{
+    SLOT *sl = &r->slots[i];
+    struct io_uring_sqe *sqe;
+    long long off, start;
+    unsigned tail, idx;
+
+    off = r->hdrlen + r->next_submit * (long long) r->frmsz;
+    start = ALIGN_DOWN(off);
+    sl->frame = r->next_submit++;
+    sl->skip = (size_t) (off - start);
+    sl->iov.iov_base = sl->buf;
+    sl->iov.iov_len = (size_t) (ALIGN_UP(off + (long long) r->readsz) - start);
+    sl->done = 0;
+
+    tail = *r->sq_tail;
+    idx = tail & *r->sq_mask;
+    sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = r->fd;
+    sqe->off = (uint64_t) start;
+    sqe->addr = (uint64_t) (uintptr_t) &sl->iov;
+    sqe->len = 1;
+    sqe->user_data = (uint64_t) i;
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    sl->busy = sys_enter(r->ring, 1, 0, 0) == 1;
+    return sl->busy;
+}
+
+static void
+reap(URING_READER *r, int wait)
+{
+    unsigned head, tail;
+
+    if (wait) {
+        while (sys_enter(r->ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {
+            ;
+        }
+    }
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        SLOT *sl = &r->slots[cqe->user_data];
+
+        sl->res = cqe->res;
+        sl->done = 1;
+        head++;
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+extern URING_READER *
+uring_open(const char *path, long long hdrlen, size_t frmsz, size_t readsz,
+           size_t hdrsz, size_t extra, long long first, long long last, int depth, int direct)
+{
+    URING_READER *r;
+    size_t cap;
+    int i;
+
+    if (depth <= 0 || last <= first) {
+        return NULL;
+    }
+    r = calloc(1, sizeof(URING_READER));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->ring = -1;
+    r->fd = -1;
+    r->cur = -1;
+    r->depth = depth;
+    r->hdrlen = hdrlen;
+    r->frmsz = frmsz;
+    r->readsz = readsz;
+    r->hdrsz = hdrsz;
+    r->extra = extra;
+    r->next_submit = first;
+    r->next_read = first;
+    r->last = last;
+    if (direct) {
+        r->fd = open(path, O_RDONLY | O_DIRECT);
+    }
+    if (r->fd < 0) { /* e.g. tmpfs has no O_DIRECT */
+        r->fd = open(path, O_RDONLY);
+    }
+    if (r->fd < 0 || !ring_init(r, depth)) {
+        uring_close(r);
+        return NULL;
+    }
+    r->slots = calloc(depth, sizeof(SLOT));
+    if (r->slots == NULL) {
+        uring_close(r);
+        return NULL;
+    }
+    cap = (size_t) ALIGN_UP((long long) (frmsz + extra)) + URING_ALIGN;
+    for (i = 0; i < depth; i++) {
+        void *p;
+
+        if (posix_memalign(&p, URING_ALIGN, cap) != 0) {
+            uring_close(r);
+            return NULL;
+        }
+        r->slots[i].buf = p;
+    }
+    for (i = 0; i < depth && r->next_submit < r->last; i++) {
+        if (!submit(r, i)) {
+            uring_close(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+extern uint8_t *
+uring_next(URING_READER *r)
+{
+    SLOT *sl;
+    size_t need, got;
+    int i;
+
+    if (r->cur >= 0) { /* the previous frame is done with, reuse its slot */
+        r->slots[r->cur].busy = 0;
+        if (r->next_submit < r->last && !submit(r, r->cur)) {
+            r->last = r->next_submit;
+        }
+        r->cur = -1;
+    }
+    if (r->next_read >= r->last) {
+        return NULL;
+    }
+    for (i = 0; i < r->depth; i++) {
+        if (r->slots[i].busy && r->slots[i].frame == r->next_read) {
+            break;
+        }
+    }
+    if (i == r->depth) {
+        return NULL;
+    }
+    sl = &r->slots[i];
+    reap(r, 0);
+    while (!sl->done) {
+        reap(r, 1);
+    }
+    r->cur = i;
+    r->next_read++;
+
+    need = sl->skip + r->readsz;
+    got = sl->res > 0 ? (size_t) sl->res : 0;
+    /* short reads are legal, finish them synchronously. O_DIRECT needs the
+     * offset aligned, so read again from the block the last one ended in */
+    while (got < need) {
+        const size_t at = (size_t) ALIGN_DOWN((long long) got);
+        ssize_t n = pread(r->fd, sl->buf + at, sl->iov.iov_len - at,
+                (off_t) (ALIGN_DOWN(r->hdrlen + sl->frame * (long long) r->frmsz) + (long long) at));
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            fprintf(stderr, "error reading frame %lld: %s\n", sl->frame, strerror(errno));
+            r->err = 1;
+            r->last = r->next_read - 1;
+            return NULL;
+        }
+        if (at + (size_t) n <= got) { /* nothing new, end of file */
+            r->last = r->next_read - 1;
+            return NULL;
+        }
+        got = at + (size_t) n;
+    }
+    if (r->hdrsz > 0 && memcmp(sl->buf + sl->skip, Y4M_FRAME_HDR, r->hdrsz) != 0) {
+        fprintf(stderr, "bad Y4M frame header\n");
+        r->last = r->next_read - 1;
+        return NULL;
+    }
+    /* whatever follows the frame in the file is not part of it, the stdio
+     * path leaves zeros there too */
+    memset(sl->buf + sl->skip + r->frmsz, 0, r->extra);
+    return sl->buf + sl->skip + r->hdrsz;
+}
+
+extern int
+uring_error(const URING_READER *r)
+{
+    return r->err;
+}
+
+extern void
+uring_close(URING_READER *r)
+{
+    int i;
+
+    if (r == NULL) {
+        return;
+    }
+    if (r->slots != NULL) {
+        /* the kernel may still be writing into the buffers */
+        for (i = 0; i < r->depth; i++) {
+            while (r->slots[i].busy && !r->slots[i].done && r->ring >= 0) {
+                reap(r, 1);
+            }
+            free(r->slots[i].buf);
+        }
+        free(r->slots);
+    }
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqe_len);
+    }
+    if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    if (r->sq_ptr != NULL) {
+        munmap(r->sq_ptr, r->sq_len);
+    }
+    if (r->ring >= 0) {
+        close(r->ring);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    free(r);
+}
+
+#else /* no io_uring on this platform */
+
+extern URING_READER *
+uring_open(const char *path, long long hdrlen, size_t frmsz, size_t readsz,
+           size_t hdrsz, size_t extra, long long first, long long last, int depth, int direct)
+{
+    (void) path; (void) hdrlen; (void) frmsz; (void) readsz; (void) hdrsz; (void) extra;
+    (void) first; (void) last; (void) depth; (void) direct;
+    return NULL;
+}
+
+extern uint8_t *
+uring_next(URING_READER *r)
+{
+    (void) r;
+    return NULL;
+}
+
+extern int
+uring_error(const URING_READER *r)
+{
+    (void) r;
+    return 0;
+}
+
+extern void
+uring_close(URING_READER *r)
+{
+    (void) r;
+}
+
+#endif
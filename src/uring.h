@@ -0,0 +1,43 @@
+/*****************************************************************************/
+/*
+ * io_uring frame reader for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _URING_H_
+#define _URING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct URING_READER URING_READER;
+
+/* read frames [first, last) of a file laid out as hdrlen bytes followed by
+ * frames of frmsz bytes, the last hdrsz of which precede the picture data
+ * (the Y4M frame header). the caller may read up to extra bytes past the
+ * end of a frame. only the first readsz bytes of each frame are read,
+ * frmsz reads all of it. up to depth frames are kept in flight.
+ * direct = 1 bypasses the page cache where the file system allows it.
+ * returns NULL if io_uring is not available, callers fall back to stdio */
+extern URING_READER *uring_open(const char *path, long long hdrlen, size_t frmsz,
+                                size_t readsz, size_t hdrsz, size_t extra, long long first,
+                                long long last, int depth, int direct);
+/* picture data of the next frame, valid until the next call. NULL at the
+ * end or on a read error, see uring_error() */
+extern uint8_t *uring_next(URING_READER *r);
+/* 1 if uring_next() stopped on a read error rather than at the end */
+extern int uring_error(const URING_READER *r);
+extern void uring_close(URING_READER *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
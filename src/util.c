@@ -166,8 +166,7 @@ done:
 extern int
 dsv_y4m_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp)
 {
-    size_t npix, chrsz = 0;
-#define Y4M_FRAME_HDR "FRAME\n"
+    size_t frmsz;
     size_t hdrsz;
     char line[8];
     hdrsz = sizeof(Y4M_FRAME_HDR) - 1;
@@ -182,13 +181,25 @@ dsv_y4m_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp)
         fprintf(stderr, "bad Y4M frame header [%s]\n", line);
         return -1;
     }
-    npix = w * h;
-    switch (subsamp) {
+    frmsz = dsv_frame_size(w, h, subsamp);
+    if (fread(o, 1, frmsz, in) != frmsz) {
+        return -1;
+    }
+    return 0;
+}
+
+extern size_t
+dsv_frame_size(int w, int h, int subsamp)
+{
+    size_t npix, chrsz = 0;
+
+    npix = (size_t) w * h;
+    switch (subsamp & ~DSV_FMT_SEMIPLANAR) {
         case DSV_SUBSAMP_444:
             chrsz = npix;
             break;
         case DSV_SUBSAMP_422:
-            chrsz = (w / 2) * h;
+            chrsz = (size_t) (w / 2) * h;
             break;
         case DSV_SUBSAMP_420:
         case DSV_SUBSAMP_411:
@@ -198,37 +209,51 @@ dsv_y4m_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp)
             fprintf(stderr, "unsupported format %d\n", subsamp);
             break;
     }
-    if (fread(o, 1, npix + chrsz + chrsz, in) != (npix + chrsz + chrsz)) {
+    return npix + chrsz + chrsz;
+}
+
+extern int
+dsv_yuv_read_seq(FILE *in, uint8_t *o, int width, int height, int subsamp)
+{
+    size_t frmsz;
+    
+    if (in == NULL) {
+        return -1;
+    }
+    frmsz = dsv_frame_size(width, height, subsamp);
+    if (fread(o, 1, frmsz, in) != frmsz) {
         return -1;
     }
     return 0;
 }
 
 extern int
-dsv_yuv_read_seq(FILE *in, uint8_t *o, int width, int height, int subsamp)
+dsv_luma_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp, int y4m)
 {
-    size_t npix, chrsz = 0;
-    
+    size_t npix, chrsz;
+    size_t hdrsz;
+    char line[8];
+
     if (in == NULL) {
         return -1;
     }
-    npix = width * height;
-    switch (subsamp) {
-        case DSV_SUBSAMP_444:
-            chrsz = npix;
-            break;
-        case DSV_SUBSAMP_422:
-            chrsz = (width / 2) * height;
-            break;
-        case DSV_SUBSAMP_420:
-        case DSV_SUBSAMP_411:
-            chrsz = npix / 4;
-            break;
-        default:
-            fprintf(stderr, "unsupported format %d\n", subsamp);
-            break;
+    if (y4m) {
+        hdrsz = sizeof(Y4M_FRAME_HDR) - 1;
+        if (fread(line, 1, hdrsz, in) != hdrsz) {
+            return -1;
+        }
+        if (memcmp(line, Y4M_FRAME_HDR, hdrsz) != 0) {
+            fprintf(stderr, "bad Y4M frame header [%s]\n", line);
+            return -1;
+        }
+    }
+    npix = (size_t) w * h;
+    chrsz = dsv_frame_size(w, h, subsamp) - npix;
+    if (fread(o, 1, npix, in) != npix) {
+        return -1;
     }
-    if (fread(o, 1, npix + chrsz + chrsz, in) != (npix + chrsz + chrsz)) {
+    /* pipes can't seek, read the chroma where it would have gone */
+    if (fseek(in, (long) chrsz, SEEK_CUR) != 0 && fread(o + npix, 1, chrsz, in) != chrsz) {
         return -1;
     }
     return 0;
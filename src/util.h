@@ -31,13 +31,24 @@ extern "C" {
 #define DSV_SUBSAMP_420  (DSV_FMT_DIV2_H | DSV_FMT_DIV2_V)
 #define DSV_SUBSAMP_411  (DSV_FMT_DIV4_H | DSV_FMT_FULL_V)
 
+/* Cb and Cr share one interleaved plane, as in NV12 */
+#define DSV_FMT_SEMIPLANAR 0x10
+#define DSV_SUBSAMP_NV12 (DSV_SUBSAMP_420 | DSV_FMT_SEMIPLANAR)
+
 #define DSV_FORMAT_H_SHIFT(format) (((format) >> 2) & 0x3)
 #define DSV_FORMAT_V_SHIFT(format) ((format) & 0x3)
 #define DSV_ROUND_SHIFT(x, shift) (((x) + (1 << (shift)) - 1) >> (shift))
 
+#define Y4M_FRAME_HDR "FRAME\n"
+
 extern int dsv_y4m_read_hdr(FILE *in, int *w, int *h, int *subs, int *frmrate);
 extern int dsv_y4m_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp);
 extern int dsv_yuv_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp);
+/* read only the luma of the next frame, seeking past its chroma where the
+ * stream allows it */
+extern int dsv_luma_read_seq(FILE *in, uint8_t *o, int w, int h, int subsamp, int y4m);
+/* size in bytes of one frame as read by the above, excluding Y4M headers */
+extern size_t dsv_frame_size(int w, int h, int subsamp);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,164 @@
+/*****************************************************************************/
+/*
+ * Block weight map writer for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#include "wmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#define WMAP_QUEUE 8
+
+/* records are filled in by one scoring thread at a time and written out in
+ * the same order by the writer thread */
+struct WMAP {
+    FILE *f;
+    int format;
+    size_t nblk;
+    size_t recsz;
+    uint8_t *buf; /* WMAP_QUEUE records */
+    int head;
+    int count;
+    int quit;
+    int ok;
+    pthread_mutex_t lock;
+    pthread_cond_t more;
+    pthread_cond_t room;
+    pthread_t thread;
+};
+
+static void *
+writer(void *arg)
+{
+    WMAP *m = arg;
+
+    pthread_mutex_lock(&m->lock);
+    for (;;) {
+        const uint8_t *rec;
+
+        while (m->count == 0 && !m->quit) {
+            pthread_cond_wait(&m->more, &m->lock);
+        }
+        if (m->count == 0) {
+            break;
+        }
+        rec = m->buf + m->head * m->recsz;
+        pthread_mutex_unlock(&m->lock);
+        /* the slot stays ours until count drops */
+        if (fwrite(rec, m->recsz, 1, m->f) != 1) {
+            m->ok = 0;
+        }
+        pthread_mutex_lock(&m->lock);
+        m->head = (m->head + 1) % WMAP_QUEUE;
+        m->count--;
+        pthread_cond_signal(&m->room);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+extern WMAP *
+wmap_open(const char *path, const WMAP_HDR *hdr)
+{
+    WMAP *m;
+
+    m = calloc(1, sizeof(WMAP));
+    if (m == NULL) {
+        return NULL;
+    }
+    m->format = hdr->format;
+    m->nblk = (size_t) hdr->wblk * hdr->hblk;
+    m->recsz = sizeof(int64_t) + m->nblk * (hdr->format == WMAP_U8 ? 1 : sizeof(float));
+    m->buf = malloc(WMAP_QUEUE * m->recsz);
+    m->ok = 1;
+    m->f = fopen(path, "wb");
+    if (m->buf == NULL || m->f == NULL || fwrite(hdr, sizeof(*hdr), 1, m->f) != 1) {
+        if (m->f != NULL) {
+            fclose(m->f);
+        }
+        free(m->buf);
+        free(m);
+        return NULL;
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->more, NULL);
+    pthread_cond_init(&m->room, NULL);
+    if (pthread_create(&m->thread, NULL, writer, m) != 0) {
+        pthread_mutex_destroy(&m->lock);
+        pthread_cond_destroy(&m->more);
+        pthread_cond_destroy(&m->room);
+        fclose(m->f);
+        free(m->buf);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+extern void
+wmap_frame(WMAP *m, long long frame, const double *w)
+{
+    const int64_t fr = frame;
+    uint8_t *rec;
+    size_t i;
+
+    pthread_mutex_lock(&m->lock);
+    while (m->count == WMAP_QUEUE) {
+        pthread_cond_wait(&m->room, &m->lock);
+    }
+    rec = m->buf + ((m->head + m->count) % WMAP_QUEUE) * m->recsz;
+    pthread_mutex_unlock(&m->lock);
+
+    memcpy(rec, &fr, sizeof(fr));
+    rec += sizeof(fr);
+    if (m->format == WMAP_U8) {
+        for (i = 0; i < m->nblk; i++) {
+            const double q = w[i] > 0.0 ? 128.0 + floor(16.0 * log2(w[i]) + 0.5) : 0.0;
+
+            rec[i] = q <= 0.0 ? 0 : (q >= 255.0 ? 255 : (uint8_t) q);
+        }
+    } else {
+        for (i = 0; i < m->nblk; i++) {
+            const float v = (float) w[i];
+
+            memcpy(rec + i * sizeof(v), &v, sizeof(v));
+        }
+    }
+
+    pthread_mutex_lock(&m->lock);
+    m->count++;
+    pthread_cond_signal(&m->more);
+    pthread_mutex_unlock(&m->lock);
+}
+
+extern int
+wmap_close(WMAP *m)
+{
+    int ok;
+
+    if (m == NULL) {
+        return 1;
+    }
+    pthread_mutex_lock(&m->lock);
+    m->quit = 1;
+    pthread_cond_signal(&m->more);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->thread, NULL);
+
+    ok = m->ok;
+    ok &= fclose(m->f) == 0;
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->more);
+    pthread_cond_destroy(&m->room);
+    free(m->buf);
+    free(m);
+    return ok;
+}
@@ -0,0 +1,52 @@
+/*****************************************************************************/
+/*
+ * Block weight map writer for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _WMAP_H_
+#define _WMAP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define WMAP_MAGIC "SXPSNRW1"
+#define WMAP_ENDIAN 0x01020304
+
+#define WMAP_F32 0 /* one float per block */
+#define WMAP_U8  1 /* one byte per block, weight = 2^((q - 128) / 16) */
+
+/* file header, in host byte order. followed by one record per scored
+ * frame: its int64_t frame number and wblk * hblk weights in raster order.
+ * a weight scales the luma SSE of its block, higher = less masking */
+typedef struct {
+    char magic[8];
+    uint32_t endian;
+    int32_t w, h; /* luma size of the scored pictures */
+    int32_t bsize; /* block side in luma samples, edge blocks are cut off */
+    int32_t wblk, hblk;
+    int32_t format; /* WMAP_ */
+    int32_t fps_num, fps_den;
+} WMAP_HDR;
+
+typedef struct WMAP WMAP;
+
+/* write the header to path and start the writer thread. NULL on failure */
+extern WMAP *wmap_open(const char *path, const WMAP_HDR *hdr);
+/* queue the weights of one frame for writing, only waits when the writer
+ * has fallen behind by more than a few frames */
+extern void wmap_frame(WMAP *m, long long frame, const double *w);
+/* write out what is queued and close the file, 0 if anything failed */
+extern int wmap_close(WMAP *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
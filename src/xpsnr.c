@@ -53,6 +53,7 @@ INFRINGEMENT WITH RESPECT TO THIS SOFTWARE.
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /* required macro definitions */
 
@@ -61,6 +62,8 @@ INFRINGEMENT WITH RESPECT TO THIS SOFTWARE.
 #endif
 #define OFFSET(x) offsetof(XPSNRContext, x)
 #define XPSNR_GAMMA 2
+#define MARK(s, stage) do { if ((s)->mark != NULL) (s)->mark((s)->markUser, (stage)); } while (0)
+#define BAND_MARGIN 3 /* luma rows around a block row the highpass reaches, plus one */
 
 /* XPSNR function definitions */
 static uint64_t
@@ -165,39 +168,124 @@ calcSquaredError(const FRAME_ELEM_TYPE *blkOrg,     const uint32_t strideOrg,
     return uSSE;
 }
 
-static double
-calcSquaredErrorAndWeight(XPSNRContext const *s,
-                                                const FRAME_ELEM_TYPE *picOrg,     const uint32_t strideOrg,
-                                                FRAME_ELEM_TYPE       *picOrgM1,   FRAME_ELEM_TYPE       *picOrgM2,
-                                                const FRAME_ELEM_TYPE *picRec,     const uint32_t strideRec,
-                                                const uint32_t offsetX,    const uint32_t offsetY,
-                                                const uint32_t blockWidth, const uint32_t blockHeight,
-                                                const uint32_t bitDepth,   const uint32_t intFrameRate, double *msAct)
+/* Cb and Cr SSE of an interleaved (NV12) block, split in one pass */
+static void
+sseLineUV(const FRAME_ELEM_TYPE *blkOrg, const FRAME_ELEM_TYPE *blkRec, int blockWidth, uint64_t *sse)
+{
+    uint64_t uSSE = 0, vSSE = 0;
+    int x;
+
+    for (x = 0; x < 2 * blockWidth; x += 2) {
+        const int64_t eu = (int64_t) blkOrg[x    ] - (int64_t) blkRec[x    ];
+        const int64_t ev = (int64_t) blkOrg[x + 1] - (int64_t) blkRec[x + 1];
+
+        uSSE += eu * eu;
+        vSSE += ev * ev;
+    }
+    sse[0] += uSSE;
+    sse[1] += vSSE;
+}
+
+static void
+calcSquaredErrorUV(const FRAME_ELEM_TYPE *blkOrg,     const uint32_t strideOrg,
+                   const FRAME_ELEM_TYPE *blkRec,     const uint32_t strideRec,
+                   const uint32_t blockWidth, const uint32_t blockHeight, uint64_t *sse)
+{
+    uint32_t y;
+
+    sse[0] = sse[1] = 0;
+    for (y = 0; y < blockHeight; y++) {
+        sseLineUV(blkOrg, blkRec, (int) blockWidth, sse);
+        blkOrg += strideOrg;
+        blkRec += strideRec;
+    }
+}
+
+/* 1 if rows y0..y1-1 of columns x0..x1-1 around a block are the same in both
+ * pictures. the spans are compared as laid out in memory, so reads that run
+ * off a row end into the next one are covered, clipped to the picture */
+static bool
+sameArea(const FRAME_ELEM_TYPE *a, const FRAME_ELEM_TYPE *b, const int O, const long len,
+         const int offX, const int offY, const int x0, const int y0, const int x1, const int y1)
+{
+    int y;
+
+    for (y = y0; y < y1; y++) {
+        long beg = (long) (offY + y) * O + offX + x0;
+        long end = beg + (x1 - x0);
+
+        beg = MAX(beg, 0);
+        end = (end > len ? len : end);
+        if (beg < end && memcmp(a + beg, b + beg, (end - beg) * sizeof(FRAME_ELEM_TYPE)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* 1 if a block is the same in both pictures */
+static bool
+sameBlock(const FRAME_ELEM_TYPE *a, const FRAME_ELEM_TYPE *b, const int O, const uint32_t w, const uint32_t h)
+{
+    uint32_t y;
+
+    for (y = 0; y < h; y++) {
+        if (memcmp(a + y * O, b + y * O, w * sizeof(FRAME_ELEM_TYPE)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* the part of the block at offsetX, offsetY the spatial highpass reads,
+ * 0 if the block is too tiny to have one. its weight then stays 1 and its
+ * temporal history is not updated */
+static bool
+activityArea(XPSNRContext const *s, const uint32_t offsetX, const uint32_t offsetY,
+             const uint32_t blockWidth, const uint32_t blockHeight, int *act)
+{
+    const int   bVal = (s->planeWidth[0] * s->planeHeight[0] > 2048 * 1152 ? 2 : 1); /* threshold is a bit more than HD resolution */
+
+    act[0] = (offsetX > 0 ? 0 : bVal);
+    act[1] = (offsetY > 0 ? 0 : bVal);
+    act[2] = (offsetX + blockWidth  < (uint32_t) s->planeWidth [0] ? (int) blockWidth  : (int) blockWidth  - bVal);
+    act[3] = (offsetY + blockHeight < (uint32_t) s->planeHeight[0] ? (int) blockHeight : (int) blockHeight - bVal);
+    return !(act[2] <= act[0] || act[3] <= act[1]); /* too tiny */
+}
+
+/* o points at the block at offsetX, offsetY. picOrg is the whole picture o
+ * is part of, only needed with picPrev. msAct gets the mean spatial
+ * activity of the block, it is left alone for blocks that are too tiny */
+static void
+calcSpatialActivity(XPSNRContext const *s,
+                                          const FRAME_ELEM_TYPE *o,          const uint32_t strideOrg,
+                                          const uint32_t offsetX,    const uint32_t offsetY,
+                                          const uint32_t blockWidth, const uint32_t blockHeight, double *msAct,
+                                          const FRAME_ELEM_TYPE *picOrg, const FRAME_ELEM_TYPE *picPrev, uint64_t *saCache)
 {
     const int      O = (int) strideOrg;
-    const int      R = (int) strideRec;
-    const FRAME_ELEM_TYPE *o = picOrg   + offsetY*O + offsetX;
-    FRAME_ELEM_TYPE     *oM1 = picOrgM1 + offsetY*O + offsetX;
-    FRAME_ELEM_TYPE     *oM2 = picOrgM2 + offsetY*O + offsetX;
-    const FRAME_ELEM_TYPE *r = picRec   + offsetY*R + offsetX;
     const int   bVal = (s->planeWidth[0] * s->planeHeight[0] > 2048 * 1152 ? 2 : 1); /* threshold is a bit more than HD resolution */
-    const int   xAct = (offsetX > 0 ? 0 : bVal);
-    const int   yAct = (offsetY > 0 ? 0 : bVal);
-    const int   wAct = (offsetX + blockWidth  < (uint32_t) s->planeWidth [0] ? (int) blockWidth  : (int) blockWidth  - bVal);
-    const int   hAct = (offsetY + blockHeight < (uint32_t) s->planeHeight[0] ? (int) blockHeight : (int) blockHeight - bVal);
-    
-    const double sse = (double) calcSquaredError (o, strideOrg,
-            r, strideRec,
-            blockWidth, blockHeight);
+    int act[4];
+    int xAct, yAct, wAct, hAct;
     uint64_t saAct = 0; /* spatial abs. activity */
-    uint64_t taAct = 0; /* temporal abs. activity */
     
-    if (wAct <= xAct || hAct <= yAct) /* too tiny */
+    if (!activityArea(s, offsetX, offsetY, blockWidth, blockHeight, act))
     {
-        return sse;
+        return;
     }
-    
-    if (bVal > 1) /* highpass with downsampling */
+    xAct = act[0];
+    yAct = act[1];
+    wAct = act[2];
+    hAct = act[3];
+
+    if (picPrev != NULL && (bVal > 1 ? sameArea(picOrg, picPrev, O, (long) O * s->planeHeight[0],
+                                                 offsetX, offsetY, xAct - 2, yAct - 2, wAct + 3, hAct + 3)
+                                     : sameArea(picOrg, picPrev, O, (long) O * s->planeHeight[0],
+                                                 offsetX, offsetY, xAct - 1, yAct - 1, wAct + 1, hAct + 1)))
+    {
+        saAct = *saCache; /* highpass input unchanged since the last frame */
+    }
+    else if (bVal > 1) /* highpass with downsampling */
     {
         saAct = highds(xAct, yAct, wAct, hAct, o, O);
     } else /* <=HD, highpass without downsampling */
@@ -212,10 +300,32 @@ calcSquaredErrorAndWeight(XPSNRContext const *s,
         }
     }
     
+    *saCache = saAct;
+    
     /* calculate weight (mean squared activity) */
     *msAct = (double) saAct / ((double)(wAct - xAct) * (double)(hAct - yAct));
+}
+
+/* o, oM1 and oM2 point at a block that is not too tiny and share a stride.
+ * adds the temporal activity to the spatial one in msAct, updates the
+ * history of the block and squares msAct, because SSE is squared */
+static void
+calcTemporalActivity(XPSNRContext const *s,
+                                           const FRAME_ELEM_TYPE *o,          const uint32_t strideOrg,
+                                           FRAME_ELEM_TYPE       *oM1,        FRAME_ELEM_TYPE       *oM2,
+                                           const uint32_t blockWidth, const uint32_t blockHeight,
+                                           const uint32_t bitDepth,   const uint32_t intFrameRate, double *msAct)
+{
+    const int      O = (int) strideOrg;
+    const int   bVal = (s->planeWidth[0] * s->planeHeight[0] > 2048 * 1152 ? 2 : 1); /* threshold is a bit more than HD resolution */
+    uint64_t taAct = 0; /* temporal abs. activity */
     
-    if (bVal > 1) /* highpass with downsampling */
+    if ((bVal == 1 || ((blockWidth | blockHeight) & 1) == 0) && sameBlock(o, oM1, O, blockWidth, blockHeight)
+            && (intFrameRate <= 32 || sameBlock(oM1, oM2, O, blockWidth, blockHeight)))
+    {
+        taAct = 0; /* static block, the history updates would not change anything */
+    }
+    else if (bVal > 1) /* highpass with downsampling */
     {
         if (intFrameRate <= 32) /* 1st-order diff */
         {
@@ -261,9 +371,6 @@ calcSquaredErrorAndWeight(XPSNRContext const *s,
     if (*msAct < (double)(1 << (bitDepth - 6))) *msAct = (double)(1 << (bitDepth - 6));
     
     *msAct *= *msAct; /* because SSE is squared */
-    
-    /* return nonweighted sum of squared errors */
-    return sse;
 }
 
 extern double
@@ -284,6 +391,176 @@ getAvgXPSNR(const double sqrtWSSEData, const double sumXPSNRData,
   return sumXPSNRData / (double) numFrames64; /* older log-domain averaging */
 }
 
+/* the temporal history writes of calcTemporalActivity(), in the same
+ * order, without computing anything. used for frames that are not scored.
+ * o, oM1 and oM2 point at the block at offsetX, offsetY */
+static void
+updateHistory(XPSNRContext const *s,
+              const FRAME_ELEM_TYPE *o, const uint32_t strideOrg,
+              FRAME_ELEM_TYPE *oM1, FRAME_ELEM_TYPE *oM2,
+              const uint32_t offsetX, const uint32_t offsetY,
+              const uint32_t blockWidth, const uint32_t blockHeight, const uint32_t intFrameRate)
+{
+    const int      O = (int) strideOrg;
+    const int   bVal = (s->planeWidth[0] * s->planeHeight[0] > 2048 * 1152 ? 2 : 1);
+    const int   xAct = (offsetX > 0 ? 0 : bVal);
+    const int   yAct = (offsetY > 0 ? 0 : bVal);
+    const int   wAct = (offsetX + blockWidth  < (uint32_t) s->planeWidth [0] ? (int) blockWidth  : (int) blockWidth  - bVal);
+    const int   hAct = (offsetY + blockHeight < (uint32_t) s->planeHeight[0] ? (int) blockHeight : (int) blockHeight - bVal);
+    uint32_t x, y;
+
+    if (wAct <= xAct || hAct <= yAct) /* too tiny, not touched */
+    {
+        return;
+    }
+    if (bVal > 1) /* 2x2 cells as in diff1st() and diff2nd() */
+    {
+        for (y = 0; y < blockHeight; y += 2) {
+            for (x = 0; x < blockWidth; x += 2) {
+                if (intFrameRate > 32) {
+                    oM2[y*O + x  ] = oM1[y*O + x  ];  oM2[(y+1)*O + x  ] = oM1[(y+1)*O + x  ];
+                    oM2[y*O + x+1] = oM1[y*O + x+1];  oM2[(y+1)*O + x+1] = oM1[(y+1)*O + x+1];
+                }
+                oM1[y*O + x  ] = o  [y*O + x  ];  oM1[(y+1)*O + x  ] = o  [(y+1)*O + x  ];
+                oM1[y*O + x+1] = o  [y*O + x+1];  oM1[(y+1)*O + x+1] = o  [(y+1)*O + x+1];
+            }
+        }
+    }
+    else
+    {
+        for (y = 0; y < blockHeight; y++) {
+            for (x = 0; x < blockWidth; x++) {
+                if (intFrameRate > 32) {
+                    oM2[y * O + x] = oM1[y * O + x];
+                }
+                oM1[y * O + x] = o[y * O + x];
+            }
+        }
+    }
+}
+
+/* "minimum-smoothing" of the weights of the block row at y as in the JITU
+ * paper, once the row and the rows above are done. row is the index of its
+ * first block. every block gets the smaller of its own weight and the larger
+ * of its neighbors' to the left and right, or above. in block order, the
+ * same as when it was done while the weights were calculated */
+static void
+smoothBlockRow(double *weights, const uint32_t y, uint32_t row,
+               const uint32_t W, const uint32_t H, const uint32_t B)
+{
+  const uint32_t WBlk = (W + B - 1) / B;
+  uint32_t x, idxBlk = row;
+
+  for (x = 0; x < W; x += B, idxBlk++)
+  {
+    double msActPrev;
+
+    if (x == 0) /* first column */
+    {
+      msActPrev = (idxBlk > 1 ? weights[idxBlk - 2] : 0);
+    }
+    else  /* after first column */
+    {
+      msActPrev = (x > B ? MAX (weights[idxBlk - 2], weights[idxBlk]) : weights[idxBlk]);
+    }
+    if (idxBlk > WBlk) /* after first row and first column */
+    {
+      msActPrev = MAX (msActPrev, weights[idxBlk - 1 - WBlk]); /* min (left, top) */
+    }
+    if ((idxBlk > 0) && (weights[idxBlk - 1] > msActPrev))
+    {
+      weights[idxBlk - 1] = msActPrev;
+    }
+    if ((x + B >= W) && (y + B >= H) && (idxBlk > WBlk)) /* last block in picture */
+    {
+      msActPrev = MAX (weights[idxBlk - 1], weights[idxBlk - WBlk]);
+      if (weights[idxBlk] > msActPrev)
+      {
+        weights[idxBlk] = msActPrev;
+      }
+    }
+  }
+}
+
+/* block SSE and perceptual weight of the luma blocks in the block row at y.
+ * oRow, rowM1, rowM2 and rRow point at the first sample of luma row y, picOrg
+ * is the whole original picture, only needed with picPrev. without rRow only
+ * the weights are calculated */
+static void
+lumaBlockRow(XPSNRContext *s, const uint32_t y,
+             const FRAME_ELEM_TYPE *oRow, const uint32_t sOrg,
+             FRAME_ELEM_TYPE *rowM1, FRAME_ELEM_TYPE *rowM2,
+             const FRAME_ELEM_TYPE *rRow, const uint32_t sRec,
+             const FRAME_ELEM_TYPE *picOrg, const FRAME_ELEM_TYPE *picPrev)
+{
+  const uint32_t      W = s->planeWidth [0];
+  const uint32_t      H = s->planeHeight[0];
+  const uint32_t      B = xpsnr_block_size (W, H);
+  const uint32_t   WBlk = (W + B - 1) / B;
+  const bool blockWeightSmoothing = (W * H <= 640u * 480u); /* JITU paper */
+  const uint32_t blockHeight = (y + B > H ? H - y : B);
+  double* const sseLuma = s->sseLuma;
+  double* const weights = s->weights;
+  uint32_t x, idxBlk = (y / B) * WBlk;
+
+  /* each stage in a pass over the row, so profiling marks it once. only the
+   * temporal pass writes, to the history, which the others don't read */
+  MARK(s, XPSNR_STAGE_SSE);
+  for (x = 0; x < W; x += B, idxBlk++)
+  {
+    const uint32_t blockWidth = (x + B > W ? W - x : B);
+
+    sseLuma[idxBlk] = (rRow == NULL ? 0.0 : (double) calcSquaredError(oRow + x, sOrg,
+                                                                      rRow + x, sRec,
+                                                                      blockWidth, blockHeight));
+  }
+  idxBlk -= WBlk;
+  if (s->inWeights != NULL) /* recorded weights, only the SSE is needed */
+  {
+    memcpy (weights + idxBlk, s->inWeights + idxBlk, WBlk * sizeof (double));
+    return;
+  }
+
+  MARK(s, XPSNR_STAGE_SPATIAL);
+  for (x = 0; x < W; x += B, idxBlk++)
+  {
+    const uint32_t blockWidth = (x + B > W ? W - x : B);
+
+    weights[idxBlk] = 1.0;
+    calcSpatialActivity(s, oRow + x, sOrg, x, y, blockWidth, blockHeight,
+                        &weights[idxBlk], picOrg, picPrev, &s->saAct[idxBlk]);
+  }
+  idxBlk -= WBlk;
+
+  MARK(s, XPSNR_STAGE_TEMPORAL);
+  for (x = 0; x < W; x += B, idxBlk++)
+  {
+    const uint32_t blockWidth = (x + B > W ? W - x : B);
+    int act[4];
+
+    if (activityArea(s, x, y, blockWidth, blockHeight, act))
+    {
+      calcTemporalActivity(s, oRow + x, sOrg, rowM1 + x, rowM2 + x, blockWidth, blockHeight,
+                           s->depth, s->frameRate, &weights[idxBlk]);
+    }
+  }
+
+  MARK(s, XPSNR_STAGE_FINAL);
+  idxBlk -= WBlk;
+  {
+    double* const wRow = weights + idxBlk;
+
+    for (x = 0; x < WBlk; x++) /* own pass, so it vectorizes */
+    {
+      wRow[x] = 1.0 / sqrt (wRow[x]);
+    }
+  }
+  if (blockWeightSmoothing)
+  {
+    smoothBlockRow(weights, y, idxBlk, W, H, B);
+  }
+}
+
 static int
 getWSSE(XPSNRContext *s, FRAME_ELEM_TYPE **org, FRAME_ELEM_TYPE **orgM1, FRAME_ELEM_TYPE **orgM2, FRAME_ELEM_TYPE **rec, uint64_t* const wsse64)
 {
@@ -291,12 +568,12 @@ getWSSE(XPSNRContext *s, FRAME_ELEM_TYPE **org, FRAME_ELEM_TYPE **orgM1, FRAME_E
   const uint32_t      H = s->planeHeight[0]; /* luma image height in pixels */
   const double        R = (double)(W * H) / (3840.0 * 2160.0); /* UHD ratio */
   const uint32_t      B = MAX (0, 4 * (int32_t)(32.0 * sqrt (R) + 0.5)); /* block size, integer multiple of 4 for SIMD */
-  const uint32_t   WBlk = (W + B - 1) / B; /* luma width in units of blocks */
   const double   avgAct = sqrt (16.0 * (double)(1 << (2 * s->depth - 9)) / sqrt (MAX (0.00001, R))); /* = sqrt (a_pic) */
   const int*  strideOrg = (s->bpp == 1 ? s->planeWidth : s->lineSizes);
   uint32_t x, y, idxBlk = 0; /* the "16.0" above is due to fixed-point code */
   double* const sseLuma = s->sseLuma;
   double* const weights = s->weights;
+  FRAME_ELEM_TYPE *swap;
   int c;
     
     if ((wsse64 == NULL) || (s->depth < 6) || (s->depth > 16)
@@ -307,7 +584,7 @@ getWSSE(XPSNRContext *s, FRAME_ELEM_TYPE **org, FRAME_ELEM_TYPE **orgM1, FRAME_E
         return -1;
     }
     
-    if ((weights == NULL) || (B >= 4 && sseLuma == NULL)) {
+    if ((weights == NULL) || (B >= 4 && (sseLuma == NULL || s->saAct == NULL || s->bufOrgPrev == NULL))) {
         printf("Failed to allocate temporary block memory.\n");
         
         return -1;
@@ -315,92 +592,78 @@ getWSSE(XPSNRContext *s, FRAME_ELEM_TYPE **org, FRAME_ELEM_TYPE **orgM1, FRAME_E
 
   if (B >= 4)
   {
-    const bool blockWeightSmoothing = (W * H <= 640u * 480u); /* JITU paper */
     const FRAME_ELEM_TYPE *pOrg = org[0];
     const uint32_t sOrg = strideOrg[0] / s->bpp;
     const FRAME_ELEM_TYPE *pRec = rec[0];
     const uint32_t sRec = s->planeWidth[0];
     FRAME_ELEM_TYPE     *pOrgM1 = orgM1[0]; /* pixel  */
     FRAME_ELEM_TYPE     *pOrgM2 = orgM2[0]; /* memory */
+    const uint32_t nBlk = ((W + B - 1) / B) * ((H + B - 1) / B);
     double wsseLuma = 0.0;
 
     for (y = 0; y < H; y += B) /* calculate block SSE and perceptual weight */
     {
-      const uint32_t blockHeight = (y + B > H ? H - y : B);
-
-      for (x = 0; x < W; x += B, idxBlk++)
-      {
-        const uint32_t blockWidth = (x + B > W ? W - x : B);
-        double msAct = 1.0, msActPrev = 0.0;
-
-        sseLuma[idxBlk] = calcSquaredErrorAndWeight(s, pOrg, sOrg,
-                                                    pOrgM1, pOrgM2,
-                                                    pRec, sRec,
-                                                    x, y,
-                                                    blockWidth, blockHeight,
-                                                    s->depth, s->frameRate, &msAct);
-        weights[idxBlk] = 1.0 / sqrt (msAct);
-
-        if (blockWeightSmoothing) /* inline "minimum-smoothing" as in paper */
-        {
-          if (x == 0) /* first column */
-          {
-            msActPrev = (idxBlk > 1 ? weights[idxBlk - 2] : 0);
-          }
-          else  /* after first column */
-          {
-            msActPrev = (x > B ? MAX (weights[idxBlk - 2], weights[idxBlk]) : weights[idxBlk]);
-          }
-          if (idxBlk > WBlk) /* after first row and first column */
-          {
-            msActPrev = MAX (msActPrev, weights[idxBlk - 1 - WBlk]); /* min (left, top) */
-          }
-          if ((idxBlk > 0) && (weights[idxBlk - 1] > msActPrev))
-          {
-            weights[idxBlk - 1] = msActPrev;
-          }
-          if ((x + B >= W) && (y + B >= H) && (idxBlk > WBlk)) /* last block in picture */
-          {
-            msActPrev = MAX (weights[idxBlk - 1], weights[idxBlk - WBlk]);
-            if (weights[idxBlk] > msActPrev)
-            {
-              weights[idxBlk] = msActPrev;
-            }
-          }
-        }
-      } /* for x */
-    } /* for y */
+      lumaBlockRow(s, y, pOrg + y*sOrg, sOrg,
+                   pOrgM1 + y*sOrg, pOrgM2 + y*sOrg,
+                   pRec + y*sRec, sRec,
+                   pOrg, s->saValid ? s->bufOrgPrev : NULL);
+    }
+    if (s->inWeights != NULL)
+    {
+      s->saValid = 0;
+    }
+    else if (org[0] == s->bufOrg[0]) /* keep this luma for the next frame */
+    {
+      swap = s->bufOrg[0];
+      s->bufOrg[0] = s->bufOrgPrev;
+      s->bufOrgPrev = swap;
+      s->saValid = 1;
+    }
 
-    for (y = idxBlk = 0; y < H; y += B) /* calculate sum for luma (Y) XPSNR */
+    MARK(s, XPSNR_STAGE_FINAL);
+    for (idxBlk = 0; idxBlk < nBlk; idxBlk++) /* calculate sum for luma (Y) XPSNR, in block order */
     {
-      for (x = 0; x < W; x += B, idxBlk++)
-      {
-        wsseLuma += sseLuma[idxBlk] * weights[idxBlk];
-      }
+      wsseLuma += sseLuma[idxBlk] * weights[idxBlk];
     }
     wsse64[0] = (wsseLuma <= 0.0 ? 0 : (uint64_t)(wsseLuma * avgAct + 0.5));
   } /* B >= 4 */
 
+  MARK(s, B < 4 ? XPSNR_STAGE_SSE : XPSNR_STAGE_CHROMA);
   for (c = 0; c < s->numComps; c++) /* finalize SSE data for all components */
   {
+    const bool     interleaved = (c > 0 && s->pixStep[c] == 2); /* Cb and Cr side by side */
     const FRAME_ELEM_TYPE *pOrg = org[c];
-    const uint32_t sOrg = strideOrg[c] / s->bpp;
+    const uint32_t sOrg = (interleaved ? s->lineSizes[c] : strideOrg[c]) / s->bpp;
     const FRAME_ELEM_TYPE *pRec = rec[c];
-    const uint32_t sRec = s->planeWidth[c];
+    const uint32_t sRec = (interleaved ? s->recLineSizes[c] / s->bpp : s->planeWidth[c]);
     const uint32_t WPln = s->planeWidth[c];
     const uint32_t HPln = s->planeHeight[c];
 
+    if (interleaved && c == 2) /* Cr was done together with Cb */
+    {
+      continue;
+    }
     if (B < 4) /* picture is too small for XPSNR, calculate unweighted PSNR */
     {
-      wsse64[c] = calcSquaredError (pOrg, sOrg,
-                                    pRec, sRec,
-                                    WPln, HPln);
+      if (interleaved)
+      {
+        calcSquaredErrorUV (pOrg, sOrg,
+                            pRec, sRec,
+                            WPln, HPln, &wsse64[c]);
+      }
+      else
+      {
+        wsse64[c] = calcSquaredError (pOrg, sOrg,
+                                      pRec, sRec,
+                                      WPln, HPln);
+      }
     }
     else if (c > 0) /* B >= 4, so Y XPSNR has already been calculated above */
     {
       const uint32_t Bx = (B * WPln) / W;
       const uint32_t By = (B * HPln) / H; /* up to chroma downsampling by 4 */
-      double wsseChroma = 0.0;
+      const uint32_t X = (interleaved ? 2 : 1);
+      double wsseChroma = 0.0, wsseChroma2 = 0.0;
 
       for (y = idxBlk = 0; y < HPln; y += By) /* calc. chroma (Cb/Cr) XPSNR */
       {
@@ -410,22 +673,131 @@ getWSSE(XPSNRContext *s, FRAME_ELEM_TYPE **org, FRAME_ELEM_TYPE **orgM1, FRAME_E
         {
           const uint32_t blockWidth = (x + Bx > WPln ? WPln - x : Bx);
 
-          wsseChroma += (double) calcSquaredError(pOrg + y*sOrg + x, sOrg,
-                                                  pRec + y*sRec + x, sRec,
-                                                  blockWidth, blockHeight) * weights[idxBlk];
+          if (interleaved)
+          {
+            uint64_t sseUV[2];
+
+            calcSquaredErrorUV(pOrg + y*sOrg + X*x, sOrg,
+                               pRec + y*sRec + X*x, sRec,
+                               blockWidth, blockHeight, sseUV);
+            wsseChroma  += (double) sseUV[0] * weights[idxBlk];
+            wsseChroma2 += (double) sseUV[1] * weights[idxBlk];
+          }
+          else
+          {
+            wsseChroma += (double) calcSquaredError(pOrg + y*sOrg + x, sOrg,
+                                                    pRec + y*sRec + x, sRec,
+                                                    blockWidth, blockHeight) * weights[idxBlk];
+          }
         }
       }
       wsse64[c] = (wsseChroma <= 0.0 ? 0 : (uint64_t)(wsseChroma * avgAct + 0.5));
+      if (interleaved)
+      {
+        wsse64[c + 1] = (wsseChroma2 <= 0.0 ? 0 : (uint64_t)(wsseChroma2 * avgAct + 0.5));
+      }
     }
   } /* for c */
 
   return 0;
 }
 
-extern void
-accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta)
+/* per-frame settings and the plane geometry, buffers sized for another
+ * geometry are released */
+static void
+initFrame(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_META *meta)
+{
+    int c;
+
+    /* hardcoded for myself. the depth and geometry are only written when
+     * they change, so xpsnr_add() can read them while xpsnr_weigh() sets up
+     * a later frame */
+    if (s->depth != 8) {
+        s->bpp = 1;
+        s->depth = 8;
+#if 1
+        s->maxError64 = (1 << s->depth) - 1; /* conventional limit */
+#else
+        s->maxError64 = 255 * (1 << (s->depth - 8)); /* JVET style */
+#endif
+        s->maxError64 *= s->maxError64;
+    }
+    
+    s->frameRate = meta->fps_num / meta->fps_den;
+    s->numComps = (meta->planes == 1 ? 1 : 3);
+
+    if (s->weights != NULL) { /* buffers were sized for another geometry */
+        for (c = 0; c < 3; c++) {
+            if (s->planeWidth[c] != original->planes[c].w || s->planeHeight[c] != original->planes[c].h) {
+                xpsnr_release(s);
+                break;
+            }
+        }
+    }
+    for (c = 0; c < 4; c++) {
+        const XPSNR_PLANE *p = &original->planes[c < 3 ? c : 2]; /* [3] is unused */
+
+        if (s->planeWidth[c] != p->w || s->planeHeight[c] != p->h) {
+            s->planeWidth[c] = p->w;
+            s->planeHeight[c] = p->h;
+        }
+    }
+}
+
+/* 1 if the chroma of both frames is semi-planar, it is then read in place */
+static bool
+isInterleaved(const XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon)
+{
+    bool interleaved;
+    int c;
+
+    interleaved = (s->numComps == 3);
+    for (c = 1; c < s->numComps; c++) {
+        interleaved &= (original->planes[c].step == 2 && recon->planes[c].step == 2
+                && original->planes[c].stride == original->planes[1].stride
+                && recon->planes[c].stride == recon->planes[1].stride);
+    }
+    if (interleaved) {
+        interleaved = (original->planes[2].data == original->planes[1].data + sizeof(FRAME_ELEM_TYPE)
+                && recon->planes[2].data == recon->planes[1].data + sizeof(FRAME_ELEM_TYPE));
+    }
+    return interleaved;
+}
+
+/* add the weighted SSE of one frame with the given plane sizes to the sums,
+ * the XPSNR of each plane goes to cur unless it is NULL */
+static void
+addSums(XPSNRContext *s, const uint64_t *wsse64, const int numComps,
+        const int *w, const int *h, const uint64_t maxError64, double *cur)
+{
+    int c;
+
+    for (c = 0; c < numComps; c++) {
+        const double sqrtWSSE = sqrt((double) wsse64[c]);
+        const double curXPSNR = getAvgXPSNR(sqrtWSSE, INFINITY, w[c],
+                h[c], maxError64, 1 /* single frame */);
+
+        s->sumWDist[c] += sqrtWSSE;
+        s->sumXPSNR[c] += curXPSNR;
+        s->andIsInf[c] &= isinf(curXPSNR);
+        if (cur != NULL) {
+            cur[c] = curXPSNR;
+        }
+    }
+}
+
+/* add the weighted SSE of one frame to the sums */
+static void
+addFrame(XPSNRContext *s, const uint64_t *wsse64)
+{
+    addSums(s, wsse64, s->numComps, s->planeWidth, s->planeHeight, s->maxError64, NULL);
+}
+
+static void
+accumFrame(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta, const bool score)
 {
     int c, retValue;
+    bool interleaved;
     uint32_t W, H, B, WBlk, HBlk;
     FRAME_ELEM_TYPE *pOrg[3];
     FRAME_ELEM_TYPE *pOrgM1[3];
@@ -433,27 +805,9 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
     FRAME_ELEM_TYPE *pRec[3];
 
     uint64_t wsse64[3] = { 0, 0, 0 };
-    double curXPSNR[3] = { INFINITY, INFINITY, INFINITY };
-    /* hardcoded for myself */
-    s->bpp = 1;
-    s->depth = 8;
-#if 1
-    s->maxError64 = (1 << s->depth) - 1; /* conventional limit */
-#else
-    s->maxError64 = 255 * (1 << (s->depth - 8)); /* JVET style */
-#endif
-    s->maxError64 *= s->maxError64;
-    
-    s->frameRate = meta->fps_num / meta->fps_den;
-    s->numComps = 3;
 
-    for (c = 0; c < 3; c++) {
-        s->planeWidth[c] = original->planes[c].w;
-        s->planeHeight[c] = original->planes[c].h;
-    }
-    /* unused */
-    s->planeWidth[3] = original->planes[2].w;
-    s->planeHeight[3] = original->planes[2].h;
+    MARK(s, XPSNR_STAGE_COPY);
+    initFrame(s, original, meta);
 
     W = s->planeWidth[0]; /* luma image width in pixels */
     H = s->planeHeight[0]; /* luma image height in pixels */
@@ -466,6 +820,10 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
         s->sseLuma = (double*) xpsnr_alloc(WBlk * HBlk, sizeof(double));
     if (s->weights == NULL)
         s->weights = (double*) xpsnr_alloc(WBlk * HBlk, sizeof(double));
+    if (s->saAct == NULL)
+        s->saAct = (uint64_t*) xpsnr_alloc(WBlk * HBlk, sizeof(uint64_t));
+    if (s->bufOrgPrev == NULL)
+        s->bufOrgPrev = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
     
     for (c = 0; c < s->numComps; c++) /* allocate temporal org buffer memory */
     {
@@ -488,6 +846,12 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
         }
     }
     
+    /* semi-planar chroma is read in place, Cb and Cr are split by the SSE kernel */
+    interleaved = isInterleaved(s, original, recon);
+    for (c = 0; c < 4; c++) {
+        s->pixStep[c] = (interleaved && c > 0 ? 2 : 1);
+    }
+
     if (s->bpp == 1) /* 8 bit */
     {
         int x, y;
@@ -496,7 +860,16 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
             const int M = s->lineSizes[c]; /* original stride */
             const int R = recon->planes[c].stride; /* recon/c stride */
             const int O = s->planeWidth[c]; /* XPSNR stride */
+            const int SM = MAX(1, original->planes[c].step); /* original sample step */
+            const int SR = MAX(1, recon->planes[c].step); /* recon/c sample step */
             
+            if (c > 0 && interleaved)
+            {
+                s->recLineSizes[c] = R;
+                pOrg[c] = (FRAME_ELEM_TYPE*) original->planes[c].data;
+                pRec[c] = (FRAME_ELEM_TYPE*) recon->planes[c].data;
+                continue;
+            }
             if (s->bufOrg[c] == NULL)
                 s->bufOrg[c] = xpsnr_allocz(
                         s->planeWidth[c] * s->planeHeight[c] * sizeof(FRAME_ELEM_TYPE));
@@ -507,20 +880,52 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
             pOrg[c] = (FRAME_ELEM_TYPE*) s->bufOrg[c];
             pRec[c] = (FRAME_ELEM_TYPE*) s->bufRec[c];
 
+            if (!score) /* only the original luma feeds the history */
+            {
+                for (y = 0; y < s->planeHeight[c]; y++) {
+                    for (x = 0; x < s->planeWidth[c]; x++) {
+                        pOrg[c][y * O + x] = (FRAME_ELEM_TYPE) original->planes[c].data[y * M + x * SM];
+                    }
+                }
+                break;
+            }
             for (y = 0; y < s->planeHeight[c]; y++) {
                 for (x = 0; x < s->planeWidth[c]; x++) {
-                    pOrg[c][y * O + x] = (FRAME_ELEM_TYPE) original->planes[c].data[y * M + x];
-                    pRec[c][y * O + x] = (FRAME_ELEM_TYPE) recon->planes[c].data[y * R + x];
+                    pOrg[c][y * O + x] = (FRAME_ELEM_TYPE) original->planes[c].data[y * M + x * SM];
+                    pRec[c][y * O + x] = (FRAME_ELEM_TYPE) recon->planes[c].data[y * R + x * SR];
                 }
             }
         }
     } else /* 10, 12, or 14 bit */
     {
         for (c = 0; c < s->numComps; c++) {
+            s->recLineSizes[c] = recon->planes[c].stride;
             pOrg[c] = (FRAME_ELEM_TYPE*) original->planes[c].data;
             pRec[c] = (FRAME_ELEM_TYPE*) recon->planes[c].data;
         }
     }
+    if (!score)
+    {
+        const uint32_t sOrg = (s->bpp == 1 ? s->planeWidth[0] : s->lineSizes[0] / s->bpp);
+        uint32_t x, y;
+
+        s->saValid = 0; /* the next frame is compared with this one */
+        MARK(s, XPSNR_STAGE_TEMPORAL);
+
+        for (y = 0; B >= 4 && y < H; y += B)
+        {
+            const uint32_t blockHeight = (y + B > H ? H - y : B);
+
+            for (x = 0; x < W; x += B)
+            {
+                const uint32_t blockWidth = (x + B > W ? W - x : B);
+
+                updateHistory(s, pOrg[0] + y*sOrg + x, sOrg, pOrgM1[0] + y*sOrg + x, pOrgM2[0] + y*sOrg + x,
+                              x, y, blockWidth, blockHeight, s->frameRate);
+            }
+        }
+        return;
+    }
     /* extended perceptually weighted peak signal-to-noise ratio (XPSNR) data */
 
     if ((retValue = getWSSE(s, (FRAME_ELEM_TYPE**) &pOrg, (FRAME_ELEM_TYPE**) &pOrgM1,
@@ -528,14 +933,587 @@ accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *me
         printf("error near end of xpsnr!\n");
         return; /* an error here implies something went wrong earlier! */
     }
-    
-    for (c = 0; c < s->numComps; c++) {
-        const double sqrtWSSE = sqrt((double) wsse64[c]);
-        
-        curXPSNR[c] = getAvgXPSNR(sqrtWSSE, INFINITY, s->planeWidth[c],
-                s->planeHeight[c], s->maxError64, 1 /* single frame */);
-        s->sumWDist[c] += sqrtWSSE;
-        s->sumXPSNR[c] += curXPSNR[c];
-        s->andIsInf[c] &= isinf(curXPSNR[c]);
+    MARK(s, XPSNR_STAGE_FINAL);
+    addFrame(s, wsse64);
+}
+
+extern void
+accum(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta)
+{
+    accumFrame(s, original, recon, meta, 1);
+}
+
+extern void
+xpsnr_history(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_META *meta)
+{
+    accumFrame(s, original, original, meta, 0);
+}
+
+/* copy the count rows of a plane data points at into *buf with stride w,
+ * followed by a row of zeros. NULL if the buffer could not be allocated */
+static FRAME_ELEM_TYPE *
+copyRows(uint8_t **buf, size_t *len, const XPSNR_PLANE *p, const int count)
+{
+    const int M = p->stride;
+    const int SM = MAX(1, p->step);
+    const size_t need = (size_t) (count + 1) * p->w * sizeof(FRAME_ELEM_TYPE);
+    FRAME_ELEM_TYPE *o;
+    int x, y;
+
+    if (*len < need) {
+        xpsnr_free(*buf);
+        *buf = xpsnr_allocz(need);
+        *len = (*buf == NULL ? 0 : need);
+        if (*buf == NULL)
+            return NULL;
+    }
+    o = (FRAME_ELEM_TYPE*) *buf;
+    for (y = 0; y < count; y++) {
+        for (x = 0; x < p->w; x++) {
+            o[y * p->w + x] = (FRAME_ELEM_TYPE) p->data[y * M + x * SM];
+        }
+    }
+    memset(o + (size_t) count * p->w, 0, p->w * sizeof(FRAME_ELEM_TYPE));
+    return o;
+}
+
+/* accumFrame() one block row at a time. the block SSE of all planes is kept
+ * until the last band, then summed up in the order getWSSE() does. the luma
+ * of the last frame is not kept, so there is no reuse of static blocks */
+static void
+accumBand(XPSNRContext *s, const uint32_t band, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta, const bool score)
+{
+    uint32_t W, H, B, WBlk, HBlk, x, y;
+    FRAME_ELEM_TYPE *pOrg[3] = { NULL, NULL, NULL };
+    FRAME_ELEM_TYPE *pRec[3] = { NULL, NULL, NULL };
+    uint32_t sOrg[3], sRec[3];
+    int first[3], count[3];
+    bool interleaved, failed = 0;
+    int c, nComps;
+
+    MARK(s, XPSNR_STAGE_COPY);
+    if (band == 0) {
+        initFrame(s, original, meta);
+        s->saValid = 0;
+    }
+    nComps = (score ? s->numComps : 1);
+    W = s->planeWidth[0];
+    H = s->planeHeight[0];
+    B = xpsnr_block_size(W, H);
+    if (B == 0 || band >= (H + B - 1) / B) {
+        printf("Error in XPSNR routine: invalid argument(s).\n");
+        return;
+    }
+    WBlk = (W + B - 1) / B;
+    HBlk = (H + B - 1) / B;
+
+    if (s->sseLuma == NULL)
+        s->sseLuma = (double*) xpsnr_alloc(WBlk * HBlk, sizeof(double));
+    if (s->weights == NULL)
+        s->weights = (double*) xpsnr_alloc(WBlk * HBlk, sizeof(double));
+    if (s->saAct == NULL)
+        s->saAct = (uint64_t*) xpsnr_alloc(WBlk * HBlk, sizeof(uint64_t));
+    if (s->bufOrgM1[0] == NULL)
+        s->bufOrgM1[0] = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrgM2[0] == NULL)
+        s->bufOrgM2[0] = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+
+    interleaved = (score && isInterleaved(s, original, recon));
+    for (c = 0; c < 4; c++) {
+        s->pixStep[c] = (interleaved && c > 0 ? 2 : 1);
+    }
+    for (c = 0; c < nComps; c++) /* rows of this band */
+    {
+        xpsnr_band_rows(W, H, c, s->planeHeight[c], band, &first[c], &count[c]);
+
+        if (c > 0 && s->sseChroma[c] == NULL)
+        {
+            const uint32_t Bx = (B * s->planeWidth[c]) / W;
+            const uint32_t By = (B * s->planeHeight[c]) / H;
+
+            s->sseChroma[c] = (double*) xpsnr_alloc(((s->planeWidth[c] + Bx - 1) / Bx) * ((s->planeHeight[c] + By - 1) / By), sizeof(double));
+            failed |= (s->sseChroma[c] == NULL);
+        }
+        if (c > 0 && interleaved)
+        {
+            pOrg[c] = (FRAME_ELEM_TYPE*) original->planes[c].data;
+            pRec[c] = (FRAME_ELEM_TYPE*) recon->planes[c].data;
+            sOrg[c] = original->planes[c].stride / s->bpp;
+            sRec[c] = recon->planes[c].stride / s->bpp;
+            continue;
+        }
+        pOrg[c] = copyRows(&s->bandOrg[c], &s->bandOrgLen[c], &original->planes[c], count[c]);
+        sOrg[c] = sRec[c] = s->planeWidth[c];
+        failed |= (pOrg[c] == NULL);
+        if (score)
+        {
+            pRec[c] = copyRows(&s->bandRec[c], &s->bandRecLen[c], &recon->planes[c], count[c]);
+            failed |= (pRec[c] == NULL);
+        }
+    }
+    if (failed || s->sseLuma == NULL || s->weights == NULL || s->saAct == NULL
+            || s->bufOrgM1[0] == NULL || s->bufOrgM2[0] == NULL) {
+        printf("Failed to allocate temporary block memory.\n");
+        return;
+    }
+
+    y = band * B;
+    if (!score)
+    {
+        const uint32_t blockHeight = (y + B > H ? H - y : B);
+
+        MARK(s, XPSNR_STAGE_TEMPORAL);
+        for (x = 0; x < W; x += B)
+        {
+            const uint32_t blockWidth = (x + B > W ? W - x : B);
+
+            updateHistory(s, pOrg[0] + (y - first[0])*W + x, W, s->bufOrgM1[0] + y*W + x, s->bufOrgM2[0] + y*W + x,
+                          x, y, blockWidth, blockHeight, s->frameRate);
+        }
+        return;
+    }
+    lumaBlockRow(s, y, pOrg[0] + (y - first[0])*W, W,
+                 s->bufOrgM1[0] + y*W, s->bufOrgM2[0] + y*W,
+                 pRec[0] + (y - first[0])*W, W,
+                 NULL, NULL);
+
+    MARK(s, XPSNR_STAGE_CHROMA);
+    for (c = 1; c < nComps; c++) /* chroma block SSE, weighted at the end */
+    {
+        const uint32_t WPln = s->planeWidth[c];
+        const uint32_t HPln = s->planeHeight[c];
+        const uint32_t Bx = (B * WPln) / W;
+        const uint32_t By = (B * HPln) / H;
+        const uint32_t X = (interleaved ? 2 : 1);
+        const uint32_t yEnd = (uint32_t) (first[c] + count[c]);
+
+        if (interleaved && c == 2) /* Cr was done together with Cb */
+        {
+            continue;
+        }
+        for (y = first[c]; y < yEnd; y += By)
+        {
+            const uint32_t blockHeight = (y + By > HPln ? HPln - y : By);
+            const FRAME_ELEM_TYPE *o = pOrg[c] + (y - first[c])*sOrg[c];
+            const FRAME_ELEM_TYPE *r = pRec[c] + (y - first[c])*sRec[c];
+            uint32_t idxBlk = (y / By) * ((WPln + Bx - 1) / Bx);
+
+            for (x = 0; x < WPln; x += Bx, idxBlk++)
+            {
+                const uint32_t blockWidth = (x + Bx > WPln ? WPln - x : Bx);
+
+                if (interleaved)
+                {
+                    uint64_t sseUV[2];
+
+                    calcSquaredErrorUV(o + X*x, sOrg[c],
+                                       r + X*x, sRec[c],
+                                       blockWidth, blockHeight, sseUV);
+                    s->sseChroma[1][idxBlk] = (double) sseUV[0];
+                    s->sseChroma[2][idxBlk] = (double) sseUV[1];
+                }
+                else
+                {
+                    s->sseChroma[c][idxBlk] = (double) calcSquaredError(o + x, sOrg[c],
+                                                                        r + x, sRec[c],
+                                                                        blockWidth, blockHeight);
+                }
+            }
+        }
+    }
+
+    if (band + 1 == HBlk) /* whole frame done */
+    {
+        const double avgAct = xpsnr_weight_scale(s);
+        uint64_t wsse64[3] = { 0, 0, 0 };
+
+        MARK(s, XPSNR_STAGE_FINAL);
+        for (c = 0; c < s->numComps; c++)
+        {
+            const uint32_t Bx = (B * s->planeWidth[c]) / W;
+            const uint32_t By = (B * s->planeHeight[c]) / H;
+            const uint32_t n = ((s->planeWidth[c] + Bx - 1) / Bx) * ((s->planeHeight[c] + By - 1) / By);
+            const double *sse = (c == 0 ? s->sseLuma : s->sseChroma[c]);
+            double wsse = 0.0;
+            uint32_t i;
+
+            for (i = 0; i < n; i++)
+            {
+                wsse += sse[i] * s->weights[i];
+            }
+            wsse64[c] = (wsse <= 0.0 ? 0 : (uint64_t)(wsse * avgAct + 0.5));
+        }
+        addFrame(s, wsse64);
+    }
+}
+
+extern void
+xpsnr_accum_band(XPSNRContext *s, uint32_t band, XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta)
+{
+    accumBand(s, band, original, recon, meta, 1);
+}
+
+extern void
+xpsnr_history_band(XPSNRContext *s, uint32_t band, XPSNR_FRAME *original, XPSNR_META *meta)
+{
+    accumBand(s, band, original, original, meta, 0);
+}
+
+extern uint32_t
+xpsnr_band_count(int w, int h)
+{
+    const uint32_t B = xpsnr_block_size(w, h);
+
+    if (B == 0) {
+        return 0;
+    }
+    return (h + B - 1) / B;
+}
+
+extern void
+xpsnr_band_rows(int w, int h, int c, int ph, uint32_t band, int *first, int *count)
+{
+    const int B = (int) xpsnr_block_size(w, h);
+    int y0, y1;
+
+    if (c == 0) {
+        y0 = (int) band * B - BAND_MARGIN;
+        y1 = ((int) band + 1) * B + BAND_MARGIN;
+    } else { /* the chroma block rows of getWSSE(), the rest go with the last band */
+        const int By = (B * ph) / h;
+
+        y0 = (int) band * By;
+        y1 = (band + 1 == xpsnr_band_count(w, h) ? ph : y0 + By);
+    }
+    y0 = MAX(y0, 0);
+    y0 = (y0 > ph ? ph : y0);
+    y1 = (y1 > ph ? ph : y1);
+    *first = y0;
+    *count = MAX(y1 - y0, 0);
+}
+
+/* blocks of the c-th plane of f, on the grid getWSSE() uses for it. one
+ * block covering the plane if the picture is too small for weighting */
+static uint32_t
+planeBlocks(const XPSNR_FRAME *f, const int c)
+{
+    const uint32_t W = f->planes[0].w;
+    const uint32_t H = f->planes[0].h;
+    const uint32_t B = xpsnr_block_size(W, H);
+    const uint32_t WPln = f->planes[c].w;
+    const uint32_t HPln = f->planes[c].h;
+    uint32_t Bx, By;
+
+    if (B == 0) {
+        return 1;
+    }
+    Bx = (B * WPln) / W;
+    By = (B * HPln) / H;
+    return ((WPln + Bx - 1) / Bx) * ((HPln + By - 1) / By);
+}
+
+extern int
+xpsnr_weigh(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_META *meta, double *weights)
+{
+    uint32_t W, H, B, x, y;
+    FRAME_ELEM_TYPE *swap;
+    const int M = original->planes[0].stride;
+    const int SM = MAX(1, original->planes[0].step);
+
+    MARK(s, XPSNR_STAGE_COPY);
+    initFrame(s, original, meta);
+    W = s->planeWidth[0];
+    H = s->planeHeight[0];
+    B = xpsnr_block_size(W, H);
+    if (B == 0) /* no weights, and accum() leaves the history alone */
+    {
+        return 1;
+    }
+    if (s->sseLuma == NULL)
+        s->sseLuma = (double*) xpsnr_alloc(xpsnr_block_count(W, H), sizeof(double));
+    if (s->weights == NULL)
+        s->weights = (double*) xpsnr_alloc(xpsnr_block_count(W, H), sizeof(double));
+    if (s->saAct == NULL)
+        s->saAct = (uint64_t*) xpsnr_alloc(xpsnr_block_count(W, H), sizeof(uint64_t));
+    if (s->bufOrgPrev == NULL)
+        s->bufOrgPrev = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrg[0] == NULL)
+        s->bufOrg[0] = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrgM1[0] == NULL)
+        s->bufOrgM1[0] = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrgM2[0] == NULL)
+        s->bufOrgM2[0] = xpsnr_allocz(W * H * sizeof(FRAME_ELEM_TYPE));
+    if (s->sseLuma == NULL || s->weights == NULL || s->saAct == NULL || s->bufOrgPrev == NULL
+            || s->bufOrg[0] == NULL || s->bufOrgM1[0] == NULL || s->bufOrgM2[0] == NULL) {
+        return 0;
+    }
+    for (y = 0; y < H; y++) {
+        for (x = 0; x < W; x++) {
+            s->bufOrg[0][y * W + x] = (FRAME_ELEM_TYPE) original->planes[0].data[y * M + x * SM];
+        }
+    }
+    for (y = 0; y < H; y += B)
+    {
+        lumaBlockRow(s, y, s->bufOrg[0] + y*W, W,
+                     s->bufOrgM1[0] + y*W, s->bufOrgM2[0] + y*W,
+                     NULL, W,
+                     s->bufOrg[0], s->saValid ? s->bufOrgPrev : NULL);
+    }
+    if (s->inWeights != NULL)
+    {
+        s->saValid = 0;
+    }
+    else /* keep this luma for the next frame, as getWSSE() does */
+    {
+        swap = s->bufOrg[0];
+        s->bufOrg[0] = s->bufOrgPrev;
+        s->bufOrgPrev = swap;
+        s->saValid = 1;
+    }
+    memcpy(weights, s->weights, xpsnr_block_count(W, H) * sizeof(double));
+    return 1;
+}
+
+extern uint32_t
+xpsnr_sse_count(XPSNR_FRAME *original, XPSNR_META *meta)
+{
+    const int numComps = (meta->planes == 1 ? 1 : 3);
+    uint32_t n = 0;
+    int c;
+
+    for (c = 0; c < numComps; c++) {
+        n += planeBlocks(original, c);
+    }
+    return n;
+}
+
+extern void
+xpsnr_block_sse(XPSNR_FRAME *original, XPSNR_FRAME *recon, XPSNR_META *meta, double *sse)
+{
+    const int numComps = (meta->planes == 1 ? 1 : 3);
+    const uint32_t W = original->planes[0].w;
+    const uint32_t H = original->planes[0].h;
+    const uint32_t B = xpsnr_block_size(W, H);
+    uint32_t x, y, idxBlk = 0;
+    int c;
+
+    for (c = 0; c < numComps; c++)
+    {
+        const FRAME_ELEM_TYPE *pOrg = original->planes[c].data;
+        const uint32_t sOrg = original->planes[c].stride;
+        const FRAME_ELEM_TYPE *pRec = recon->planes[c].data;
+        const uint32_t sRec = recon->planes[c].stride;
+        const uint32_t WPln = original->planes[c].w;
+        const uint32_t HPln = original->planes[c].h;
+        const uint32_t Bx = (B == 0 ? WPln : (B * WPln) / W);
+        const uint32_t By = (B == 0 ? HPln : (B * HPln) / H);
+
+        for (y = 0; y < HPln; y += By)
+        {
+            const uint32_t blockHeight = (y + By > HPln ? HPln - y : By);
+
+            for (x = 0; x < WPln; x += Bx, idxBlk++)
+            {
+                const uint32_t blockWidth = (x + Bx > WPln ? WPln - x : Bx);
+
+                sse[idxBlk] = (double) calcSquaredError(pOrg + y*sOrg + x, sOrg,
+                                                        pRec + y*sRec + x, sRec,
+                                                        blockWidth, blockHeight);
+            }
+        }
+    }
+}
+
+extern void
+xpsnr_add(XPSNRContext *s, XPSNR_FRAME *original, XPSNR_META *meta,
+          const double *sse, const double *weights, double *xpsnr)
+{
+    const int numComps = (meta->planes == 1 ? 1 : 3);
+    const uint32_t W = original->planes[0].w;
+    const uint32_t H = original->planes[0].h;
+    const double avgAct = xpsnr_weight_scale(s);
+    uint64_t wsse64[3] = { 0, 0, 0 };
+    int w[3], h[3];
+    int c;
+
+    for (c = 0; c < numComps; c++)
+    {
+        const uint32_t n = planeBlocks(original, c);
+        double wsse = 0.0;
+        uint32_t i;
+
+        w[c] = original->planes[c].w;
+        h[c] = original->planes[c].h;
+        if (xpsnr_block_size(W, H) == 0) /* unweighted, as getWSSE() */
+        {
+            wsse64[c] = (uint64_t) sse[0];
+        }
+        else
+        {
+            for (i = 0; i < n; i++)
+            {
+                wsse += sse[i] * weights[i];
+            }
+            wsse64[c] = (wsse <= 0.0 ? 0 : (uint64_t)(wsse * avgAct + 0.5));
+        }
+        sse += n;
+    }
+    addSums(s, wsse64, numComps, w, h, s->maxError64, xpsnr);
+    for (c = numComps; xpsnr != NULL && c < 3; c++) {
+        xpsnr[c] = NAN;
+    }
+}
+
+extern uint32_t
+xpsnr_block_size(int w, int h)
+{
+    const uint32_t W = w;
+    const uint32_t H = h;
+    const uint32_t B = MAX(0, 4 * (int32_t )(32.0 * sqrt((double )(W * H) / (3840.0 * 2160.0)) + 0.5));
+
+    return (B < 4 ? 0 : B);
+}
+
+extern uint32_t
+xpsnr_block_count(int w, int h)
+{
+    const uint32_t B = xpsnr_block_size(w, h);
+
+    if (B == 0) {
+        return 0;
+    }
+    return ((w + B - 1) / B) * ((h + B - 1) / B);
+}
+
+extern double
+xpsnr_weight_scale(const XPSNRContext *s)
+{
+    const double R = (double) ((uint32_t) s->planeWidth[0] * (uint32_t) s->planeHeight[0]) / (3840.0 * 2160.0);
+
+    /* avgAct of getWSSE() */
+    return sqrt(16.0 * (double) (1 << (2 * s->depth - 9)) / sqrt(MAX(0.00001, R)));
+}
+
+extern void
+xpsnr_reset(XPSNRContext *s)
+{
+    int c;
+
+    for (c = 0; c < 3; c++) {
+        s->sumWDist[c] = 0.0;
+        s->sumXPSNR[c] = 0.0;
+        s->andIsInf[c] = 0;
+        /* temporal history starts out black, as after the first allocation */
+        if (s->bufOrgM1[c] != NULL)
+            memset(s->bufOrgM1[c], 0, s->planeWidth[c] * s->planeHeight[c] * sizeof(FRAME_ELEM_TYPE));
+        if (s->bufOrgM2[c] != NULL)
+            memset(s->bufOrgM2[c], 0, s->planeWidth[c] * s->planeHeight[c] * sizeof(FRAME_ELEM_TYPE));
+    }
+    s->numFrames64 = 0;
+    s->saValid = 0;
+}
+
+extern void
+xpsnr_release(XPSNRContext *s)
+{
+    int c;
+
+    xpsnr_free(s->sseLuma);
+    xpsnr_free(s->weights);
+    xpsnr_free(s->saAct);
+    xpsnr_free(s->bufOrgPrev);
+    s->sseLuma = NULL;
+    s->weights = NULL;
+    s->saAct = NULL;
+    s->bufOrgPrev = NULL;
+    s->saValid = 0;
+    for (c = 0; c < 3; c++) {
+        xpsnr_free(s->bandOrg[c]);
+        xpsnr_free(s->bandRec[c]);
+        xpsnr_free(s->sseChroma[c]);
+        s->bandOrg[c] = NULL;
+        s->bandRec[c] = NULL;
+        s->sseChroma[c] = NULL;
+        s->bandOrgLen[c] = 0;
+        s->bandRecLen[c] = 0;
+        xpsnr_free(s->bufOrg[c]);
+        xpsnr_free(s->bufOrgM1[c]);
+        xpsnr_free(s->bufOrgM2[c]);
+        xpsnr_free(s->bufRec[c]);
+        s->bufOrg[c] = NULL;
+        s->bufOrgM1[c] = NULL;
+        s->bufOrgM2[c] = NULL;
+        s->bufRec[c] = NULL;
+    }
+}
+
+/* state layout: numFrames64, maxError64, per plane sumWDist, sumXPSNR, andIsInf and the
+ * plane size, then the luma history M1 and M2. native byte order */
+extern int
+xpsnr_save(const XPSNRContext *s, FILE *f)
+{
+    const size_t histLen = (size_t) s->planeWidth[0] * s->planeHeight[0];
+    uint32_t dims[6];
+    uint8_t hasHist;
+    int c;
+
+    for (c = 0; c < 3; c++) {
+        dims[2 * c + 0] = s->planeWidth[c];
+        dims[2 * c + 1] = s->planeHeight[c];
+    }
+    hasHist = (s->bufOrgM1[0] != NULL && s->bufOrgM2[0] != NULL);
+    if (fwrite(&s->numFrames64, sizeof(s->numFrames64), 1, f) != 1
+            || fwrite(&s->maxError64, sizeof(s->maxError64), 1, f) != 1
+            || fwrite(s->sumWDist, sizeof(s->sumWDist), 1, f) != 1
+            || fwrite(s->sumXPSNR, sizeof(s->sumXPSNR), 1, f) != 1
+            || fwrite(s->andIsInf, sizeof(s->andIsInf), 1, f) != 1
+            || fwrite(dims, sizeof(dims), 1, f) != 1
+            || fwrite(&hasHist, 1, 1, f) != 1)
+        return 0;
+    if (hasHist && histLen > 0) {
+        if (fwrite(s->bufOrgM1[0], sizeof(FRAME_ELEM_TYPE), histLen, f) != histLen
+                || fwrite(s->bufOrgM2[0], sizeof(FRAME_ELEM_TYPE), histLen, f) != histLen)
+            return 0;
+    }
+    return 1;
+}
+
+extern int
+xpsnr_load(XPSNRContext *s, FILE *f)
+{
+    size_t histLen;
+    uint32_t dims[6];
+    uint8_t hasHist;
+    int c;
+
+    if (fread(&s->numFrames64, sizeof(s->numFrames64), 1, f) != 1
+            || fread(&s->maxError64, sizeof(s->maxError64), 1, f) != 1
+            || fread(s->sumWDist, sizeof(s->sumWDist), 1, f) != 1
+            || fread(s->sumXPSNR, sizeof(s->sumXPSNR), 1, f) != 1
+            || fread(s->andIsInf, sizeof(s->andIsInf), 1, f) != 1
+            || fread(dims, sizeof(dims), 1, f) != 1
+            || fread(&hasHist, 1, 1, f) != 1)
+        return 0;
+    for (c = 0; c < 3; c++) {
+        if (s->planeWidth[c] != (int) dims[2 * c] || s->planeHeight[c] != (int) dims[2 * c + 1]) {
+            xpsnr_release(s); /* accum() allocates the rest for this geometry */
+            break;
+        }
+    }
+    for (c = 0; c < 3; c++) {
+        s->planeWidth[c] = dims[2 * c + 0];
+        s->planeHeight[c] = dims[2 * c + 1];
     }
+    s->saValid = 0;
+    histLen = (size_t) s->planeWidth[0] * s->planeHeight[0];
+    if (!hasHist || histLen == 0)
+        return 1;
+    if (s->bufOrgM1[0] == NULL)
+        s->bufOrgM1[0] = xpsnr_allocz(histLen * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrgM2[0] == NULL)
+        s->bufOrgM2[0] = xpsnr_allocz(histLen * sizeof(FRAME_ELEM_TYPE));
+    if (s->bufOrgM1[0] == NULL || s->bufOrgM2[0] == NULL)
+        return 0;
+    return fread(s->bufOrgM1[0], sizeof(FRAME_ELEM_TYPE), histLen, f) == histLen
+        && fread(s->bufOrgM2[0], sizeof(FRAME_ELEM_TYPE), histLen, f) == histLen;
 }
@@ -52,6 +52,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stdio.h>
 
 /* TODO hacks made to just get it to work. */
 
@@ -70,6 +71,14 @@ extern "C" {
 #define xpsnr_allocz(a) calloc(a,1)
 #define xpsnr_free free
 
+/* parts of accum() reported to XPSNRContext->mark, 0 is left to the caller */
+#define XPSNR_STAGE_COPY     1 /* copying the frames into the context */
+#define XPSNR_STAGE_SSE      2 /* luma block SSE */
+#define XPSNR_STAGE_SPATIAL  3 /* spatial activity highpass */
+#define XPSNR_STAGE_TEMPORAL 4 /* temporal activity and history update */
+#define XPSNR_STAGE_CHROMA   5 /* chroma block SSE */
+#define XPSNR_STAGE_FINAL    6 /* weighted sums */
+
 /* XPSNR structure definition */
 
 typedef struct XPSNRContext {
@@ -80,6 +89,8 @@ typedef struct XPSNRContext {
     uint64_t numFrames64;
     unsigned frameRate;
     int lineSizes[4];
+    int recLineSizes[4]; /* only for interleaved chroma, which isn't copied */
+    int pixStep[4]; /* 2 if Cb and Cr are interleaved (NV12), else 1 */
     int planeHeight[4];
     int planeWidth[4];
     /* XPSNR specific variables */
@@ -89,10 +100,31 @@ typedef struct XPSNRContext {
     uint8_t *bufOrgM1[3];
     uint8_t *bufOrgM2[3];
     uint8_t *bufRec[3];
+    /* luma of the last scored frame and the spatial activity of its blocks,
+     * reused for blocks whose highpass input did not change */
+    uint8_t *bufOrgPrev;
+    uint64_t *saAct;
+    bool saValid;
     uint64_t maxError64;
     double sumWDist[3];
     double sumXPSNR[3];
     bool andIsInf[3];
+    /* if set, the block weights of the next frame are copied from here
+     * instead of being derived from the original picture. weights only
+     * depend on the original, so this is exact when they were recorded
+     * from s->weights on an earlier run over the same reference */
+    const double *inWeights;
+    /* band mode, see xpsnr_accum_band(): copies of the rows of the current
+     * band and the SSE of every chroma block, summed up after the last band */
+    uint8_t *bandOrg[3];
+    uint8_t *bandRec[3];
+    size_t bandOrgLen[3];
+    size_t bandRecLen[3];
+    double *sseChroma[3];
+    /* if set, called with an XPSNR_STAGE_ whenever accum() moves on to
+     * another part of the work, for profiling */
+    void (*mark)(void *user, int stage);
+    void *markUser;
 } XPSNRContext;
 
 typedef struct {
@@ -102,6 +134,9 @@ typedef struct {
     
     int fps_num;
     int fps_den;
+    /* 1 = luma only, the chroma planes are neither read nor scored.
+     * anything else scores all three */
+    int planes;
 } XPSNR_META;
 
 typedef struct {
@@ -110,6 +145,10 @@ typedef struct {
     int format;
     int stride;
     int w, h;
+    /* elements between horizontally adjacent samples. 0 or 1 = planar,
+     * 2 = semi-planar chroma (NV12): planes[1].data points at the first Cb
+     * and planes[2].data at the first Cr sample of the same UV plane */
+    int step;
 } XPSNR_PLANE;
 
 typedef struct {
@@ -117,9 +156,62 @@ typedef struct {
 } XPSNR_FRAME;
 
 extern void accum(XPSNRContext *s, XPSNR_FRAME *orig, XPSNR_FRAME *recon, XPSNR_META *meta);
+/* advance the temporal history by an original frame that is not scored, so
+ * the next accum() sees the same history as if it had been */
+extern void xpsnr_history(XPSNRContext *s, XPSNR_FRAME *orig, XPSNR_META *meta);
 extern double getAvgXPSNR(const double sqrtWSSEData, const double sumXPSNRData,
                           const uint32_t imageWidth, const uint32_t imageHeight,
                           const uint64_t maxError64, const uint64_t numFrames64);
+/* band mode: a frame is handed over in xpsnr_band_count() bands of one block
+ * row each, with the same results as accum() on the whole frame. only the
+ * temporal history is kept for the whole luma plane. the planes of a band
+ * frame have the w, h and step of the full planes, data points at the first
+ * row given by xpsnr_band_rows() and stride is the distance between rows.
+ * bands must come in order, 0 if the picture is too small for bands */
+extern uint32_t xpsnr_band_count(int w, int h);
+/* rows of plane c (0 = luma) of height ph a band needs, including the rows
+ * around a block row the luma highpass reads. count may be 0 for chroma */
+extern void xpsnr_band_rows(int w, int h, int c, int ph, uint32_t band, int *first, int *count);
+extern void xpsnr_accum_band(XPSNRContext *s, uint32_t band, XPSNR_FRAME *orig, XPSNR_FRAME *recon, XPSNR_META *meta);
+/* xpsnr_history() for one band, only the luma of orig is used */
+extern void xpsnr_history_band(XPSNRContext *s, uint32_t band, XPSNR_FRAME *orig, XPSNR_META *meta);
+/* accum() in three steps that can run on different threads, for pipelining
+ * frames (see async.h). with the same frames the sums are bit-identical.
+ * xpsnr_weigh() computes the block weights of an original and advances the
+ * temporal history of s, so it has to be called for every frame in order.
+ * weights gets xpsnr_block_count() entries, 0 if out of memory, weights
+ * and the history are then left alone. xpsnr_block_sse() only reads
+ * the two frames and can run for any number of frames at once, sse gets
+ * xpsnr_sse_count() entries. it needs planar chroma (step 0 or 1).
+ * xpsnr_add() adds a frame to the sums of s like accum() and stores its
+ * XPSNR per plane in xpsnr[3] if not NULL, NAN for planes not scored. it
+ * only touches the sums, so it may run while xpsnr_weigh() is working on a
+ * later frame, but calls have to come in frame order for identical sums */
+extern int xpsnr_weigh(XPSNRContext *s, XPSNR_FRAME *orig, XPSNR_META *meta, double *weights);
+extern uint32_t xpsnr_sse_count(XPSNR_FRAME *orig, XPSNR_META *meta);
+extern void xpsnr_block_sse(XPSNR_FRAME *orig, XPSNR_FRAME *recon, XPSNR_META *meta, double *sse);
+extern void xpsnr_add(XPSNRContext *s, XPSNR_FRAME *orig, XPSNR_META *meta,
+                      const double *sse, const double *weights, double *xpsnr);
+/* number of entries in XPSNRContext->weights for a luma plane of w x h,
+ * 0 if the picture is too small for perceptual weighting */
+extern uint32_t xpsnr_block_count(int w, int h);
+/* side of the square blocks in luma samples, 0 if there are none */
+extern uint32_t xpsnr_block_size(int w, int h);
+/* factor from XPSNRContext->weights to the weights the luma SSE of each
+ * block is scaled by. 1.0 is a block as active as the nominal picture
+ * activity a_pic of the resolution, flat content weighs more. valid after
+ * the first accum() */
+extern double xpsnr_weight_scale(const XPSNRContext *s);
+/* clear the accumulated sums and temporal history but keep the buffers,
+ * so the context can score another sequence of the same geometry */
+extern void xpsnr_reset(XPSNRContext *s);
+/* free all buffers allocated by accum() */
+extern void xpsnr_release(XPSNRContext *s);
+/* write or restore everything accum() carries from one frame to the next
+ * (sums, frame count and temporal history), so scoring can be continued in
+ * another process with bit-identical results. return 0 on I/O errors */
+extern int xpsnr_save(const XPSNRContext *s, FILE *f);
+extern int xpsnr_load(XPSNRContext *s, FILE *f);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,480 @@
+/*****************************************************************************/
+/*
+ * zstd compressed input for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#define _GNU_SOURCE /* fopencookie() */
+#include "zst.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+extern int
+zst_name(const char *name)
+{
+    size_t n = strlen(name);
+
+    return n > 4 && strcmp(name + n - 4, ".zst") == 0;
+}
+
+#if defined(SXPSNR_ZSTD) && defined(__linux__)
+
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <zstd.h>
+
+/* larger frames are not decompressed ahead, the file is streamed instead */
+#define ZST_FRAME_MAX (64 << 20)
+/* footer and skippable frame of the seek table of the zstd seekable format */
+#define ZST_SEEK_MAGIC 0x8F92EAB1u
+#define ZST_SEEK_SKIP  0x184D2A5Eu
+#define ZST_SEEK_FOOTER 9
+
+typedef struct {
+    uint64_t coff, csize; /* in the file */
+    uint64_t doff, dsize; /* in the decompressed stream */
+} ZFRAME;
+
+typedef struct {
+    long long frame; /* held or being decompressed, -1 = none */
+    int busy;
+    int err;
+    uint8_t *buf;
+    size_t cap;
+} ZSLOT;
+
+typedef struct {
+    const uint8_t *map;
+    size_t mapsz;
+    long long pos; /* in the decompressed stream */
+
+    /* indexed files. frame k is decompressed into slot k % nslots by the
+     * decoder threads while it is within nslots frames of the reader */
+    ZFRAME *fr;
+    long long nfr;
+    long long size;
+    long long cur; /* frame holding pos */
+    ZSLOT *slot;
+    int nslots;
+    long long base;
+    int quit;
+    int nthreads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+
+    /* anything else is streamed */
+    ZSTD_DStream *ds;
+    ZSTD_inBuffer in;
+    int ended; /* the last frame was complete */
+} ZST;
+
+static uint32_t
+rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int
+add_frame(ZST *z, long long *cap, uint64_t coff, uint64_t csize, uint64_t dsize)
+{
+    if (dsize > ZST_FRAME_MAX) {
+        return 0;
+    }
+    if (z->nfr == *cap) {
+        ZFRAME *nfr;
+
+        *cap = *cap ? *cap * 2 : 256;
+        nfr = realloc(z->fr, *cap * sizeof(ZFRAME));
+        if (nfr == NULL) {
+            return 0;
+        }
+        z->fr = nfr;
+    }
+    z->fr[z->nfr].coff = coff;
+    z->fr[z->nfr].csize = csize;
+    z->fr[z->nfr].doff = z->size;
+    z->fr[z->nfr].dsize = dsize;
+    z->nfr++;
+    z->size += dsize;
+    return 1;
+}
+
+/* frames from the seek table at the end of the file, 0 if there is none */
+static int
+index_table(ZST *z)
+{
+    const uint8_t *end = z->map + z->mapsz;
+    const uint8_t *p;
+    uint64_t n, esz, tsz, coff = 0;
+    long long cap = 0, k;
+
+    if (z->mapsz < 8 + ZST_SEEK_FOOTER || rd32(end - 4) != ZST_SEEK_MAGIC || (end[-5] & 0x7c) != 0) {
+        return 0;
+    }
+    n = rd32(end - ZST_SEEK_FOOTER);
+    esz = (end[-5] & 0x80) ? 12 : 8; /* with checksums */
+    tsz = 8 + n * esz + ZST_SEEK_FOOTER;
+    if (tsz > z->mapsz) {
+        return 0;
+    }
+    p = end - tsz;
+    if (rd32(p) != ZST_SEEK_SKIP || rd32(p + 4) != tsz - 8) {
+        return 0;
+    }
+    for (k = 0, p += 8; k < (long long) n; k++, p += esz) {
+        if (!add_frame(z, &cap, coff, rd32(p), rd32(p + 4))) {
+            return 0;
+        }
+        coff += rd32(p);
+    }
+    return coff == z->mapsz - tsz;
+}
+
+/* frames found by walking the file, 0 if one of them does not record its
+ * decompressed size */
+static int
+index_walk(ZST *z)
+{
+    size_t off = 0;
+    long long cap = 0;
+
+    while (off < z->mapsz) {
+        const uint8_t *p = z->map + off;
+        const size_t left = z->mapsz - off;
+        unsigned long long dsize;
+        size_t csize;
+
+        if (left >= 8 && (rd32(p) & 0xfffffff0u) == ZSTD_MAGIC_SKIPPABLE_START) {
+            if (rd32(p + 4) > left - 8) {
+                return 0;
+            }
+            off += 8 + (size_t) rd32(p + 4);
+            continue;
+        }
+        csize = ZSTD_findFrameCompressedSize(p, left);
+        dsize = ZSTD_getFrameContentSize(p, left);
+        if (ZSTD_isError(csize) || dsize == ZSTD_CONTENTSIZE_UNKNOWN || dsize == ZSTD_CONTENTSIZE_ERROR
+                || !add_frame(z, &cap, off, csize, dsize)) {
+            return 0;
+        }
+        off += csize;
+    }
+    return 1;
+}
+
+static void *
+decoder(void *arg)
+{
+    ZST *z = arg;
+    ZSTD_DCtx *dc = ZSTD_createDCtx();
+
+    pthread_mutex_lock(&z->lock);
+    while (!z->quit) {
+        const ZFRAME *f;
+        ZSLOT *s = NULL;
+        long long k;
+        size_t r = 0;
+
+        for (k = z->base; k < z->base + z->nslots && k < z->nfr; k++) {
+            ZSLOT *t = &z->slot[k % z->nslots];
+
+            if (t->frame != k && !t->busy) {
+                s = t;
+                break;
+            }
+        }
+        if (s == NULL) {
+            pthread_cond_wait(&z->work, &z->lock);
+            continue;
+        }
+        /* the slot held a frame behind the reader, nobody reads it now */
+        f = &z->fr[k];
+        s->frame = k;
+        s->busy = 1;
+        pthread_mutex_unlock(&z->lock);
+
+        if (s->cap < f->dsize) {
+            free(s->buf);
+            s->buf = malloc(f->dsize);
+            s->cap = s->buf != NULL ? f->dsize : 0;
+        }
+        if (dc != NULL && s->buf != NULL) {
+            r = ZSTD_decompressDCtx(dc, s->buf, f->dsize, z->map + f->coff, f->csize);
+        }
+
+        pthread_mutex_lock(&z->lock);
+        s->err = dc == NULL || s->buf == NULL || ZSTD_isError(r) || r != f->dsize;
+        s->busy = 0;
+        pthread_cond_broadcast(&z->done);
+    }
+    pthread_mutex_unlock(&z->lock);
+    ZSTD_freeDCtx(dc);
+    return NULL;
+}
+
+/* decompressed frame k, waiting for the decoders. NULL on errors */
+static const uint8_t *
+frame_data(ZST *z, long long k)
+{
+    ZSLOT *s = &z->slot[k % z->nslots];
+    const uint8_t *p;
+
+    pthread_mutex_lock(&z->lock);
+    if (z->base != k) {
+        z->base = k;
+        pthread_cond_broadcast(&z->work);
+    }
+    while (s->frame != k || s->busy) {
+        pthread_cond_wait(&z->done, &z->lock);
+    }
+    p = s->err ? NULL : s->buf;
+    pthread_mutex_unlock(&z->lock);
+    return p;
+}
+
+static ssize_t
+stream_read(ZST *z, char *buf, size_t n)
+{
+    ZSTD_outBuffer out;
+
+    out.dst = buf;
+    out.size = n;
+    out.pos = 0;
+    while (out.pos < out.size) {
+        const size_t in0 = z->in.pos, out0 = out.pos;
+        const size_t r = ZSTD_decompressStream(z->ds, &out, &z->in);
+
+        if (ZSTD_isError(r)) {
+            errno = EIO;
+            return -1;
+        }
+        if (z->in.pos == in0 && out.pos == out0) {
+            if (z->in.pos < z->in.size || !z->ended) {
+                errno = EIO; /* cut off in the middle of a frame */
+                return -1;
+            }
+            break;
+        }
+        z->ended = (r == 0);
+    }
+    z->pos += out.pos;
+    return out.pos;
+}
+
+static ssize_t
+zst_read(void *cookie, char *buf, size_t n)
+{
+    ZST *z = cookie;
+    size_t got = 0;
+
+    if (z->ds != NULL) {
+        return stream_read(z, buf, n);
+    }
+    while (got < n && z->pos < z->size) {
+        const ZFRAME *f;
+        const uint8_t *data;
+        size_t k;
+
+        while ((uint64_t) z->pos >= z->fr[z->cur].doff + z->fr[z->cur].dsize) {
+            z->cur++;
+        }
+        f = &z->fr[z->cur];
+        data = frame_data(z, z->cur);
+        if (data == NULL) {
+            errno = EIO;
+            return got > 0 ? (ssize_t) got : -1;
+        }
+        k = f->doff + f->dsize - z->pos;
+        k = k < n - got ? k : n - got;
+        memcpy(buf + got, data + (z->pos - f->doff), k);
+        got += k;
+        z->pos += k;
+    }
+    return got;
+}
+
+static int
+zst_seek(void *cookie, off64_t *off, int whence)
+{
+    ZST *z = cookie;
+    long long pos = *off, lo, hi;
+
+    if (whence == SEEK_CUR) {
+        pos += z->pos;
+    } else if (whence == SEEK_END) {
+        if (z->ds != NULL) {
+            errno = ESPIPE;
+            return -1;
+        }
+        pos += z->size;
+    }
+    if (pos < 0 || (z->ds != NULL && pos != z->pos)) { /* streams only tell */
+        errno = z->ds != NULL ? ESPIPE : EINVAL;
+        return -1;
+    }
+    if (z->ds == NULL) {
+        /* last frame starting at or before pos */
+        lo = 0;
+        hi = z->nfr - 1;
+        while (lo < hi) {
+            const long long mid = (lo + hi + 1) / 2;
+
+            if ((long long) z->fr[mid].doff <= pos) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        z->cur = lo;
+    }
+    z->pos = pos;
+    *off = pos;
+    return 0;
+}
+
+static int
+zst_close(void *cookie)
+{
+    ZST *z = cookie;
+    int i;
+
+    if (z->nthreads > 0) {
+        pthread_mutex_lock(&z->lock);
+        z->quit = 1;
+        pthread_cond_broadcast(&z->work);
+        pthread_mutex_unlock(&z->lock);
+        for (i = 0; i < z->nthreads; i++) {
+            pthread_join(z->threads[i], NULL);
+        }
+    }
+    if (z->slot != NULL) {
+        pthread_mutex_destroy(&z->lock);
+        pthread_cond_destroy(&z->work);
+        pthread_cond_destroy(&z->done);
+        for (i = 0; i < z->nslots; i++) {
+            free(z->slot[i].buf);
+        }
+    }
+    ZSTD_freeDStream(z->ds);
+    if (z->mapsz > 0) {
+        munmap((void *) z->map, z->mapsz);
+    }
+    free(z->slot);
+    free(z->threads);
+    free(z->fr);
+    free(z);
+    return 0;
+}
+
+/* decoder threads and their slots, 0 if not even one thread started */
+static int
+start_decoders(ZST *z, int threads)
+{
+    int i;
+
+    z->nslots = 2 * threads;
+    z->slot = calloc(z->nslots, sizeof(ZSLOT));
+    z->threads = calloc(threads, sizeof(pthread_t));
+    if (z->slot == NULL || z->threads == NULL) {
+        free(z->slot);
+        z->slot = NULL;
+        return 0;
+    }
+    for (i = 0; i < z->nslots; i++) {
+        z->slot[i].frame = -1;
+    }
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->work, NULL);
+    pthread_cond_init(&z->done, NULL);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&z->threads[i], NULL, decoder, z) != 0) {
+            break;
+        }
+        z->nthreads++;
+    }
+    return z->nthreads > 0;
+}
+
+extern FILE *
+zst_open(const char *path, int threads)
+{
+    cookie_io_functions_t io;
+    struct stat st;
+    ZST *z;
+    FILE *f;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    z = calloc(1, sizeof(ZST));
+    if (z == NULL || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        free(z);
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    z->mapsz = st.st_size;
+    if (z->mapsz > 0) {
+        z->map = mmap(NULL, z->mapsz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (z->map == MAP_FAILED) {
+            close(fd);
+            free(z);
+            return NULL;
+        }
+    }
+    close(fd);
+
+    if ((index_table(z) || (z->nfr = 0, z->size = 0, index_walk(z))) && z->nfr > 0) {
+        if (!start_decoders(z, threads < 1 ? 1 : threads)) {
+            zst_close(z);
+            errno = EAGAIN;
+            return NULL;
+        }
+    } else {
+        z->ds = ZSTD_createDStream();
+        if (z->ds == NULL || ZSTD_isError(ZSTD_initDStream(z->ds))) {
+            zst_close(z);
+            errno = ENOMEM;
+            return NULL;
+        }
+        z->in.src = z->map;
+        z->in.size = z->mapsz;
+        z->in.pos = 0;
+    }
+
+    io.read = zst_read;
+    io.write = NULL;
+    io.seek = zst_seek;
+    io.close = zst_close;
+    f = fopencookie(z, "rb", io);
+    if (f == NULL) {
+        zst_close(z);
+    }
+    return f;
+}
+
+#else /* built without zstd */
+
+extern FILE *
+zst_open(const char *path, int threads)
+{
+    (void) path;
+    (void) threads;
+    errno = ENOSYS;
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,33 @@
+/*****************************************************************************/
+/*
+ * zstd compressed input for XPSNR command line driver.
+ *
+ * Written by the sxpsnr contributors.
+ * This file is public domain.
+ */
+/*****************************************************************************/
+
+#ifndef _ZST_H_
+#define _ZST_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+/* 1 if the file name ends in .zst */
+extern int zst_name(const char *name);
+/* open a zstd compressed file as a read-only stream of its decompressed
+ * bytes. a file made of several frames that all record their size (pzstd,
+ * t2sz, the zstd seekable format) can seek and has up to threads frames
+ * decompressed ahead in parallel, anything else is decompressed in order
+ * and can't seek, like a pipe. fileno() of the stream is -1.
+ * NULL on failure, with errno ENOSYS if built without zstd (SXPSNR_ZSTD) */
+extern FILE *zst_open(const char *path, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+#!/bin/sh
+# Check that the working tree computes bit-identical block weights and
+# sums to an earlier revision, for changes that must not move a single
+# bit, like reordering how the block weights are computed.
+#
+# Generated 4:2:0 clips are scored at 352x288 (block weight smoothing)
+# and 2560x1440 (above HD, downsampled activity), at 30 and 60 fps:
+# - a small program built against xpsnr.c of each side prints every block
+#   weight and the sums after each frame with %a, so any changed bit shows
+# - band mode (-max_mem=) is checked through the -part= records of both
+#   command line tools, when the revision has them
+#
+#   tools/exact.sh [revision]    (default: HEAD)
+set -eu
+
+rev=${1:-HEAD}
+cc=${CC:-cc}
+cflags="-std=c99 -O2 -fno-math-errno -w"
+libs="-lm -lpthread"
+if [ "$(uname)" = Linux ]; then
+    libs="$libs -lrt"
+fi
+root=$(git rev-parse --show-toplevel)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# gen w h frames seed: static gradient on the left, moving texture on the
+# right, with a little noise unless seed is 0
+cat > "$tmp/gen.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char **argv)
+{
+    int w, h, n, f, p, x, y;
+    unsigned s;
+
+    if (argc != 5) {
+        return 1;
+    }
+    w = atoi(argv[1]);
+    h = atoi(argv[2]);
+    n = atoi(argv[3]);
+    s = (unsigned) atoi(argv[4]);
+    for (f = 0; f < n; f++) {
+        for (p = 0; p < 3; p++) {
+            const int pw = p ? w / 2 : w;
+            const int ph = p ? h / 2 : h;
+
+            for (y = 0; y < ph; y++) {
+                for (x = 0; x < pw; x++) {
+                    int v = x < pw / 2 ? (x + y) & 255 : (((x + 3 * f) * (y + f)) >> 3) & 255;
+
+                    if (s != 0) {
+                        s = s * 1103515245u + 12345u;
+                        v += (int) ((s >> 16) % 9) - 4;
+                        v = v < 0 ? 0 : v > 255 ? 255 : v;
+                    }
+                    putchar(v);
+                }
+            }
+        }
+    }
+    return 0;
+}
+EOF
+
+# dump w h fps ref dst: block weights and sums after every frame
+cat > "$tmp/dump.c" <<'EOF'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "xpsnr.h"
+
+/* the block count of xpsnr.c, which older revisions don't export */
+static uint32_t
+block_count(int w, int h)
+{
+    const int b = 4 * (int) (32.0 * sqrt((double) w * h / (3840.0 * 2160.0)) + 0.5);
+
+    return b < 4 ? 0 : (uint32_t) (((w + b - 1) / b) * ((h + b - 1) / b));
+}
+
+/* fields added later (sample step, planes) stay zero, which means planar
+ * with three planes on every revision */
+static void
+planes(XPSNR_FRAME *f, uint8_t *buf, int w, int h)
+{
+    int c;
+
+    memset(f, 0, sizeof(XPSNR_FRAME));
+    for (c = 0; c < 3; c++) {
+        XPSNR_PLANE *p = &f->planes[c];
+
+        p->w = p->stride = c ? w / 2 : w;
+        p->h = c ? h / 2 : h;
+        p->len = p->w * p->h;
+        p->data = buf;
+        buf += p->len;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    XPSNRContext s;
+    XPSNR_META md;
+    XPSNR_FRAME o, r;
+    FILE *rf, *df;
+    uint8_t *rb, *db;
+    size_t fs;
+    uint32_t i, n;
+    int w, h, c;
+
+    if (argc != 6) {
+        return 1;
+    }
+    w = atoi(argv[1]);
+    h = atoi(argv[2]);
+    memset(&s, 0, sizeof(s));
+    memset(&md, 0, sizeof(md));
+    md.width = w;
+    md.height = h;
+    md.fps_num = atoi(argv[3]);
+    md.fps_den = 1;
+    fs = (size_t) w * h * 3 / 2;
+    rb = malloc(fs);
+    db = malloc(fs);
+    rf = fopen(argv[4], "rb");
+    df = fopen(argv[5], "rb");
+    if (rb == NULL || db == NULL || rf == NULL || df == NULL) {
+        return 1;
+    }
+    n = block_count(w, h);
+    while (fread(rb, 1, fs, rf) == fs && fread(db, 1, fs, df) == fs) {
+        planes(&o, rb, w, h);
+        planes(&r, db, w, h);
+        accum(&s, &o, &r, &md);
+        for (i = 0; i < n; i++) {
+            printf("%a\n", s.weights[i]);
+        }
+        for (c = 0; c < 3; c++) {
+            printf("%a %a\n", s.sumWDist[c], s.sumXPSNR[c]);
+        }
+    }
+    return 0;
+}
+EOF
+
+mkdir "$tmp/old"
+git -C "$root" archive "$rev" src | tar -x -C "$tmp/old"
+$cc -O2 "$tmp/gen.c" -o "$tmp/gen"
+for b in old new; do
+    src="$root/src"
+    if [ $b = old ]; then
+        src="$tmp/old/src"
+    fi
+    $cc $cflags "$src"/*.c $libs -o "$tmp/$b.bin"
+    $cc $cflags -I"$src" "$tmp/dump.c" "$src/xpsnr.c" -lm -o "$tmp/$b.dump"
+done
+
+# revisions before -max_mem= and -part= only get the weights compared
+bands=1
+if ! "$tmp/old.bin" 2>&1 | grep -q -e '-max_mem='; then
+    echo "skipped  band mode, $rev has no -max_mem="
+    bands=0
+fi
+fail=0
+check() {
+    if cmp -s "$tmp/old.out" "$tmp/new.out"; then
+        echo "exact    $1"
+    else
+        echo "DIFFERS  $1"
+        fail=1
+    fi
+}
+for size in 352x288:1 2560x1440:12; do
+    geo=${size%:*}
+    w=${geo%x*}
+    h=${geo#*x}
+    "$tmp/gen" "$w" "$h" 6 0 > "$tmp/ref.yuv"
+    "$tmp/gen" "$w" "$h" 6 1 > "$tmp/dst.yuv"
+    for fps in 30 60; do
+        for b in old new; do
+            "$tmp/$b.dump" "$w" "$h" $fps "$tmp/ref.yuv" "$tmp/dst.yuv" > "$tmp/$b.out"
+        done
+        check "$geo $fps fps, weights and sums"
+    done
+    if [ $bands = 0 ]; then
+        continue
+    fi
+    for b in old new; do
+        rm -f "$tmp/$b.out"
+        "$tmp/$b.bin" -ref="$tmp/ref.yuv" -dst="$tmp/dst.yuv" -w="$w" -h="$h" \
+            -max_mem="${size#*:}" -part="$tmp/$b.out" > /dev/null
+    done
+    check "$geo -max_mem=${size#*:}, -part= record"
+done
+exit $fail